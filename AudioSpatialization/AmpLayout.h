@@ -0,0 +1,243 @@
+// Storage order of the amplitude volume and everything indexed like it (bands, channels, visibility bits),
+// and the element format of the amplitude volume itself. Shared by the C++ and by shader.comp / shader.frag
+// through GL_GOOGLE_include_directive, so it sticks to the subset both languages accept: ints, ivec3 and
+// integer arithmetic, with the few float conversions written once per language.
+#ifndef AMP_LAYOUT_H
+#define AMP_LAYOUT_H
+
+#ifdef __cplusplus
+#include <cstdint>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+#define AMP_LAYOUT_FUNC inline
+#define AMP_IVEC3 glm::ivec3
+#define AMP_UINT uint32_t
+#else
+#define AMP_LAYOUT_FUNC
+#define AMP_IVEC3 ivec3
+#define AMP_UINT uint
+#endif
+
+// x-major rows, as the volume has always been stored.
+const int AMP_LAYOUT_LINEAR = 0;
+// 8x8x8 bricks, x-major inside a brick and between bricks, so a z step stays within 2 KB more often than not.
+const int AMP_LAYOUT_BRICKED = 1;
+
+const int AMP_BRICK_SHIFT = 3;
+const int AMP_BRICK_SIZE = 1 << AMP_BRICK_SHIFT;
+const int AMP_BRICK_MASK = AMP_BRICK_SIZE - 1;
+const int AMP_BRICK_CELLS = AMP_BRICK_SIZE * AMP_BRICK_SIZE * AMP_BRICK_SIZE;
+
+AMP_LAYOUT_FUNC AMP_IVEC3 ampBrickCount(AMP_IVEC3 extent) {
+
+	return (extent + AMP_BRICK_MASK) >> AMP_BRICK_SHIFT;
+
+}
+
+// Elements a volume of this extent occupies; the bricked layout pads every axis to whole bricks.
+AMP_LAYOUT_FUNC int ampStorageSize(AMP_IVEC3 extent, int volumeLayout) {
+
+	if (volumeLayout == AMP_LAYOUT_BRICKED) {
+		AMP_IVEC3 bricks = ampBrickCount(extent);
+		return bricks.x * bricks.y * bricks.z * AMP_BRICK_CELLS;
+	}
+
+	return extent.x * extent.y * extent.z;
+
+}
+
+AMP_LAYOUT_FUNC int ampBrickID(AMP_IVEC3 cell, AMP_IVEC3 extent) {
+
+	AMP_IVEC3 bricks = ampBrickCount(extent);
+	AMP_IVEC3 brick = cell >> AMP_BRICK_SHIFT;
+	return brick.x + brick.y * bricks.x + brick.z * bricks.x * bricks.y;
+
+}
+
+// Position of a cell within its brick.
+AMP_LAYOUT_FUNC int ampBrickLocal(AMP_IVEC3 cell) {
+
+	AMP_IVEC3 local = cell & AMP_BRICK_MASK;
+	return local.x + (local.y << AMP_BRICK_SHIFT) + (local.z << (2 * AMP_BRICK_SHIFT));
+
+}
+
+AMP_LAYOUT_FUNC int ampCellIndex(AMP_IVEC3 cell, AMP_IVEC3 extent, int volumeLayout) {
+
+	if (volumeLayout == AMP_LAYOUT_BRICKED) {
+		return ampBrickID(cell, extent) * AMP_BRICK_CELLS + ampBrickLocal(cell);
+	}
+
+	return cell.x + cell.y * extent.x + cell.z * extent.x * extent.y;
+
+}
+
+// Brick table of a sparse volume (SparseVolume.h), one entry per brick: the pool cell of an open brick's
+// first cell, AMP_BRICK_FAR plus the single pool cell a far field brick shares, or AMP_BRICK_SOLID for a
+// brick inside geometry, which has no storage at all.
+const AMP_UINT AMP_BRICK_SOLID = 0xFFFFFFFFu;
+const AMP_UINT AMP_BRICK_FAR = 0x80000000u;
+
+// Pool cell holding cell, -1 inside solid bricks.
+AMP_LAYOUT_FUNC int ampPoolCell(AMP_UINT entry, AMP_IVEC3 cell) {
+
+	if (entry == AMP_BRICK_SOLID) {
+		return -1;
+	}
+
+	if ((entry & AMP_BRICK_FAR) != 0u) {
+		return int(entry & ~AMP_BRICK_FAR);
+	}
+
+	return int(entry) + ampBrickLocal(cell);
+
+}
+
+// Element formats of the amplitude volume, packed into 32 bit words low cell first. Only the broadband
+// amplitude is packed: the band (32 B) and source channel (36 B) volumes stay float, so of 72 B per cell
+// HALF saves 2 and LOG8 saves 3. Neither buys room for a finer grid until those two are packed as well.
+// FLOAT: exact.
+// HALF: IEEE fp16, relative error about 2^-11 (0.05%) down to 6.1e-5, absolute error under 3e-8 below that.
+// LOG8: 0 is silence, codes 1..255 step evenly in log2 from 2^-AMP_LOG8_RANGE of the run's scale up to the
+// scale itself, so every amplitude in that span comes back within 2^(AMP_LOG8_RANGE / 508) (2.2%, 0.19 dB);
+// quieter, negative and unsolved cells read as 0. The other formats ignore the scale.
+const int AMP_FORMAT_FLOAT = 0;
+const int AMP_FORMAT_HALF = 1;
+const int AMP_FORMAT_LOG8 = 2;
+
+const float AMP_LOG8_RANGE = 16.0;
+
+AMP_LAYOUT_FUNC int ampElementBits(int format) {
+
+	return format == AMP_FORMAT_LOG8 ? 8 : (format == AMP_FORMAT_HALF ? 16 : 32);
+
+}
+
+// Words holding cells elements of the given format.
+AMP_LAYOUT_FUNC int ampWordCount(int cells, int format) {
+
+	int perWord = 32 / ampElementBits(format);
+	return (cells + perWord - 1) / perWord;
+
+}
+
+AMP_LAYOUT_FUNC int ampWordIndex(int cell, int format) {
+
+	return cell / (32 / ampElementBits(format));
+
+}
+
+AMP_LAYOUT_FUNC AMP_UINT ampElementShift(int cell, int format) {
+
+	int perWord = 32 / ampElementBits(format);
+	return AMP_UINT((cell % perWord) * ampElementBits(format));
+
+}
+
+AMP_LAYOUT_FUNC AMP_UINT ampElementMask(int format) {
+
+	return format == AMP_FORMAT_FLOAT ? 0xFFFFFFFFu : ((1u << AMP_UINT(ampElementBits(format))) - 1u);
+
+}
+
+// LOG8 scale: the loudest amplitude in each run of AMP_SCALE_CELLS storage cells, which is exactly one brick
+// in the bricked layout and in a sparse pool's open bricks. A quiet brick far from the source then spends all
+// its codes below its own peak rather than below 1, and amplitudes above 1 no longer clip.
+const int AMP_SCALE_CELLS = AMP_BRICK_CELLS;
+
+AMP_LAYOUT_FUNC int ampScaleIndex(int cell) {
+
+	return cell / AMP_SCALE_CELLS;
+
+}
+
+AMP_LAYOUT_FUNC int ampScaleCount(int cells) {
+
+	return (cells + AMP_SCALE_CELLS - 1) / AMP_SCALE_CELLS;
+
+}
+
+#ifdef __cplusplus
+
+inline uint32_t ampEncode(float amp, int format, float scale) {
+
+	if (format == AMP_FORMAT_HALF) {
+		return glm::packHalf1x16(amp);
+	}
+
+	if (format == AMP_FORMAT_LOG8) {
+		float level = amp > 0.0f && scale > 0.0f ? std::log2(std::min(amp / scale, 1.0f)) / AMP_LOG8_RANGE + 1.0f : -1.0f;
+		return level < 0.0f ? 0u : 1u + static_cast<uint32_t>(std::round(level * 254.0f));
+	}
+
+	uint32_t bits;
+	std::memcpy(&bits, &amp, sizeof(bits));
+	return bits;
+
+}
+
+inline float ampDecode(uint32_t element, int format, float scale) {
+
+	if (format == AMP_FORMAT_HALF) {
+		return glm::unpackHalf1x16(static_cast<uint16_t>(element));
+	}
+
+	if (format == AMP_FORMAT_LOG8) {
+		return element == 0u ? 0.0f : scale * std::exp2((float(element - 1u) / 254.0f - 1.0f) * AMP_LOG8_RANGE);
+	}
+
+	float amp;
+	std::memcpy(&amp, &element, sizeof(amp));
+	return amp;
+
+}
+
+#else
+
+AMP_UINT ampEncode(float amp, int format, float scale) {
+
+	if (format == AMP_FORMAT_HALF) {
+		return packHalf2x16(vec2(amp, 0.0)) & 0xFFFFu;
+	}
+
+	if (format == AMP_FORMAT_LOG8) {
+		float level = amp > 0.0 && scale > 0.0 ? log2(min(amp / scale, 1.0)) / AMP_LOG8_RANGE + 1.0 : -1.0;
+		return level < 0.0 ? 0u : 1u + uint(round(level * 254.0));
+	}
+
+	return floatBitsToUint(amp);
+
+}
+
+float ampDecode(AMP_UINT element, int format, float scale) {
+
+	if (format == AMP_FORMAT_HALF) {
+		return unpackHalf2x16(element).x;
+	}
+
+	if (format == AMP_FORMAT_LOG8) {
+		return element == 0u ? 0.0 : scale * exp2((float(element - 1u) / 254.0 - 1.0) * AMP_LOG8_RANGE);
+	}
+
+	return uintBitsToFloat(element);
+
+}
+
+#endif
+
+// The amplitude of cell from the word holding it and the scale of its run.
+AMP_LAYOUT_FUNC float ampDecodeCell(AMP_UINT word, int cell, int format, float scale) {
+
+	return ampDecode((word >> ampElementShift(cell, format)) & ampElementMask(format), format, scale);
+
+}
+
+#ifdef __cplusplus
+const char* const AMP_LAYOUT_NAMES[] = { "LINEAR", "BRICKED" };
+const char* const AMP_FORMAT_NAMES[] = { "FLOAT", "HALF", "LOG8" };
+#endif
+
+#endif
@@ -0,0 +1,293 @@
+#include "AmplitudeField.h"
+#include "SparseVolume.h"
+#include <immintrin.h>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+#if defined(__AVX2__)
+const size_t LANES = 8;
+#else
+const size_t LANES = 4;
+#endif
+
+}
+
+AmplitudeField::AmplitudeField(const float* data, const glm::uvec3& gridSize, const glm::vec3& gridMin, float cellSize, uint32_t stride, int layout,
+	const SparseVolume* sparse) :
+	data(data), gridSize(gridSize), gridMin(gridMin), inverseCellSize(1.0f / cellSize), stride(stride), layout(layout), sparse(sparse) {
+
+	// Gather offsets are 32 bit.
+	if (size_t(ampStorageSize(glm::ivec3(gridSize), layout)) * stride > size_t(INT32_MAX)) {
+		throw std::runtime_error("Amplitude Field Too Large To Index\n");
+	}
+
+}
+
+float AmplitudeField::sample(const glm::vec3& pos, uint32_t channel) const {
+
+	glm::vec3 gridPos = glm::clamp((pos - gridMin) * inverseCellSize - glm::vec3(0.5f), glm::vec3(0.0f), glm::vec3(gridSize) - glm::vec3(1.0f));
+	glm::uvec3 lower = glm::uvec3(gridPos);
+	glm::uvec3 upper = glm::min(lower + glm::uvec3(1), gridSize - glm::uvec3(1));
+	glm::vec3 frac = gridPos - glm::vec3(lower);
+
+	glm::ivec3 extent = glm::ivec3(gridSize);
+
+	auto at = [&](uint32_t x, uint32_t y, uint32_t z) {
+		if (sparse != nullptr) {
+			int cell = sparse->poolCell(glm::ivec3(x, y, z));
+			return cell < 0 ? 0.0f : data[size_t(cell) * stride + channel];
+		}
+
+		return data[size_t(ampCellIndex(glm::ivec3(x, y, z), extent, layout)) * stride + channel];
+	};
+
+	// Along x, then y, then z; sampleMany does the same in the same order.
+	float c00 = at(lower.x, lower.y, lower.z) + (at(upper.x, lower.y, lower.z) - at(lower.x, lower.y, lower.z)) * frac.x;
+	float c10 = at(lower.x, upper.y, lower.z) + (at(upper.x, upper.y, lower.z) - at(lower.x, upper.y, lower.z)) * frac.x;
+	float c01 = at(lower.x, lower.y, upper.z) + (at(upper.x, lower.y, upper.z) - at(lower.x, lower.y, upper.z)) * frac.x;
+	float c11 = at(lower.x, upper.y, upper.z) + (at(upper.x, upper.y, upper.z) - at(lower.x, upper.y, upper.z)) * frac.x;
+
+	float c0 = c00 + (c10 - c00) * frac.y;
+	float c1 = c01 + (c11 - c01) * frac.y;
+
+	return c0 + (c1 - c0) * frac.z;
+
+}
+
+void AmplitudeField::sampleMany(std::span<const glm::vec3> positions, std::span<float> results, uint32_t channel) const {
+
+	if (results.size() < positions.size()) {
+		throw std::runtime_error("Amplitude Field Results Shorter Than Positions\n");
+	}
+
+	size_t i = 0;
+
+	// A sparse pool goes through the brick table, one position at a time.
+	if (sparse != nullptr) {
+		for (; i < positions.size(); i++) {
+			results[i] = sample(positions[i], channel);
+		}
+
+		return;
+	}
+
+#if defined(__AVX2__)
+	const __m256 half = _mm256_set1_ps(0.5f);
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 scale = _mm256_set1_ps(inverseCellSize);
+	const __m256 minX = _mm256_set1_ps(gridMin.x), minY = _mm256_set1_ps(gridMin.y), minZ = _mm256_set1_ps(gridMin.z);
+	const __m256 maxX = _mm256_set1_ps(float(gridSize.x - 1)), maxY = _mm256_set1_ps(float(gridSize.y - 1)), maxZ = _mm256_set1_ps(float(gridSize.z - 1));
+	const __m256i lastX = _mm256_set1_epi32(gridSize.x - 1), lastY = _mm256_set1_epi32(gridSize.y - 1), lastZ = _mm256_set1_epi32(gridSize.z - 1);
+	const __m256i one = _mm256_set1_epi32(1);
+	const __m256i strideSize = _mm256_set1_epi32(stride);
+	const __m256i channelOffset = _mm256_set1_epi32(channel);
+
+	// ampCellIndex, eight cells at a time.
+	glm::ivec3 bricks = ampBrickCount(glm::ivec3(gridSize));
+	const bool bricked = layout == AMP_LAYOUT_BRICKED;
+	const __m256i brickMask = _mm256_set1_epi32(AMP_BRICK_MASK);
+	const __m256i rowSize = _mm256_set1_epi32(bricked ? bricks.x : gridSize.x);
+	const __m256i sliceSize = _mm256_set1_epi32(bricked ? bricks.x * bricks.y : gridSize.x * gridSize.y);
+
+	auto cellIndex = [&](__m256i cx, __m256i cy, __m256i cz) {
+		if (!bricked) {
+			return _mm256_add_epi32(cx, _mm256_add_epi32(_mm256_mullo_epi32(cy, rowSize), _mm256_mullo_epi32(cz, sliceSize)));
+		}
+
+		__m256i brick = _mm256_add_epi32(_mm256_srai_epi32(cx, AMP_BRICK_SHIFT),
+			_mm256_add_epi32(_mm256_mullo_epi32(_mm256_srai_epi32(cy, AMP_BRICK_SHIFT), rowSize), _mm256_mullo_epi32(_mm256_srai_epi32(cz, AMP_BRICK_SHIFT), sliceSize)));
+		__m256i local = _mm256_add_epi32(_mm256_and_si256(cx, brickMask),
+			_mm256_add_epi32(_mm256_slli_epi32(_mm256_and_si256(cy, brickMask), AMP_BRICK_SHIFT), _mm256_slli_epi32(_mm256_and_si256(cz, brickMask), 2 * AMP_BRICK_SHIFT)));
+
+		return _mm256_add_epi32(_mm256_slli_epi32(brick, 3 * AMP_BRICK_SHIFT), local);
+	};
+
+	for (; i + LANES <= positions.size(); i += LANES) {
+		alignas(32) float x[LANES], y[LANES], z[LANES];
+		for (size_t lane = 0; lane < LANES; lane++) {
+			x[lane] = positions[i + lane].x;
+			y[lane] = positions[i + lane].y;
+			z[lane] = positions[i + lane].z;
+		}
+
+		__m256 gx = _mm256_min_ps(_mm256_max_ps(_mm256_sub_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(x), minX), scale), half), zero), maxX);
+		__m256 gy = _mm256_min_ps(_mm256_max_ps(_mm256_sub_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(y), minY), scale), half), zero), maxY);
+		__m256 gz = _mm256_min_ps(_mm256_max_ps(_mm256_sub_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(z), minZ), scale), half), zero), maxZ);
+
+		__m256i lx = _mm256_cvttps_epi32(gx), ly = _mm256_cvttps_epi32(gy), lz = _mm256_cvttps_epi32(gz);
+		__m256i ux = _mm256_min_epi32(_mm256_add_epi32(lx, one), lastX);
+		__m256i uy = _mm256_min_epi32(_mm256_add_epi32(ly, one), lastY);
+		__m256i uz = _mm256_min_epi32(_mm256_add_epi32(lz, one), lastZ);
+
+		__m256 fx = _mm256_sub_ps(gx, _mm256_cvtepi32_ps(lx));
+		__m256 fy = _mm256_sub_ps(gy, _mm256_cvtepi32_ps(ly));
+		__m256 fz = _mm256_sub_ps(gz, _mm256_cvtepi32_ps(lz));
+
+		auto gather = [&](__m256i cx, __m256i cy, __m256i cz) {
+			__m256i index = _mm256_add_epi32(_mm256_mullo_epi32(cellIndex(cx, cy, cz), strideSize), channelOffset);
+			return _mm256_i32gather_ps(data, index, 4);
+		};
+
+		auto lerp = [](__m256 a, __m256 b, __m256 t) {
+			return _mm256_add_ps(a, _mm256_mul_ps(_mm256_sub_ps(b, a), t));
+		};
+
+		__m256 c00 = lerp(gather(lx, ly, lz), gather(ux, ly, lz), fx);
+		__m256 c10 = lerp(gather(lx, uy, lz), gather(ux, uy, lz), fx);
+		__m256 c01 = lerp(gather(lx, ly, uz), gather(ux, ly, uz), fx);
+		__m256 c11 = lerp(gather(lx, uy, uz), gather(ux, uy, uz), fx);
+
+		_mm256_storeu_ps(&results[i], lerp(lerp(c00, c10, fy), lerp(c01, c11, fy), fz));
+	}
+#else
+	// SSE2 has no gather or 32 bit multiply, so cell offsets and loads are per lane and the rest is vector.
+	// The loads are software pipelined: each group's cells are located and prefetched one group before
+	// they are read, which hides most of the miss latency on scattered queries.
+	const __m128 half = _mm_set1_ps(0.5f);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 scale = _mm_set1_ps(inverseCellSize);
+	const __m128 minX = _mm_set1_ps(gridMin.x), minY = _mm_set1_ps(gridMin.y), minZ = _mm_set1_ps(gridMin.z);
+	const __m128 maxX = _mm_set1_ps(float(gridSize.x - 1)), maxY = _mm_set1_ps(float(gridSize.y - 1)), maxZ = _mm_set1_ps(float(gridSize.z - 1));
+	const glm::ivec3 extent = glm::ivec3(gridSize);
+
+	struct Group {
+		__m128 fx, fy, fz;
+		const float* base[LANES];
+		size_t dx[LANES], dy[LANES], dz[LANES];
+	};
+
+	auto locate = [&](size_t first, Group& group) {
+		alignas(16) float x[LANES], y[LANES], z[LANES];
+		for (size_t lane = 0; lane < LANES; lane++) {
+			x[lane] = positions[first + lane].x;
+			y[lane] = positions[first + lane].y;
+			z[lane] = positions[first + lane].z;
+		}
+
+		__m128 gx = _mm_min_ps(_mm_max_ps(_mm_sub_ps(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(x), minX), scale), half), zero), maxX);
+		__m128 gy = _mm_min_ps(_mm_max_ps(_mm_sub_ps(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(y), minY), scale), half), zero), maxY);
+		__m128 gz = _mm_min_ps(_mm_max_ps(_mm_sub_ps(_mm_mul_ps(_mm_sub_ps(_mm_load_ps(z), minZ), scale), half), zero), maxZ);
+
+		__m128i lx = _mm_cvttps_epi32(gx), ly = _mm_cvttps_epi32(gy), lz = _mm_cvttps_epi32(gz);
+
+		group.fx = _mm_sub_ps(gx, _mm_cvtepi32_ps(lx));
+		group.fy = _mm_sub_ps(gy, _mm_cvtepi32_ps(ly));
+		group.fz = _mm_sub_ps(gz, _mm_cvtepi32_ps(lz));
+
+		alignas(16) int32_t cellX[LANES], cellY[LANES], cellZ[LANES];
+		_mm_store_si128(reinterpret_cast<__m128i*>(cellX), lx);
+		_mm_store_si128(reinterpret_cast<__m128i*>(cellY), ly);
+		_mm_store_si128(reinterpret_cast<__m128i*>(cellZ), lz);
+
+		for (size_t lane = 0; lane < LANES; lane++) {
+			// Both layouts are separable per axis, so the upper neighbour's offset on one axis doesn't depend on
+			// the other two and the eight corners are base plus sums of three steps. The clamp at the last
+			// cell makes its step zero.
+			glm::ivec3 cell = glm::ivec3(cellX[lane], cellY[lane], cellZ[lane]);
+			glm::ivec3 upper = glm::min(cell + 1, extent - 1);
+			int index = ampCellIndex(cell, extent, layout);
+
+			group.dx[lane] = size_t(ampCellIndex(glm::ivec3(upper.x, cell.y, cell.z), extent, layout) - index) * stride;
+			group.dy[lane] = size_t(ampCellIndex(glm::ivec3(cell.x, upper.y, cell.z), extent, layout) - index) * stride;
+			group.dz[lane] = size_t(ampCellIndex(glm::ivec3(cell.x, cell.y, upper.z), extent, layout) - index) * stride;
+			group.base[lane] = data + size_t(index) * stride + channel;
+
+			_mm_prefetch(reinterpret_cast<const char*>(group.base[lane]), _MM_HINT_T0);
+			_mm_prefetch(reinterpret_cast<const char*>(group.base[lane] + group.dy[lane]), _MM_HINT_T0);
+			_mm_prefetch(reinterpret_cast<const char*>(group.base[lane] + group.dz[lane]), _MM_HINT_T0);
+			_mm_prefetch(reinterpret_cast<const char*>(group.base[lane] + group.dy[lane] + group.dz[lane]), _MM_HINT_T0);
+		}
+	};
+
+	auto lerp = [](__m128 a, __m128 b, __m128 t) {
+		return _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), t));
+	};
+
+	auto interpolate = [&](const Group& group, float* out) {
+		alignas(16) float corners[8][LANES];
+		for (size_t lane = 0; lane < LANES; lane++) {
+			const float* base = group.base[lane];
+			size_t dx = group.dx[lane], dy = group.dy[lane], dz = group.dz[lane];
+
+			corners[0][lane] = base[0];
+			corners[1][lane] = base[dx];
+			corners[2][lane] = base[dy];
+			corners[3][lane] = base[dx + dy];
+			corners[4][lane] = base[dz];
+			corners[5][lane] = base[dx + dz];
+			corners[6][lane] = base[dy + dz];
+			corners[7][lane] = base[dx + dy + dz];
+		}
+
+		__m128 c00 = lerp(_mm_load_ps(corners[0]), _mm_load_ps(corners[1]), group.fx);
+		__m128 c10 = lerp(_mm_load_ps(corners[2]), _mm_load_ps(corners[3]), group.fx);
+		__m128 c01 = lerp(_mm_load_ps(corners[4]), _mm_load_ps(corners[5]), group.fx);
+		__m128 c11 = lerp(_mm_load_ps(corners[6]), _mm_load_ps(corners[7]), group.fx);
+
+		_mm_storeu_ps(out, lerp(lerp(c00, c10, group.fy), lerp(c01, c11, group.fy), group.fz));
+	};
+
+	Group groups[2];
+	size_t groupCount = positions.size() / LANES;
+
+	if (groupCount > 0) {
+		locate(0, groups[0]);
+	}
+
+	for (size_t g = 0; g < groupCount; g++) {
+		if (g + 1 < groupCount) {
+			locate((g + 1) * LANES, groups[(g + 1) & 1]);
+		}
+
+		interpolate(groups[g & 1], &results[g * LANES]);
+	}
+
+	i = groupCount * LANES;
+#endif
+
+	for (; i < positions.size(); i++) {
+		results[i] = sample(positions[i], channel);
+	}
+
+}
+
+void AmplitudeField::benchmark(size_t count) const {
+
+	// Fixed seed so runs are comparable; a margin past the grid exercises the clamping.
+	std::mt19937 rng(1);
+	glm::vec3 gridMax = gridMin + glm::vec3(gridSize) / inverseCellSize;
+	std::uniform_real_distribution<float> xs(gridMin.x - 10.0f, gridMax.x + 10.0f);
+	std::uniform_real_distribution<float> ys(gridMin.y - 10.0f, gridMax.y + 10.0f);
+	std::uniform_real_distribution<float> zs(gridMin.z - 10.0f, gridMax.z + 10.0f);
+
+	std::vector<glm::vec3> positions(count);
+	for (auto& pos : positions) {
+		pos = glm::vec3(xs(rng), ys(rng), zs(rng));
+	}
+
+	std::vector<float> scalarResults(count), batchResults(count);
+
+	auto scalarStart = std::chrono::high_resolution_clock::now();
+	for (size_t i = 0; i < count; i++) {
+		scalarResults[i] = sample(positions[i]);
+	}
+	double scalarTime = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - scalarStart).count();
+
+	auto batchStart = std::chrono::high_resolution_clock::now();
+	sampleMany(positions, batchResults);
+	double batchTime = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - batchStart).count();
+
+	float maxDifference = 0.0f;
+	for (size_t i = 0; i < count; i++) {
+		maxDifference = std::max(maxDifference, std::abs(scalarResults[i] - batchResults[i]));
+	}
+
+	std::cout << "SAMPLING BENCHMARK - " << count << " POINTS | SCALAR " << (count / scalarTime) / 1000000.0 << " MSAMPLES/S | " << LANES << " WIDE " << (count / batchTime) / 1000000.0 << " MSAMPLES/S | MAX DIFFERENCE " << maxDifference << "\n";
+
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include <span>
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+#include "AmpLayout.h"
+
+class SparseVolume;
+
+// Read-only view of a solved volume for host side listener queries. The data isn't owned: it is either
+// the CPU solve or VulkanClass's persistently mapped readback of ampBuffer, and stays valid until the
+// next solve rewrites it. Each cell holds stride floats and channel picks one, so the same view serves
+// the broadband volume (stride 1) and the octave bands (stride BAND_COUNT). Cells are found through
+// ampCellIndex, so either storage layout works, or through a SparseVolume's brick table when data is its pool;
+// solid bricks then read as silent.
+class AmplitudeField {
+
+public:
+	AmplitudeField() = default;
+	AmplitudeField(const float* data, const glm::uvec3& gridSize, const glm::vec3& gridMin, float cellSize, uint32_t stride = 1, int layout = AMP_LAYOUT_LINEAR,
+		const SparseVolume* sparse = nullptr);
+
+	// Trilinear between the eight nearest cell centres, clamped to the grid.
+	float sample(const glm::vec3& pos, uint32_t channel = 0) const;
+
+	// sample() for every position, a SIMD register of positions at a time. results must be as long as positions.
+	void sampleMany(std::span<const glm::vec3> positions, std::span<float> results, uint32_t channel = 0) const;
+
+	bool isValid() const { return data != nullptr; }
+	const float* getData() const { return data; }
+	const glm::uvec3& getGridSize() const { return gridSize; }
+	size_t getCellCount() const { return size_t(gridSize.x) * gridSize.y * gridSize.z; }
+
+	// Times sample() against sampleMany() on random points inside the grid and checks they agree.
+	void benchmark(size_t count) const;
+
+private:
+	const float* data = nullptr;
+	glm::uvec3 gridSize{ 0 };
+	glm::vec3 gridMin{ 0.0f };
+	float inverseCellSize = 1.0f;
+	uint32_t stride = 1;
+	int layout = AMP_LAYOUT_LINEAR;
+	const SparseVolume* sparse = nullptr;
+
+};
@@ -0,0 +1,467 @@
+#define MINIAUDIO_IMPLEMENTATION
+#include "AudioEngine.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <random>
+#include <stdexcept>
+#include <thread>
+
+namespace {
+
+// Frames read per decoder call when loading a clip.
+const ma_uint32 DECODE_CHUNK = 1024;
+
+// Frames mixed per pass through the filters. Filter gains step once per block, so this bounds how coarse
+// the glide between two published settings can get; callbacks asking for more are split.
+const ma_uint32 MIX_BLOCK = 64;
+
+// Frames per mix() call in an offline render. Fixed, so the same scene renders the same file every time.
+const ma_uint32 RENDER_BLOCK = 480;
+
+// How long an offline render runs the null backend afterwards, only to check the device path starts.
+const float SMOKE_TEST_SECONDS = 0.05f;
+
+// One octave wide peaking filter per band, and the range its gain is held to.
+const double BAND_Q = 1.414;
+const double MIN_BAND_DB = -24.0;
+const double MAX_BAND_DB = 12.0;
+
+// Per sample step of the gain ramp, about 20 ms to settle at 48 kHz.
+const float GAIN_SMOOTHING = 0.001f;
+
+// Per block step of the band gains, a similar settling time, and the distance below which they snap.
+const double BAND_SMOOTHING = 0.06;
+const double BAND_SNAP_DB = 0.01;
+
+// Partition size of the convolver, which is also the latency it adds.
+const uint32_t CONVOLUTION_BLOCK = 256;
+
+// Room left in the impulse response for the direct arrival, enough for about 85 m of path.
+const float RESPONSE_PADDING = 0.25f;
+
+// Relative band change and path change, in model units, below which the response isn't rebuilt.
+const float RESPONSE_TOLERANCE = 0.01f;
+const float RESPONSE_PATH_TOLERANCE = 1.0f;
+
+// Set on the thread stressTest mixes on, so operator new below counts what that thread allocates.
+thread_local bool countAllocations = false;
+std::atomic<uint32_t> countedAllocations{ 0 };
+
+#ifdef AUDIO_COUNT_ALLOCATIONS
+const bool ALLOCATIONS_COUNTED = true;
+#else
+const bool ALLOCATIONS_COUNTED = false;
+#endif
+
+}
+
+#ifdef AUDIO_COUNT_ALLOCATIONS
+// Replaced only in builds that define AUDIO_COUNT_ALLOCATIONS, to count for stressTest; the application's
+// allocator is otherwise left alone. miniaudio's own C allocations aren't seen, but nothing the mix calls
+// into allocates through it.
+void* operator new(std::size_t size) {
+
+	if (countAllocations) {
+		countedAllocations.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	if (void* memory = std::malloc(size > 0 ? size : 1)) {
+		return memory;
+	}
+
+	throw std::bad_alloc();
+
+}
+
+void operator delete(void* memory) noexcept {
+
+	std::free(memory);
+
+}
+
+void operator delete(void* memory, std::size_t) noexcept {
+
+	std::free(memory);
+
+}
+#endif
+
+AudioEngine::AudioEngine(uint32_t sampleRate, float reverbTime) : sampleRate(sampleRate), reverbTime(reverbTime) {
+
+	responseLength = size_t((reverbTime + RESPONSE_PADDING) * sampleRate);
+
+	scratch.resize(MIX_BLOCK);
+
+}
+
+AudioEngine::~AudioEngine() {
+
+	closeDevice();
+
+	for (auto& voice : voices) {
+		for (int band = 0; band < BAND_COUNT; band++) {
+			ma_peak2_uninit(&voice->filters[band], nullptr);
+		}
+	}
+
+}
+
+uint32_t AudioEngine::addVoice(const std::string& clipPath) {
+
+	ma_decoder_config decoderConfig = ma_decoder_config_init(ma_format_f32, 1, sampleRate);
+	ma_decoder decoder;
+
+	if (ma_decoder_init_file(clipPath.c_str(), &decoderConfig, &decoder) != MA_SUCCESS) {
+		throw std::runtime_error("Failed to Decode Audio Clip\n");
+	}
+
+	float chunk[DECODE_CHUNK];
+	ma_uint64 framesRead = 0;
+	ma_result result;
+	std::vector<float> samples;
+
+	do {
+		result = ma_decoder_read_pcm_frames(&decoder, chunk, DECODE_CHUNK, &framesRead);
+		samples.insert(samples.end(), chunk, chunk + framesRead);
+	} while (result == MA_SUCCESS && framesRead > 0);
+
+	ma_decoder_uninit(&decoder);
+
+	uint32_t index = addVoice(std::move(samples));
+
+	std::cout << "AUDIO CLIP LOADED - " << clipPath << " (" << voices[index]->samples.size() / float(sampleRate) << " s)\n";
+
+	return index;
+
+}
+
+uint32_t AudioEngine::addVoice(std::vector<float> samples) {
+
+	if (deviceOpen) {
+		throw std::runtime_error("Voices Must Be Added Before The Audio Device Starts\n");
+	}
+
+	if (samples.empty()) {
+		throw std::runtime_error("Audio Clip Is Empty\n");
+	}
+
+	auto voice = std::make_unique<Voice>();
+	voice->samples = std::move(samples);
+
+	for (int band = 0; band < BAND_COUNT; band++) {
+		ma_peak2_config filterConfig = ma_peak2_config_init(ma_format_f32, 1, sampleRate, 0.0, BAND_Q, BAND_FREQUENCIES[band]);
+
+		if (ma_peak2_init(&filterConfig, nullptr, &voice->filters[band]) != MA_SUCCESS) {
+			throw std::runtime_error("Failed to Create Band Filter\n");
+		}
+	}
+
+	if (reverbTime > 0.0f) {
+		voice->convolver = std::make_unique<Convolver>(CONVOLUTION_BLOCK, responseLength);
+	}
+
+	voices.push_back(std::move(voice));
+
+	return static_cast<uint32_t>(voices.size() - 1);
+
+}
+
+bool AudioEngine::responseChanged(const Voice& voice, const BandAmplitude& bands, float pathLength) {
+
+	if (std::abs(pathLength - voice.responsePath) > RESPONSE_PATH_TOLERANCE) {
+		return true;
+	}
+
+	for (int band = 0; band < BAND_COUNT; band++) {
+		if (std::abs(bands.amp[band] - voice.responseBands.amp[band]) > RESPONSE_TOLERANCE * std::max(voice.responseBands.amp[band], 1e-6f)) {
+			return true;
+		}
+	}
+
+	return false;
+
+}
+
+void AudioEngine::setVoiceBands(uint32_t voice, const BandAmplitude& bands, float pathLength) {
+
+	// The response carries the band shape and level, so the filters stay flat at unity gain.
+	if (voices[voice]->convolver) {
+		if (!responseChanged(*voices[voice], bands, pathLength)) {
+			return;
+		}
+
+		voices[voice]->responseBands = bands;
+		voices[voice]->responsePath = pathLength;
+		voices[voice]->convolver->setImpulseResponse(synthesizeImpulseResponse(bands, pathLength, reverbTime, sampleRate, responseLength));
+
+		voices[voice]->params.write(VoiceParams{ 1.0f });
+		return;
+	}
+
+	// Overall level is the mean band amplitude; each peaking filter shapes its band relative to it.
+	VoiceParams& params = voices[voice]->params.writeSlot();
+	float mean = 0.0f;
+
+	for (int band = 0; band < BAND_COUNT; band++) {
+		mean += bands.amp[band];
+	}
+
+	mean /= BAND_COUNT;
+	params.gain = mean;
+
+	for (int band = 0; band < BAND_COUNT; band++) {
+		params.bandDB[band] = 0.0f;
+
+		if (mean > 0.0f) {
+			params.bandDB[band] = float(std::clamp(20.0 * std::log10(std::max(bands.amp[band], mean * 0.001f) / mean), MIN_BAND_DB, MAX_BAND_DB));
+		}
+	}
+
+	voices[voice]->params.publish();
+
+}
+
+void AudioEngine::glideFilters(Voice& voice, const VoiceParams& target) {
+
+	// Biquad coefficients are recomputed as the gains glide; ma_peak2_reinit keeps the filter history.
+	for (int band = 0; band < BAND_COUNT; band++) {
+		double delta = target.bandDB[band] - voice.bandDB[band];
+
+		if (delta == 0.0) {
+			continue;
+		}
+
+		voice.bandDB[band] = std::abs(delta) < BAND_SNAP_DB ? target.bandDB[band] : float(voice.bandDB[band] + delta * BAND_SMOOTHING);
+
+		ma_peak2_config filterConfig = ma_peak2_config_init(ma_format_f32, 1, sampleRate, voice.bandDB[band], BAND_Q, BAND_FREQUENCIES[band]);
+		ma_peak2_reinit(&filterConfig, &voice.filters[band]);
+	}
+
+}
+
+void AudioEngine::mix(float* output, ma_uint32 frameCount) {
+
+	memset(output, 0, sizeof(float) * frameCount);
+
+	for (auto& voicePtr : voices) {
+		Voice& voice = *voicePtr;
+
+		voice.params.update();
+		const VoiceParams& target = voice.params.read();
+
+		for (ma_uint32 first = 0; first < frameCount; first += MIX_BLOCK) {
+			ma_uint32 frames = std::min(MIX_BLOCK, frameCount - first);
+
+			glideFilters(voice, target);
+
+			for (ma_uint32 i = 0; i < frames; i++) {
+				voice.gain += (target.gain - voice.gain) * GAIN_SMOOTHING;
+				scratch[i] = voice.samples[voice.cursor] * voice.gain;
+				voice.cursor = (voice.cursor + 1) % voice.samples.size();
+			}
+
+			if (voice.convolver) {
+				voice.convolver->process(scratch.data(), scratch.data(), frames);
+			}
+			else {
+				for (int band = 0; band < BAND_COUNT; band++) {
+					ma_peak2_process_pcm_frames(&voice.filters[band], scratch.data(), scratch.data(), frames);
+				}
+			}
+
+			for (ma_uint32 i = 0; i < frames; i++) {
+				output[first + i] += scratch[i];
+			}
+		}
+	}
+
+}
+
+void AudioEngine::dataCallback(ma_device* device, void* output, const void*, ma_uint32 frameCount) {
+
+	AudioEngine* engine = static_cast<AudioEngine*>(device->pUserData);
+
+	engine->mix(static_cast<float*>(output), frameCount);
+
+}
+
+void AudioEngine::openDevice(bool nullBackend) {
+
+	ma_backend backends[] = { ma_backend_null };
+
+	if (ma_context_init(nullBackend ? backends : nullptr, nullBackend ? 1 : 0, nullptr, &context) != MA_SUCCESS) {
+		throw std::runtime_error("Failed to Create Audio Context\n");
+	}
+	contextOpen = true;
+
+	ma_device_config deviceConfig = ma_device_config_init(ma_device_type_playback);
+	deviceConfig.playback.format = ma_format_f32;
+	deviceConfig.playback.channels = 1;
+	deviceConfig.sampleRate = sampleRate;
+	deviceConfig.dataCallback = dataCallback;
+	deviceConfig.pUserData = this;
+
+	if (ma_device_init(&context, &deviceConfig, &device) != MA_SUCCESS) {
+		throw std::runtime_error("Failed to Open Audio Device\n");
+	}
+	deviceOpen = true;
+
+	if (ma_device_start(&device) != MA_SUCCESS) {
+		throw std::runtime_error("Failed to Start Audio Device\n");
+	}
+
+}
+
+void AudioEngine::closeDevice() {
+
+	if (deviceOpen) {
+		ma_device_uninit(&device);
+		deviceOpen = false;
+	}
+
+	if (contextOpen) {
+		ma_context_uninit(&context);
+		contextOpen = false;
+	}
+
+}
+
+void AudioEngine::start() {
+
+	openDevice(false);
+
+	std::cout << "AUDIO DEVICE STARTED - " << device.playback.name << " | " << voices.size() << " VOICES\n";
+
+}
+
+void AudioEngine::render(const std::string& path, float seconds) {
+
+	ma_encoder encoder;
+	ma_encoder_config encoderConfig = ma_encoder_config_init(ma_encoding_format_wav, ma_format_f32, 1, sampleRate);
+
+	if (ma_encoder_init_file(path.c_str(), &encoderConfig, &encoder) != MA_SUCCESS) {
+		throw std::runtime_error("Failed to Open WAV Output File\n");
+	}
+
+	// Mixed straight into the file, as fast as the CPU allows, rather than paced by a device.
+	const uint64_t totalFrames = static_cast<uint64_t>(std::llround(static_cast<double>(seconds) * sampleRate));
+	std::vector<float> block(RENDER_BLOCK);
+
+	for (uint64_t first = 0; first < totalFrames; first += RENDER_BLOCK) {
+		ma_uint32 frames = static_cast<ma_uint32>(std::min<uint64_t>(RENDER_BLOCK, totalFrames - first));
+		mix(block.data(), frames);
+
+		if (ma_encoder_write_pcm_frames(&encoder, block.data(), frames, nullptr) != MA_SUCCESS) {
+			ma_encoder_uninit(&encoder);
+			throw std::runtime_error("Failed to Write WAV Output File\n");
+		}
+	}
+
+	ma_encoder_uninit(&encoder);
+
+	std::cout << "AUDIO RENDER COMPLETE - " << path << " (" << totalFrames << " FRAMES, " << seconds << " s)\n";
+
+	// The file is already written; this only checks the callback path runs on a device.
+	openDevice(true);
+	std::this_thread::sleep_for(std::chrono::duration<float>(SMOKE_TEST_SECONDS));
+	closeDevice();
+
+}
+
+void AudioEngine::stressTest(float seconds, uint32_t sampleRate) {
+
+	// 375 Hz repeats every 128 samples at 48 kHz, so the looping clip itself never steps.
+	const float PI = 3.14159265359f;
+	const float frequency = 375.0f;
+	const ma_uint32 period = sampleRate / 100;
+
+	for (float reverbTime : { 0.0f, 1.0f }) {
+		AudioEngine engine(sampleRate, reverbTime);
+
+		std::vector<float> clip(sampleRate);
+		for (size_t i = 0; i < clip.size(); i++) {
+			clip[i] = 0.5f * std::sin(2.0f * PI * frequency * i / sampleRate);
+		}
+
+		engine.addVoice(clip);
+		engine.addVoice(clip);
+
+		std::atomic<bool> done{ false };
+		uint32_t callbacks = 0;
+		double worstCallback = 0.0;
+		float maxStep = 0.0f;
+		float peak = 0.0f;
+
+		std::thread audio([&]() {
+
+			std::vector<float> output(period);
+			float previous = 0.0f;
+			auto deadline = std::chrono::steady_clock::now();
+
+			countAllocations = true;
+
+			while (!done.load(std::memory_order_acquire)) {
+				auto start = std::chrono::steady_clock::now();
+				engine.mix(output.data(), period);
+				worstCallback = std::max(worstCallback, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+
+				for (float sample : output) {
+					maxStep = std::max(maxStep, std::abs(sample - previous));
+					peak = std::max(peak, std::abs(sample));
+					previous = sample;
+				}
+
+				callbacks++;
+				deadline += std::chrono::microseconds(1000000 * period / sampleRate);
+				std::this_thread::sleep_until(deadline);
+			}
+
+			countAllocations = false;
+
+		});
+
+		// Worse than any render loop: a new random set for one voice or the other, back to back.
+		std::mt19937 rng(1);
+		std::uniform_real_distribution<float> amplitude(0.0f, 1.0f);
+		uint64_t published = 0;
+		uint32_t allocationsBefore = countedAllocations.load();
+		auto end = std::chrono::steady_clock::now() + std::chrono::duration<float>(seconds);
+
+		while (std::chrono::steady_clock::now() < end) {
+			BandAmplitude bands;
+			for (int band = 0; band < BAND_COUNT; band++) {
+				bands.amp[band] = amplitude(rng);
+			}
+
+			engine.setVoiceBands(static_cast<uint32_t>(published % 2), bands, 1000.0f * amplitude(rng));
+			published++;
+		}
+
+		done.store(true, std::memory_order_release);
+		audio.join();
+
+		uint32_t allocations = countedAllocations.load() - allocationsBefore;
+		double periodSeconds = double(period) / sampleRate;
+		float cleanStep = peak * 2.0f * PI * frequency / sampleRate;
+		float stepRatio = cleanStep > 0.0f ? maxStep / cleanStep : 0.0f;
+
+		std::cout << "AUDIO STRESS TEST - " << (reverbTime > 0.0f ? "REVERB" : "DRY") << " | " << published << " PARAMETER SETS | " << callbacks << " CALLBACKS | WORST "
+			<< worstCallback * 1e6 << " us OF " << periodSeconds * 1e6 << " us | " << (ALLOCATIONS_COUNTED ? std::to_string(allocations) : std::string("UNCOUNTED")) << " ALLOCATIONS | MAX STEP " << stepRatio << "x A CLEAN SINE\n";
+
+		if (allocations > 0) {
+			std::cout << "WARNING - THE AUDIO CALLBACK ALLOCATED\n";
+		}
+		if (worstCallback > periodSeconds) {
+			std::cout << "WARNING - AN AUDIO CALLBACK OVERRAN ITS PERIOD\n";
+		}
+		if (stepRatio > 1.5f) {
+			std::cout << "WARNING - PARAMETER CHANGES CLICK\n";
+		}
+	}
+
+}
@@ -0,0 +1,91 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include <miniaudio.h>
+
+#include "Geometry.h"
+#include "TripleBuffer.h"
+#include "Convolver.h"
+
+// Plays looping mono clips through a per voice octave band EQ driven by the solved amplitude field.
+// The main thread publishes band amplitudes with setVoiceBands; the miniaudio callback picks up the latest
+// set through a triple buffer and glides toward it, so it never waits on the render loop, allocates, or
+// clicks when the field jumps. Voices are added before start() or render() and never removed.
+// With a reverb time set, each voice is instead convolved with an impulse response synthesized from its
+// bands and path length, at a fixed extra latency of one convolution block.
+class AudioEngine {
+
+public:
+	AudioEngine(uint32_t sampleRate = 48000, float reverbTime = 0.0f);
+	~AudioEngine();
+
+	// Decodes the whole clip to mono at the engine rate. Returns the voice index.
+	uint32_t addVoice(const std::string& clipPath);
+	// A voice looping samples, already mono at the engine rate.
+	uint32_t addVoice(std::vector<float> samples);
+	// pathLength, in model units, only matters with reverb on, where it places the direct arrival.
+	void setVoiceBands(uint32_t voice, const BandAmplitude& bands, float pathLength = 0.0f);
+	uint32_t getVoiceCount() { return static_cast<uint32_t>(voices.size()); }
+
+	// Opens the default playback device.
+	void start();
+
+	// Mixes exactly seconds * sampleRate frames offline in fixed blocks and writes them to a WAV file, so the
+	// mix can be checked without a sound card and reproduced. Then runs the null backend briefly as a smoke test.
+	void render(const std::string& path, float seconds);
+
+	// Mixes on a thread paced like a 10 ms device callback while the calling thread publishes random band
+	// sets as fast as it can, dry and with reverb. Reports the slowest callback against its period, the
+	// allocations made on the audio thread (expected 0, counted only when built with AUDIO_COUNT_ALLOCATIONS),
+	// and the largest sample step against that of a steady sine at the output's peak (expected at most
+	// about 1, higher means clicks).
+	static void stressTest(float seconds, uint32_t sampleRate = 48000);
+
+private:
+	// Mix targets for one voice, worked out on the main thread so the callback only interpolates.
+	struct VoiceParams {
+		float gain = 0.0f;
+		float bandDB[BAND_COUNT] = {};
+	};
+
+	struct Voice {
+		std::vector<float> samples;
+		size_t cursor = 0;
+
+		// Main thread writes, callback reads.
+		TripleBuffer<VoiceParams> params;
+		std::unique_ptr<Convolver> convolver;
+
+		// Main thread only: what the current impulse response was built from.
+		BandAmplitude responseBands{};
+		float responsePath = -1.0f;
+
+		// Callback thread only: the values currently applied, chasing params.
+		float gain = 0.0f;
+		float bandDB[BAND_COUNT] = {};
+		ma_peak2 filters[BAND_COUNT];
+	};
+
+	uint32_t sampleRate;
+	float reverbTime;
+	size_t responseLength;
+	std::vector<std::unique_ptr<Voice>> voices;
+	std::vector<float> scratch;
+
+	ma_context context;
+	ma_device device;
+	bool deviceOpen = false;
+	bool contextOpen = false;
+
+	static void dataCallback(ma_device* device, void* output, const void* input, ma_uint32 frameCount);
+	void mix(float* output, ma_uint32 frameCount);
+	void glideFilters(Voice& voice, const VoiceParams& target);
+	bool responseChanged(const Voice& voice, const BandAmplitude& bands, float pathLength);
+	void openDevice(bool nullBackend);
+	void closeDevice();
+
+};
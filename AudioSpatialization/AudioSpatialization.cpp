@@ -1,5 +1,8 @@
 #include "VKConfig.h"
+#include "AudioEngine.h"
 #include <iostream>
+#include <chrono>
+#include <string>
 
 VulkanClass* vk;
 
@@ -9,15 +12,8 @@ namespace win {
 }
 
 namespace camera {
-	float xExtent = 3720;
-	float yExtent = 1550;
-	float zExtent = 2280;
-
-	float minX = 1920.95;
-	float minY = 1429.43;
-	float minZ = 1182.81;
-
-	glm::vec3 pos = (glm::vec3(xExtent, yExtent, zExtent) / glm::vec3(2.0) - glm::vec3(minX, minY, minZ)) * glm::vec3(0.005);// glm::vec3(0.0f, 0.0f, 0.0f);
+	// Set to the centre of the loaded model once VulkanClass has read its extents.
+	glm::vec3 pos = glm::vec3(0.0f);
 	glm::vec3 fwd = glm::vec3(0.0f, 0.0f, 1.0f);
 	glm::vec3 right;
 	glm::vec3 up;
@@ -27,6 +23,24 @@ namespace camera {
 
 Transform transform;
 
+namespace source {
+	// Model units the source moves per key press; five amplitude cells.
+	const float step = 5.0f * AMP_CELL_SIZE;
+	bool moved = false;
+}
+
+namespace audio {
+	AudioEngine* engine = nullptr;
+	std::string clipPath;
+	// Headless WAV render: output file, length, and the listener in model units (defaults to the model centre).
+	std::string renderPath;
+	float renderSeconds = 5.0f;
+	// Convolve with a synthesized impulse response of this RT60 instead of the band EQ; 0 leaves it off.
+	float reverbTime = 0.0f;
+	bool listenerSet = false;
+	glm::vec3 listener;
+}
+
 namespace hostSwapChain {
 	uint32_t currentFrame = 0;
 }
@@ -84,6 +98,35 @@ void keyboardCallback(GLFWwindow* window, int key, int scancode, int action, int
 		//camera::fwd = glm::vec3(camera::fwd.x, sin(camera::Xangle), cos(camera::Xangle));
 	}
 
+	// J/L, U/O and I/K move the sound source along x, y and z; display() re-solves on the next frame.
+	if (action == GLFW_RELEASE) {
+		return;
+	}
+	if (key == GLFW_KEY_J) {
+		vk->sourcePos.x -= source::step;
+		source::moved = true;
+	}
+	if (key == GLFW_KEY_L) {
+		vk->sourcePos.x += source::step;
+		source::moved = true;
+	}
+	if (key == GLFW_KEY_U) {
+		vk->sourcePos.y += source::step;
+		source::moved = true;
+	}
+	if (key == GLFW_KEY_O) {
+		vk->sourcePos.y -= source::step;
+		source::moved = true;
+	}
+	if (key == GLFW_KEY_I) {
+		vk->sourcePos.z += source::step;
+		source::moved = true;
+	}
+	if (key == GLFW_KEY_K) {
+		vk->sourcePos.z -= source::step;
+		source::moved = true;
+	}
+
 }
 
 void windowResizeCallback(GLFWwindow* window, int width, int height) {
@@ -95,26 +138,104 @@ void windowResizeCallback(GLFWwindow* window, int width, int height) {
 }
 
 bool first = true;
+bool cpuSolve = false;
+int ampLayout = AMP_LAYOUT_LINEAR;
+// Render from the trilinear 3D image instead of the nearest cell of the buffer.
+bool volumeImage = false;
+int ampFormat = AMP_FORMAT_FLOAT;
+// Solve only the bricks near geometry, one ray per far field brick, nothing inside solids.
+bool sparseSolve = false;
+// Above 0 (--refine), far field bricks a coarse pass finds a shadow edge or a steeper amplitude step across are solved per cell.
+// The pass reruns when the source moves, within twice the bricks the starting source refined.
+float refineThreshold = 0.0f;
+// Map the model's geometry and acceleration structures from <model>.scene when it matches, and write it when it doesn't.
+bool sceneCache = true;
+// Trace visibility through the BVH, or through the old grid walk to compare against it (--traversal).
+int traversal = TRAVERSAL_BVH;
+// Show the GPU timing panel, and where to write the timings on exit (CSV, or JSON for a .json path).
+bool showGui = false;
+std::string gpuProfilePath;
 
 void display() {
 
 	vkWaitForFences(vk->getLogicalDevice(), 1, &vk->inFlightFence[hostSwapChain::currentFrame], VK_TRUE, UINT32_MAX);
 
-	if (vk->first) {
+	if ((vk->first || source::moved) && cpuSolve) {
+		vk->solveOnCPU();
+
+		vk->first = false;
+		source::moved = false;
+	}
+
+	// After the first solve, dispatch() only traces cells whose view of the source may have changed.
+	if (vk->first || source::moved) {
+		double solveStart = glfwGetTime();
+
 		vk->dispatch();
 
 		vkWaitForFences(vk->getLogicalDevice(), 1, &vk->computeInFlightFence, VK_TRUE, UINT64_MAX);
 
+		vk->getGpuProfiler().collect();
+
+		std::cout << "COMPUTE DISPATCH TIME - " << (glfwGetTime() - solveStart) * 1000.0 << " ms | GPU " << vk->getGpuProfiler().getStats(GpuProfiler::PHASE_SOLVE).lastMs << " ms | "
+			<< vk->getTracedCellCount() << " OF " << vk->ampCellCount << " CELLS TRACED\n";
+
 		vk->first = false;
+		source::moved = false;
 
 		//vk->validateAmpBuffer();
 	}
 
+	if (showGui) {
+		vk->drawGui();
+	}
+
 	vk->draw(hostSwapChain::currentFrame);
 
 	hostSwapChain::currentFrame = (hostSwapChain::currentFrame + 1) % vk->getMaxFramesInFlight();
 
-	//vk->drawGui();
+}
+
+// Voice 0 plays the primary source, voice 1 + i the listed source i, each with its own clip or the --audio clip.
+void createAudioEngine() {
+
+	audio::engine = new AudioEngine(48000, audio::reverbTime);
+	audio::engine->addVoice(audio::clipPath);
+
+	for (const auto& clip : vk->sourceClips) {
+		audio::engine->addVoice(clip.empty() ? audio::clipPath : clip);
+	}
+
+}
+
+// Feeds the field at the listener to the voices: the solved bands for the primary source, and for listed
+// sources their channel amplitude spread over the bands with the same air absorption the solver applies.
+void updateAudio(const glm::vec3& listener) {
+
+	audio::engine->setVoiceBands(0, vk->sampleBands(listener), glm::length(vk->sourcePos - listener));
+
+	if (vk->sources.empty()) {
+		return;
+	}
+
+	SourceChannels channels = vk->sampleChannels(listener);
+
+	for (uint32_t i = 0; i < vk->sources.size(); i++) {
+		BandAmplitude bands{};
+		float dist = glm::length(glm::vec3(vk->sources[i]) - listener);
+
+		for (int k = 0; k < TOP_SOURCES; k++) {
+			if (channels.source[k] != i) {
+				continue;
+			}
+
+			for (int band = 0; band < BAND_COUNT; band++) {
+				bands.amp[band] = channels.amp[k] * attenuatedPower(dist, BAND_FREQUENCIES[band]) / attenuatedPower(dist);
+			}
+		}
+
+		audio::engine->setVoiceBands(1 + i, bands, dist);
+	}
 
 }
 
@@ -134,9 +255,253 @@ void idle() {
 
 	vk->updateTransform();
 
+	// The listener rides with the camera; undo the model scale to get back to model units.
+	if (audio::engine != nullptr && !vk->first) {
+		updateAudio(camera::pos / 0.005f);
+	}
+
 }
 
-int main() {
+// Offline mix to a WAV file after a headless solve, when --render was given.
+void renderAudio() {
+
+	if (audio::renderPath.empty()) {
+		return;
+	}
+
+	if (!audio::listenerSet) {
+		const ModelExtent& extents = vk->getExtents();
+		audio::listener = glm::vec3(extents.xMax + extents.xMin, extents.yMax + extents.yMin, extents.zMax + extents.zMin) * 0.5f;
+	}
+
+	createAudioEngine();
+	updateAudio(audio::listener);
+	audio::engine->render(audio::renderPath, audio::renderSeconds);
+
+	delete audio::engine;
+	audio::engine = nullptr;
+
+}
+
+// Batch solve without a window: load the model, trace the amplitude volume once and write it to disk.
+// With --cpu no Vulkan device is created at all.
+int solveHeadless(const std::string& modelPath, const std::string& outputPath, const std::string& sourcesPath) {
+
+	try {
+		if (cpuSolve) {
+			vk = new VulkanClass(modelPath, true, ampLayout, ampFormat, sparseSolve, refineThreshold, sceneCache);
+			if (!sourcesPath.empty()) {
+				vk->loadSources(sourcesPath);
+			}
+			vk->solveOnCPU();
+			vk->writeAmpBuffer(outputPath);
+			vk->writeBandVolume(outputPath + ".bands");
+			if (!sourcesPath.empty()) {
+				vk->writeSourceChannels(outputPath + ".channels");
+			}
+			renderAudio();
+
+			delete vk;
+			return 0;
+		}
+
+		vk = new VulkanClass(modelPath, false, ampLayout, ampFormat, sparseSolve, refineThreshold, sceneCache, traversal);
+		vk->createTransformBuffer(sizeof(transform));
+		vk->createTransformDescriptorSet();
+		vk->createAmpDescriptorSet();
+		vk->createPosDescriptorSet();
+		vk->createBVHDescriptorSet();
+		vk->tuneComputeWorkgroupSize();
+
+		if (!sourcesPath.empty()) {
+			vk->loadSources(sourcesPath);
+		}
+
+		auto solveStart = std::chrono::high_resolution_clock::now();
+
+		vk->dispatch();
+
+		vkWaitForFences(vk->getLogicalDevice(), 1, &vk->computeInFlightFence, VK_TRUE, UINT64_MAX);
+
+		double solveTime = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - solveStart).count();
+
+		vk->getGpuProfiler().collect();
+		double gpuTime = vk->getGpuProfiler().getStats(GpuProfiler::PHASE_SOLVE).lastMs / 1000.0;
+
+		std::cout << "COMPUTE DISPATCH TIME - " << solveTime * 1000.0 << " ms | " << (vk->ampCellCount / solveTime) / 1000000.0 << " MRAYS/S | GPU "
+			<< gpuTime * 1000.0 << " ms | " << (gpuTime > 0.0 ? (vk->ampCellCount / gpuTime) / 1000000.0 : 0.0) << " MRAYS/S\n";
+
+		for (int phase = GpuProfiler::PHASE_VISIBILITY; phase <= GpuProfiler::PHASE_PACK; phase++) {
+			if (vk->getGpuProfiler().getStats(GpuProfiler::Phase(phase)).count == 0) {
+				continue;
+			}
+
+			std::cout << "  " << GpuProfiler::getPhaseName(GpuProfiler::Phase(phase)) << " PASS - " << vk->getGpuProfiler().getStats(GpuProfiler::Phase(phase)).lastMs << " ms\n";
+		}
+
+		if (!gpuProfilePath.empty()) {
+			vk->getGpuProfiler().write(gpuProfilePath);
+		}
+
+		vk->writeAmpBuffer(outputPath);
+		vk->writeBandVolume(outputPath + ".bands");
+		if (!sourcesPath.empty()) {
+			vk->writeSourceChannels(outputPath + ".channels");
+		}
+		renderAudio();
+
+		vkDeviceWaitIdle(vk->getLogicalDevice());
+
+		delete vk;
+	}
+	catch (const std::exception& e) {
+		std::cout << "HEADLESS SOLVE FAILED - " << e.what();
+		return 1;
+	}
+
+	return 0;
+
+}
+
+// Ray throughput of the CPU kernels on the model, without touching the GPU. The BVH is first checked
+// against the triangle grid it replaced (0 mismatches expected), and the grid is timed with and without
+// its offsets scan. The solve and the volume reads run once per layout, then the solve once more over a
+// sparse volume; compare GPU dispatch times with --headless --layout, --sparse and --traversal. Ends with
+// the convolver and the audio handoff stress test (no overrun or click warnings expected, and 0 allocations
+// in a build that defines AUDIO_COUNT_ALLOCATIONS to count them).
+int runBenchmark(const std::string& modelPath) {
+
+	try {
+		for (int layout : { AMP_LAYOUT_LINEAR, AMP_LAYOUT_BRICKED }) {
+			vk = new VulkanClass(modelPath, true, layout, AMP_FORMAT_FLOAT, false, 0.0f, sceneCache);
+			if (layout == AMP_LAYOUT_LINEAR) {
+				vk->validateBVH(10000);
+				vk->benchmarkTraversal(100000);
+			}
+			vk->solveOnCPU();
+			vk->benchmarkRaymarch(100000);
+			vk->getAmplitudeField().benchmark(1000000);
+
+			delete vk;
+			vk = nullptr;
+		}
+
+		vk = new VulkanClass(modelPath, true, AMP_LAYOUT_LINEAR, AMP_FORMAT_FLOAT, true, 0.0f, sceneCache);
+		vk->solveOnCPU();
+
+		delete vk;
+		vk = nullptr;
+
+		Convolver::benchmark(48000);
+		AudioEngine::stressTest(2.0f);
+	}
+	catch (const std::exception& e) {
+		std::cout << "BENCHMARK FAILED - " << e.what();
+		return 1;
+	}
+
+	return 0;
+
+}
+
+int main(int argc, char** argv) {
+
+	bool headless = false;
+	bool benchmark = false;
+	std::string modelPath = "models/City.obj";
+	std::string outputPath = "amplitudes.bin";
+	std::string sourcesPath;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+
+		if (arg == "--headless") {
+			headless = true;
+		}
+		else if (arg == "--benchmark") {
+			benchmark = true;
+		}
+		else if (arg == "--cpu") {
+			cpuSolve = true;
+		}
+		else if (arg == "--model" && i + 1 < argc) {
+			modelPath = argv[++i];
+		}
+		else if (arg == "--out" && i + 1 < argc) {
+			outputPath = argv[++i];
+		}
+		else if (arg == "--sources" && i + 1 < argc) {
+			sourcesPath = argv[++i];
+		}
+		else if (arg == "--audio" && i + 1 < argc) {
+			audio::clipPath = argv[++i];
+		}
+		else if (arg == "--render" && i + 1 < argc) {
+			audio::renderPath = argv[++i];
+		}
+		else if (arg == "--seconds" && i + 1 < argc) {
+			audio::renderSeconds = std::stof(argv[++i]);
+		}
+		else if (arg == "--listener" && i + 3 < argc) {
+			audio::listener.x = std::stof(argv[++i]);
+			audio::listener.y = std::stof(argv[++i]);
+			audio::listener.z = std::stof(argv[++i]);
+			audio::listenerSet = true;
+		}
+		else if (arg == "--reverb" && i + 1 < argc) {
+			audio::reverbTime = std::stof(argv[++i]);
+		}
+		else if (arg == "--gui") {
+			showGui = true;
+		}
+		else if (arg == "--gpu-profile" && i + 1 < argc) {
+			gpuProfilePath = argv[++i];
+		}
+		else if (arg == "--sparse") {
+			sparseSolve = true;
+		}
+		else if (arg == "--refine" && i + 1 < argc) {
+			refineThreshold = std::stof(argv[++i]);
+		}
+		else if (arg == "--no-scene-cache") {
+			sceneCache = false;
+		}
+		else if (arg == "--volume-image") {
+			volumeImage = true;
+		}
+		else if (arg == "--format" && i + 1 < argc && (std::string(argv[i + 1]) == "float" || std::string(argv[i + 1]) == "half" || std::string(argv[i + 1]) == "log8")) {
+			std::string format = argv[++i];
+			ampFormat = format == "half" ? AMP_FORMAT_HALF : (format == "log8" ? AMP_FORMAT_LOG8 : AMP_FORMAT_FLOAT);
+		}
+		else if (arg == "--traversal" && i + 1 < argc && (std::string(argv[i + 1]) == "bvh" || std::string(argv[i + 1]) == "grid" || std::string(argv[i + 1]) == "grid-rescan")) {
+			std::string trace = argv[++i];
+			traversal = trace == "grid" ? TRAVERSAL_GRID : (trace == "grid-rescan" ? TRAVERSAL_GRID_RESCAN : TRAVERSAL_BVH);
+		}
+		else if (arg == "--layout" && i + 1 < argc && (std::string(argv[i + 1]) == "linear" || std::string(argv[i + 1]) == "bricked")) {
+			ampLayout = std::string(argv[++i]) == "bricked" ? AMP_LAYOUT_BRICKED : AMP_LAYOUT_LINEAR;
+		}
+		else {
+			std::cout << "Usage: AudioSpatialization [--headless] [--cpu] [--benchmark] [--model <path.obj>] [--out <amplitudes.bin>] [--sources <sources.txt>]\n"
+				"       [--audio <clip.wav>] [--render <mix.wav>] [--seconds <n>] [--listener <x> <y> <z>] [--reverb <rt60>]\n"
+				"       [--layout linear|bricked] [--volume-image] [--format float|half|log8] [--sparse] [--refine <threshold>]\n"
+				"       [--gui] [--gpu-profile <timings.csv|timings.json>] [--no-scene-cache] [--traversal bvh|grid|grid-rescan]\n"
+				"--format packs the broadband amplitude only (4 of 72 B per cell); band and source channel volumes stay float.\n";
+			return 1;
+		}
+	}
+
+	if (benchmark) {
+		return runBenchmark(modelPath);
+	}
+
+	if (!audio::renderPath.empty() && audio::clipPath.empty()) {
+		std::cout << "--render needs an --audio clip\n";
+		return 1;
+	}
+
+	if (headless) {
+		return solveHeadless(modelPath, outputPath, sourcesPath);
+	}
 
 	glfwInit();
 
@@ -146,12 +511,30 @@ int main() {
 
 
 
-	vk = new VulkanClass(window);
+	vk = new VulkanClass(window, modelPath, ampLayout, volumeImage, ampFormat, sparseSolve, refineThreshold, sceneCache, traversal);
+
+	const ModelExtent& extents = vk->getExtents();
+	camera::pos = glm::vec3(extents.xMax + extents.xMin, extents.yMax + extents.yMin, extents.zMax + extents.zMin) * glm::vec3(0.5 * 0.005);
 	vk->createTransformBuffer(sizeof(transform));
 	vk->createTransformDescriptorSet();
 	//vk->createAmpBuffer();
 	vk->createAmpDescriptorSet();
 	vk->createPosDescriptorSet();
+	vk->createBVHDescriptorSet();
+	vk->tuneComputeWorkgroupSize();
+
+	if (showGui) {
+		vk->initImGui();
+	}
+
+	if (!sourcesPath.empty()) {
+		vk->loadSources(sourcesPath);
+	}
+
+	if (!audio::clipPath.empty()) {
+		createAudioEngine();
+		audio::engine->start();
+	}
 
 	glfwSetKeyCallback(window, keyboardCallback);
 	glfwSetWindowSizeCallback(window, windowResizeCallback);
@@ -167,6 +550,12 @@ int main() {
 
 	vkDeviceWaitIdle(vk->getLogicalDevice());
 
+	if (!gpuProfilePath.empty()) {
+		vk->getGpuProfiler().collect();
+		vk->getGpuProfiler().write(gpuProfilePath);
+	}
+
+	delete audio::engine;
 	delete vk;
 
 	return 0;
@@ -0,0 +1,381 @@
+#include "BVH.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <stdexcept>
+
+float rayTriangleIntersection(const glm::vec3& start, const glm::vec3& end, const PrecomputedTriangle& T) {
+
+	glm::vec3 edge1 = glm::vec3(T.e1);
+	glm::vec3 edge2 = glm::vec3(T.e2);
+	glm::vec3 normal = glm::vec3(T.v0.w, T.e1.w, T.e2.w);
+	glm::vec3 rayVector = end - start;
+
+	// Only the sign matters for back face culling, so neither vector is normalized.
+	if (glm::dot(normal, rayVector) > 0) {
+		return 0;
+	}
+
+	glm::vec3 rayCrossE2 = glm::cross(rayVector, edge2);
+	float det = glm::dot(edge1, rayCrossE2);
+
+	if (std::abs(det) < 0.000001f) {
+		return 0;
+	}
+
+	float invDet = 1.0f / det;
+	glm::vec3 s = start - glm::vec3(T.v0);
+	float u = invDet * glm::dot(s, rayCrossE2);
+
+	if (u < -0.000001f || u > 1.000001f) {
+		return 0;
+	}
+
+	glm::vec3 sCrossE1 = glm::cross(s, edge1);
+	float v = invDet * glm::dot(rayVector, sCrossE1);
+
+	if (v < -0.000001f || u + v > 1.000001f) {
+		return 0;
+	}
+
+	float t = invDet * glm::dot(edge2, sCrossE1);
+
+	if (t < 0.0f) {
+		return 0;
+	}
+
+	return t;
+
+}
+
+float rayTriangleIntersection(const glm::vec3& start, const glm::vec3& end, const Triangle& T) {
+
+	glm::vec3 normal = glm::normalize(glm::vec3(T.vertices[0].normal + T.vertices[1].normal + T.vertices[2].normal) / 3.0f);
+
+	return rayTriangleIntersection(start, end, precomputeTriangle(glm::vec3(T.vertices[0].pos), glm::vec3(T.vertices[1].pos), glm::vec3(T.vertices[2].pos), normal));
+
+}
+
+float rayBoxIntersection(const glm::vec3& aabbMin, const glm::vec3& aabbMax, const glm::vec3& rayOrigin, const glm::vec3& invDir) {
+
+	glm::vec3 tmin = (aabbMin - rayOrigin) * invDir;
+	glm::vec3 tmax = (aabbMax - rayOrigin) * invDir;
+
+	glm::vec3 tclose = glm::min(tmin, tmax);
+	glm::vec3 tfar = glm::max(tmin, tmax);
+
+	float tClose = std::max(tclose.x, std::max(tclose.y, tclose.z));
+	float tFar = std::min(tfar.x, std::min(tfar.y, tfar.z));
+
+	if (tClose <= tFar && tFar > 0) {
+		return std::max(tClose, 0.0f);
+	}
+
+	return FLT_MAX;
+
+}
+
+bool triangleTouchesCell(const Triangle& T, const glm::ivec3& cell, const ModelExtent& extents) {
+
+	glm::vec3 centroid = glm::vec3(T.vertices[0].pos + T.vertices[1].pos + T.vertices[2].pos) / 3.0f;
+
+	if (getAmpCellID(centroid, extents) == cell) {
+		return true;
+	}
+
+	for (int i = 0; i < 3; i++) {
+		if (getAmpCellID(glm::vec3(T.vertices[i].pos), extents) == cell) {
+			return true;
+		}
+	}
+
+	return false;
+
+}
+
+void BVH::build(const std::vector<Triangle>& triangles) {
+
+	if (triangles.empty()) {
+		throw std::runtime_error("Cannot Build BVH Without Triangles\n");
+	}
+
+	uint32_t numTriangles = static_cast<uint32_t>(triangles.size());
+
+	centroids.resize(numTriangles);
+	triMin.resize(numTriangles);
+	triMax.resize(numTriangles);
+	triIndices.resize(numTriangles);
+
+	for (uint32_t i = 0; i < numTriangles; i++) {
+		glm::vec3 a = glm::vec3(triangles[i].vertices[0].pos);
+		glm::vec3 b = glm::vec3(triangles[i].vertices[1].pos);
+		glm::vec3 c = glm::vec3(triangles[i].vertices[2].pos);
+
+		triMin[i] = glm::min(a, glm::min(b, c));
+		triMax[i] = glm::max(a, glm::max(b, c));
+		centroids[i] = (a + b + c) / 3.0f;
+		triIndices[i] = i;
+	}
+
+	// A binary tree over n leaves never needs more than 2n - 1 nodes.
+	nodes.clear();
+	nodes.resize(2 * numTriangles - 1);
+
+	BVHNode& root = nodes[0];
+	root.leftFirst = 0;
+	root.count = numTriangles;
+	updateBounds(0);
+
+	uint32_t nodesUsed = 1;
+	subdivide(0, 1, nodesUsed);
+
+	nodes.resize(nodesUsed);
+	nodes.shrink_to_fit();
+
+	centroids.clear();
+	centroids.shrink_to_fit();
+	triMin.clear();
+	triMin.shrink_to_fit();
+	triMax.clear();
+	triMax.shrink_to_fit();
+
+}
+
+void BVH::updateBounds(uint32_t nodeIndex) {
+
+	BVHNode& node = nodes[nodeIndex];
+	node.aabbMin = glm::vec3(FLT_MAX);
+	node.aabbMax = glm::vec3(-FLT_MAX);
+
+	for (uint32_t i = node.leftFirst; i < node.leftFirst + node.count; i++) {
+		uint32_t tri = triIndices[i];
+		node.aabbMin = glm::min(node.aabbMin, triMin[tri]);
+		node.aabbMax = glm::max(node.aabbMax, triMax[tri]);
+	}
+
+}
+
+static float surfaceArea(const glm::vec3& aabbMin, const glm::vec3& aabbMax) {
+
+	glm::vec3 e = aabbMax - aabbMin;
+	return e.x * e.y + e.y * e.z + e.z * e.x;
+
+}
+
+float BVH::findBestSplit(const BVHNode& node, int& axis, float& splitPos) const {
+
+	float bestCost = FLT_MAX;
+
+	for (int a = 0; a < 3; a++) {
+		float boundsMin = FLT_MAX;
+		float boundsMax = -FLT_MAX;
+
+		for (uint32_t i = node.leftFirst; i < node.leftFirst + node.count; i++) {
+			float c = centroids[triIndices[i]][a];
+			boundsMin = std::min(boundsMin, c);
+			boundsMax = std::max(boundsMax, c);
+		}
+
+		if (boundsMin == boundsMax) {
+			continue;
+		}
+
+		struct Bin {
+			glm::vec3 aabbMin = glm::vec3(FLT_MAX);
+			glm::vec3 aabbMax = glm::vec3(-FLT_MAX);
+			uint32_t count = 0;
+		} bins[SAH_BINS];
+
+		float scale = SAH_BINS / (boundsMax - boundsMin);
+
+		for (uint32_t i = node.leftFirst; i < node.leftFirst + node.count; i++) {
+			uint32_t tri = triIndices[i];
+			int binIndex = std::min(SAH_BINS - 1, static_cast<int>((centroids[tri][a] - boundsMin) * scale));
+			bins[binIndex].count++;
+			bins[binIndex].aabbMin = glm::min(bins[binIndex].aabbMin, triMin[tri]);
+			bins[binIndex].aabbMax = glm::max(bins[binIndex].aabbMax, triMax[tri]);
+		}
+
+		// Sweep from both sides so every plane between bins is evaluated in linear time.
+		float leftArea[SAH_BINS - 1], rightArea[SAH_BINS - 1];
+		uint32_t leftCount[SAH_BINS - 1], rightCount[SAH_BINS - 1];
+
+		glm::vec3 leftMin = glm::vec3(FLT_MAX), leftMax = glm::vec3(-FLT_MAX);
+		glm::vec3 rightMin = glm::vec3(FLT_MAX), rightMax = glm::vec3(-FLT_MAX);
+		uint32_t leftSum = 0, rightSum = 0;
+
+		for (int i = 0; i < SAH_BINS - 1; i++) {
+			leftSum += bins[i].count;
+			leftCount[i] = leftSum;
+			leftMin = glm::min(leftMin, bins[i].aabbMin);
+			leftMax = glm::max(leftMax, bins[i].aabbMax);
+			leftArea[i] = leftSum > 0 ? surfaceArea(leftMin, leftMax) : 0.0f;
+
+			rightSum += bins[SAH_BINS - 1 - i].count;
+			rightCount[SAH_BINS - 2 - i] = rightSum;
+			rightMin = glm::min(rightMin, bins[SAH_BINS - 1 - i].aabbMin);
+			rightMax = glm::max(rightMax, bins[SAH_BINS - 1 - i].aabbMax);
+			rightArea[SAH_BINS - 2 - i] = rightSum > 0 ? surfaceArea(rightMin, rightMax) : 0.0f;
+		}
+
+		float binWidth = (boundsMax - boundsMin) / SAH_BINS;
+
+		for (int i = 0; i < SAH_BINS - 1; i++) {
+			if (leftCount[i] == 0 || rightCount[i] == 0) {
+				continue;
+			}
+
+			float cost = leftCount[i] * leftArea[i] + rightCount[i] * rightArea[i];
+			if (cost < bestCost) {
+				bestCost = cost;
+				axis = a;
+				splitPos = boundsMin + binWidth * (i + 1);
+			}
+		}
+	}
+
+	return bestCost;
+
+}
+
+void BVH::subdivide(uint32_t nodeIndex, uint32_t depth, uint32_t& nodesUsed) {
+
+	BVHNode& node = nodes[nodeIndex];
+
+	// The traversal stacks only hold BVH_MAX_DEPTH entries; a node that deep stays a leaf, however large.
+	if (node.count <= minLeafSize || depth >= BVH_MAX_DEPTH) {
+		return;
+	}
+
+	int axis = -1;
+	float splitPos = 0.0f;
+	float splitCost = findBestSplit(node, axis, splitPos);
+
+	// Triangles whose centroids coincide cannot be separated by a plane; keep them as one leaf.
+	if (axis < 0) {
+		return;
+	}
+
+	float leafCost = node.count * surfaceArea(node.aabbMin, node.aabbMax);
+	if (splitCost >= leafCost && node.count <= maxLeafSize) {
+		return;
+	}
+
+	int32_t i = node.leftFirst;
+	int32_t j = i + node.count - 1;
+	while (i <= j) {
+		if (centroids[triIndices[i]][axis] < splitPos) {
+			i++;
+		}
+		else {
+			std::swap(triIndices[i], triIndices[j--]);
+		}
+	}
+
+	uint32_t leftCount = i - node.leftFirst;
+	if (leftCount == 0 || leftCount == node.count) {
+		return;
+	}
+
+	uint32_t leftChild = nodesUsed++;
+	uint32_t rightChild = nodesUsed++;
+
+	nodes[leftChild].leftFirst = node.leftFirst;
+	nodes[leftChild].count = leftCount;
+	nodes[rightChild].leftFirst = i;
+	nodes[rightChild].count = node.count - leftCount;
+
+	node.leftFirst = leftChild;
+	node.count = 0;
+
+	updateBounds(leftChild);
+	updateBounds(rightChild);
+
+	subdivide(leftChild, depth + 1, nodesUsed);
+	subdivide(rightChild, depth + 1, nodesUsed);
+
+}
+
+bool BVH::intersect(const std::vector<Triangle>& triangles, const glm::vec3& start, const glm::vec3& end, const ModelExtent& extents, float& closestT) const {
+
+	glm::vec3 dir = end - start;
+	glm::vec3 invDir = 1.0f / dir;
+	glm::ivec3 startCell = getAmpCellID(start, extents);
+
+	closestT = 1.0f;
+	bool hit = false;
+
+	uint32_t stack[BVH_MAX_DEPTH];
+	int stackPtr = 0;
+	stack[stackPtr++] = 0;
+
+	while (stackPtr > 0) {
+		const BVHNode& node = nodes[stack[--stackPtr]];
+
+		if (rayBoxIntersection(node.aabbMin, node.aabbMax, start, invDir) >= closestT) {
+			continue;
+		}
+
+		if (node.count > 0) {
+			for (uint32_t i = node.leftFirst; i < node.leftFirst + node.count; i++) {
+				const Triangle& T = triangles[triIndices[i]];
+
+				if (triangleTouchesCell(T, startCell, extents)) {
+					continue;
+				}
+
+				float t = rayTriangleIntersection(start, end, T);
+				if (t > 0 && t < closestT) {
+					closestT = t;
+					hit = true;
+				}
+			}
+			continue;
+		}
+
+		uint32_t nearChild = node.leftFirst;
+		uint32_t farChild = node.leftFirst + 1;
+		float nearT = rayBoxIntersection(nodes[nearChild].aabbMin, nodes[nearChild].aabbMax, start, invDir);
+		float farT = rayBoxIntersection(nodes[farChild].aabbMin, nodes[farChild].aabbMax, start, invDir);
+
+		if (farT < nearT) {
+			std::swap(nearChild, farChild);
+			std::swap(nearT, farT);
+		}
+
+		if (farT < closestT) {
+			stack[stackPtr++] = farChild;
+		}
+		if (nearT < closestT) {
+			stack[stackPtr++] = nearChild;
+		}
+	}
+
+	return hit;
+
+}
+
+uint32_t BVH::depth() const {
+
+	if (nodes.empty()) {
+		return 0;
+	}
+
+	uint32_t maxDepth = 0;
+	std::vector<std::pair<uint32_t, uint32_t>> stack = { { 0, 1 } };
+
+	while (!stack.empty()) {
+		auto [index, level] = stack.back();
+		stack.pop_back();
+
+		maxDepth = std::max(maxDepth, level);
+
+		if (nodes[index].count == 0) {
+			stack.push_back({ nodes[index].leftFirst, level + 1 });
+			stack.push_back({ nodes[index].leftFirst + 1, level + 1 });
+		}
+	}
+
+	return maxDepth;
+
+}
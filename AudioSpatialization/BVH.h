@@ -0,0 +1,57 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+
+#include "Geometry.h"
+
+// Flattened BVH node, laid out to match the std430 BVHNode struct in shader.comp.
+// Interior nodes have count == 0 and store their left child in leftFirst (the right child is leftFirst + 1).
+// Leaves store the first entry of BVH::triIndices in leftFirst and the number of triangles in count.
+struct BVHNode {
+	glm::vec3 aabbMin;
+	uint32_t leftFirst;
+	glm::vec3 aabbMax;
+	uint32_t count;
+};
+
+// Deepest a BVH gets, root included; subdivide makes a leaf of any node at this depth. A depth first walk
+// holds at most one deferred child per level, so this is also the traversal stack size (BVH_STACK_SIZE in
+// shader.comp and CPUSolver.cpp) that can never overflow.
+const uint32_t BVH_MAX_DEPTH = 64;
+
+class BVH {
+
+public:
+	std::vector<BVHNode> nodes;
+	std::vector<uint32_t> triIndices;
+
+	// Triangles per leaf above which a split is always attempted, and the hard upper bound per leaf.
+	uint32_t minLeafSize = 2;
+	uint32_t maxLeafSize = 8;
+
+	void build(const std::vector<Triangle>& triangles);
+
+	// Closest front facing hit along the segment start -> end, skipping triangles that touch the
+	// amplitude cell the segment starts in (the same rule Collision() applies on the GPU).
+	bool intersect(const std::vector<Triangle>& triangles, const glm::vec3& start, const glm::vec3& end, const ModelExtent& extents, float& closestT) const;
+
+	uint32_t depth() const;
+
+private:
+	static const int SAH_BINS = 16;
+
+	std::vector<glm::vec3> centroids;
+	std::vector<glm::vec3> triMin;
+	std::vector<glm::vec3> triMax;
+
+	void updateBounds(uint32_t nodeIndex);
+	void subdivide(uint32_t nodeIndex, uint32_t depth, uint32_t& nodesUsed);
+	float findBestSplit(const BVHNode& node, int& axis, float& splitPos) const;
+
+};
+
+// Slab test against the inverse segment direction; returns the entry parameter or FLT_MAX on a miss.
+float rayBoxIntersection(const glm::vec3& aabbMin, const glm::vec3& aabbMax, const glm::vec3& rayOrigin, const glm::vec3& invDir);
+
+// True when any vertex or the centroid of T lies in the given amplitude cell.
+bool triangleTouchesCell(const Triangle& T, const glm::ivec3& cell, const ModelExtent& extents);
@@ -0,0 +1,570 @@
+#include "CPUSolver.h"
+#include "SparseVolume.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <immintrin.h>
+
+namespace {
+
+const int BVH_STACK_SIZE = BVH_MAX_DEPTH;
+const float EPSILON = 0.000001f;
+
+float diffractionFactor(float theta, float bandFrequency = REFERENCE_FREQUENCY) {
+
+	return std::min(std::max(std::exp((-1 * std::pow(theta, 2.0f) * (bandFrequency / REFERENCE_FREQUENCY)) / 6), 0.0f), 1.0f);
+
+}
+
+// Diffracted amplitude over a gathered edge list; amplitudeAt(cell) supplies the neighbouring amplitude
+// in whichever band is being solved. Same sum as calculateDiffractedVisibility in shader.comp.
+template<typename Amplitude>
+float diffractedAmplitude(const int edgeCells[], int numEdges, float theta, float bandFrequency, const Amplitude& amplitudeAt) {
+
+	float edgeFactor = std::abs(std::sqrt(std::abs(1 - std::abs(diffractionFactor(theta, bandFrequency)))));
+	float diffractedPower = 0.0f;
+
+	for (int i = 0; i < numEdges; i++) {
+		if (edgeCells[i] >= 0) {
+			diffractedPower += std::abs(edgeFactor * amplitudeAt(edgeCells[i]));
+		}
+	}
+
+	return diffractedPower / std::max(numEdges, 1);
+
+}
+
+// One deque of z slices per thread. The owner pops from the front, idle threads steal from the back.
+class SliceQueue {
+
+public:
+	void push(uint32_t slice) {
+		std::lock_guard<std::mutex> lock(mutex);
+		slices.push_back(slice);
+	}
+
+	bool pop(uint32_t& slice) {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (slices.empty()) {
+			return false;
+		}
+		slice = slices.front();
+		slices.pop_front();
+		return true;
+	}
+
+	bool steal(uint32_t& slice) {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (slices.empty()) {
+			return false;
+		}
+		slice = slices.back();
+		slices.pop_back();
+		return true;
+	}
+
+private:
+	std::mutex mutex;
+	std::deque<uint32_t> slices;
+
+};
+
+// Runs work(z) for every slice. Each thread starts on a contiguous block of slices; no work is added
+// later, so a thread that finds every queue empty is done.
+template<typename Work>
+void forEachSlice(uint32_t sliceCount, unsigned int threadCount, const Work& work) {
+
+	std::vector<SliceQueue> queues(threadCount);
+
+	for (uint32_t z = 0; z < sliceCount; z++) {
+		queues[size_t(z) * threadCount / sliceCount].push(z);
+	}
+
+	auto worker = [&](unsigned int id) {
+		uint32_t slice;
+
+		while (true) {
+			bool found = queues[id].pop(slice);
+
+			for (unsigned int k = 1; k < threadCount && !found; k++) {
+				found = queues[(id + k) % threadCount].steal(slice);
+			}
+
+			if (!found) {
+				return;
+			}
+
+			work(slice);
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (unsigned int i = 1; i < threadCount; i++) {
+		threads.emplace_back(worker, i);
+	}
+
+	worker(0);
+
+	for (auto& thread : threads) {
+		thread.join();
+	}
+
+}
+
+// Loads x, y, z into the first three lanes and repeats x in the fourth, so horizontal min/max over
+// all four lanes equals min/max over xyz.
+inline __m128 loadXYZX(const float* p) {
+	__m128 v = _mm_loadu_ps(p);
+	return _mm_shuffle_ps(v, v, _MM_SHUFFLE(0, 2, 1, 0));
+}
+
+inline __m128 setXYZX(const glm::vec3& v) {
+	return _mm_set_ps(v.x, v.z, v.y, v.x);
+}
+
+// SSE slab test, same arithmetic as rayBoxEntry in shader.comp.
+inline float rayBoxEntry(const BVHNode& node, __m128 origin, __m128 invDir) {
+
+	__m128 tmin = _mm_mul_ps(_mm_sub_ps(loadXYZX(&node.aabbMin.x), origin), invDir);
+	__m128 tmax = _mm_mul_ps(_mm_sub_ps(loadXYZX(&node.aabbMax.x), origin), invDir);
+
+	__m128 tclose = _mm_min_ps(tmin, tmax);
+	__m128 tfar = _mm_max_ps(tmin, tmax);
+
+	tclose = _mm_max_ps(tclose, _mm_shuffle_ps(tclose, tclose, _MM_SHUFFLE(2, 3, 0, 1)));
+	tclose = _mm_max_ps(tclose, _mm_shuffle_ps(tclose, tclose, _MM_SHUFFLE(1, 0, 3, 2)));
+	tfar = _mm_min_ps(tfar, _mm_shuffle_ps(tfar, tfar, _MM_SHUFFLE(2, 3, 0, 1)));
+	tfar = _mm_min_ps(tfar, _mm_shuffle_ps(tfar, tfar, _MM_SHUFFLE(1, 0, 3, 2)));
+
+	float tClose = _mm_cvtss_f32(tclose);
+	float tFar = _mm_cvtss_f32(tfar);
+
+	if (tClose <= tFar && tFar > 0) {
+		return std::max(tClose, 0.0f);
+	}
+
+	return FLT_MAX;
+
+}
+
+// Thin wrappers so one kernel compiles to SSE, AVX2 or AVX-512. Lane masks are vector masks on SSE and
+// AVX2 and k registers on AVX-512; laneBits turns either into one bit per lane.
+#if defined(__AVX512F__)
+typedef __m512 simdf;
+typedef __mmask16 simdmask;
+inline simdf load(const float* p) { return _mm512_load_ps(p); }
+inline simdf splat(float v) { return _mm512_set1_ps(v); }
+inline simdf add(simdf a, simdf b) { return _mm512_add_ps(a, b); }
+inline simdf sub(simdf a, simdf b) { return _mm512_sub_ps(a, b); }
+inline simdf mul(simdf a, simdf b) { return _mm512_mul_ps(a, b); }
+inline simdf div(simdf a, simdf b) { return _mm512_div_ps(a, b); }
+inline simdf absolute(simdf a) { return _mm512_abs_ps(a); }
+inline simdmask greaterEqual(simdf a, simdf b) { return _mm512_cmp_ps_mask(a, b, _CMP_GE_OQ); }
+inline simdmask lessEqual(simdf a, simdf b) { return _mm512_cmp_ps_mask(a, b, _CMP_LE_OQ); }
+inline simdmask greaterThan(simdf a, simdf b) { return _mm512_cmp_ps_mask(a, b, _CMP_GT_OQ); }
+inline simdmask both(simdmask a, simdmask b) { return a & b; }
+inline int laneBits(simdmask m) { return m; }
+inline void store(float* p, simdf a) { _mm512_store_ps(p, a); }
+#elif defined(__AVX2__)
+typedef __m256 simdf;
+typedef __m256 simdmask;
+inline simdf load(const float* p) { return _mm256_load_ps(p); }
+inline simdf splat(float v) { return _mm256_set1_ps(v); }
+inline simdf add(simdf a, simdf b) { return _mm256_add_ps(a, b); }
+inline simdf sub(simdf a, simdf b) { return _mm256_sub_ps(a, b); }
+inline simdf mul(simdf a, simdf b) { return _mm256_mul_ps(a, b); }
+inline simdf div(simdf a, simdf b) { return _mm256_div_ps(a, b); }
+inline simdf absolute(simdf a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+inline simdmask greaterEqual(simdf a, simdf b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+inline simdmask lessEqual(simdf a, simdf b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+inline simdmask greaterThan(simdf a, simdf b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+inline simdmask both(simdmask a, simdmask b) { return _mm256_and_ps(a, b); }
+inline int laneBits(simdmask m) { return _mm256_movemask_ps(m); }
+inline void store(float* p, simdf a) { _mm256_store_ps(p, a); }
+#else
+typedef __m128 simdf;
+typedef __m128 simdmask;
+inline simdf load(const float* p) { return _mm_load_ps(p); }
+inline simdf splat(float v) { return _mm_set1_ps(v); }
+inline simdf add(simdf a, simdf b) { return _mm_add_ps(a, b); }
+inline simdf sub(simdf a, simdf b) { return _mm_sub_ps(a, b); }
+inline simdf mul(simdf a, simdf b) { return _mm_mul_ps(a, b); }
+inline simdf div(simdf a, simdf b) { return _mm_div_ps(a, b); }
+inline simdf absolute(simdf a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+inline simdmask greaterEqual(simdf a, simdf b) { return _mm_cmpge_ps(a, b); }
+inline simdmask lessEqual(simdf a, simdf b) { return _mm_cmple_ps(a, b); }
+inline simdmask greaterThan(simdf a, simdf b) { return _mm_cmpgt_ps(a, b); }
+inline simdmask both(simdmask a, simdmask b) { return _mm_and_ps(a, b); }
+inline int laneBits(simdmask m) { return _mm_movemask_ps(m); }
+inline void store(float* p, simdf a) { _mm_store_ps(p, a); }
+#endif
+
+inline simdf dot3(const simdf a[3], const simdf b[3]) {
+	return add(add(mul(a[0], b[0]), mul(a[1], b[1])), mul(a[2], b[2]));
+}
+
+inline void cross3(const simdf a[3], const simdf b[3], simdf out[3]) {
+	out[0] = sub(mul(a[1], b[2]), mul(b[1], a[2]));
+	out[1] = sub(mul(a[2], b[0]), mul(b[2], a[0]));
+	out[2] = sub(mul(a[0], b[1]), mul(b[0], a[1]));
+}
+
+// Moller-Trumbore against PACKET_WIDTH precomputed triangles at once, with the same tests as
+// rayTriangleIntersection in BVH.cpp and shader.comp. Returns a lane mask of hits and writes their t.
+inline int intersectPacket(const TrianglePacket& P, const simdf s[3], const simdf d[3], float* tOut) {
+
+	simdf zero = splat(0.0f);
+
+	simdf normal[3] = { load(P.normal[0]), load(P.normal[1]), load(P.normal[2]) };
+	simdmask valid = lessEqual(dot3(normal, d), zero);
+
+	simdf e1[3] = { load(P.e1[0]), load(P.e1[1]), load(P.e1[2]) };
+	simdf e2[3] = { load(P.e2[0]), load(P.e2[1]), load(P.e2[2]) };
+
+	simdf rayCrossE2[3];
+	cross3(d, e2, rayCrossE2);
+
+	simdf det = dot3(e1, rayCrossE2);
+	valid = both(valid, greaterEqual(absolute(det), splat(EPSILON)));
+
+	if (laneBits(valid) == 0) {
+		return 0;
+	}
+
+	simdf invDet = div(splat(1.0f), det);
+	simdf lower = splat(-EPSILON);
+	simdf upper = splat(1.0f + EPSILON);
+
+	simdf sv[3] = { sub(s[0], load(P.v0[0])), sub(s[1], load(P.v0[1])), sub(s[2], load(P.v0[2])) };
+
+	simdf u = mul(invDet, dot3(sv, rayCrossE2));
+	valid = both(valid, both(greaterEqual(u, lower), lessEqual(u, upper)));
+
+	simdf sCrossE1[3];
+	cross3(sv, e1, sCrossE1);
+
+	simdf v = mul(invDet, dot3(d, sCrossE1));
+	valid = both(valid, both(greaterEqual(v, lower), lessEqual(add(u, v), upper)));
+
+	simdf t = mul(invDet, dot3(e2, sCrossE1));
+	valid = both(valid, greaterThan(t, zero));
+
+	store(tOut, t);
+
+	return laneBits(valid);
+
+}
+
+}
+
+CPUSolver::CPUSolver(const std::vector<glm::vec4>& positions, const std::vector<Face>& faces, const BVH& bvh, const std::vector<PrecomputedTriangle>& bvhTriangles,
+	const DiffractionEdges& edges, const ModelExtent& extents, const glm::uvec3& gridSize, int layout)
+	: positions(positions), faces(faces), edges(edges), extents(extents), gridSize(gridSize), layout(layout) {
+
+	// Transpose every leaf into packets of PACKET_WIDTH triangles; leaves then point at packets instead of triIndices.
+	nodes = bvh.nodes;
+
+	for (auto& node : nodes) {
+		if (node.count == 0) {
+			continue;
+		}
+
+		uint32_t firstPacket = static_cast<uint32_t>(packets.size());
+
+		for (uint32_t k = 0; k < node.count; k += PACKET_WIDTH) {
+			TrianglePacket P{};
+
+			for (uint32_t lane = 0; lane < PACKET_WIDTH && k + lane < node.count; lane++) {
+				const PrecomputedTriangle& T = bvhTriangles[node.leftFirst + k + lane];
+
+				for (int c = 0; c < 3; c++) {
+					P.v0[c][lane] = T.v0[c];
+					P.e1[c][lane] = T.e1[c];
+					P.e2[c][lane] = T.e2[c];
+				}
+				P.normal[0][lane] = T.v0.w;
+				P.normal[1][lane] = T.e1.w;
+				P.normal[2][lane] = T.e2.w;
+				P.face[lane] = bvh.triIndices[node.leftFirst + k + lane];
+			}
+
+			packets.push_back(P);
+		}
+
+		node.leftFirst = firstPacket;
+		node.count = static_cast<uint32_t>(packets.size()) - firstPacket;
+	}
+
+}
+
+bool CPUSolver::isSkipped(uint32_t x, uint32_t y, uint32_t z) const {
+
+	return occupancy != nullptr && !occupancy->isSolved(glm::ivec3(x, y, z));
+
+}
+
+template<typename Cell>
+void CPUSolver::broadcastFarBricks(Cell* cells, unsigned int threadCount) const {
+
+	if (occupancy == nullptr) {
+		return;
+	}
+
+	forEachSlice(gridSize.z, threadCount, [&](uint32_t z) {
+		for (uint32_t y = 0; y < gridSize.y; y++) {
+			for (uint32_t x = 0; x < gridSize.x; x++) {
+				glm::ivec3 cell(x, y, z);
+
+				if (!occupancy->isSolid(cell) && !occupancy->isSolved(cell)) {
+					glm::ivec3 r = occupancy->representative(cell);
+					cells[cellIndex(x, y, z)] = cells[cellIndex(r.x, r.y, r.z)];
+				}
+			}
+		}
+	});
+
+}
+
+bool CPUSolver::touchesCell(uint32_t face, const glm::ivec3& cell) const {
+
+	const Face& F = faces[face];
+	glm::vec3 p[3] = { glm::vec3(positions[F.v[0]]), glm::vec3(positions[F.v[1]]), glm::vec3(positions[F.v[2]]) };
+
+	if (getAmpCellID((p[0] + p[1] + p[2]) / 3.0f, extents) == cell) {
+		return true;
+	}
+
+	for (int i = 0; i < 3; i++) {
+		if (getAmpCellID(p[i], extents) == cell) {
+			return true;
+		}
+	}
+
+	return false;
+
+}
+
+bool CPUSolver::traverse(const glm::vec3& start, const glm::vec3& end, const glm::ivec3& startCell, float& closestT) const {
+
+	glm::vec3 dir = end - start;
+	glm::vec3 invDir = 1.0f / dir;
+
+	__m128 origin = setXYZX(start);
+	__m128 inv = setXYZX(invDir);
+	simdf s[3] = { splat(start.x), splat(start.y), splat(start.z) };
+	simdf d[3] = { splat(dir.x), splat(dir.y), splat(dir.z) };
+
+	closestT = 1.0f;
+	bool hit = false;
+
+	uint32_t stack[BVH_STACK_SIZE];
+	int stackPtr = 0;
+	stack[stackPtr++] = 0;
+
+	while (stackPtr > 0) {
+		const BVHNode& node = nodes[stack[--stackPtr]];
+
+		if (rayBoxEntry(node, origin, inv) >= closestT) {
+			continue;
+		}
+
+		if (node.count > 0) {
+			for (uint32_t p = node.leftFirst; p < node.leftFirst + node.count; p++) {
+				alignas(PACKET_WIDTH * sizeof(float)) float t[PACKET_WIDTH];
+				int mask = intersectPacket(packets[p], s, d, t);
+
+				if (mask == 0) {
+					continue;
+				}
+
+				for (int lane = 0; lane < PACKET_WIDTH; lane++) {
+					if ((mask & (1 << lane)) && t[lane] < closestT && !touchesCell(packets[p].face[lane], startCell)) {
+						closestT = t[lane];
+						hit = true;
+					}
+				}
+			}
+			continue;
+		}
+
+		uint32_t nearChild = node.leftFirst;
+		uint32_t farChild = node.leftFirst + 1;
+		float nearT = rayBoxEntry(nodes[nearChild], origin, inv);
+		float farT = rayBoxEntry(nodes[farChild], origin, inv);
+
+		if (farT < nearT) {
+			std::swap(nearChild, farChild);
+			std::swap(nearT, farT);
+		}
+
+		if (farT < closestT) {
+			stack[stackPtr++] = farChild;
+		}
+		if (nearT < closestT) {
+			stack[stackPtr++] = nearChild;
+		}
+	}
+
+	return hit;
+
+}
+
+int CPUSolver::gatherDiffractionEdges(const glm::vec3& startPos, const glm::vec3& collisionPoint, const glm::vec3& sourcePos, int edgeCells[], float& theta) const {
+
+	uint32_t nearest[DIFFRACTION_MAX_EDGES];
+	int numEdges = edges.findNearest(collisionPoint, nearest);
+
+	glm::vec3 ray1 = glm::normalize(startPos - collisionPoint);
+	glm::vec3 ray2 = glm::normalize(collisionPoint - sourcePos);
+
+	theta = std::acos(std::clamp(glm::dot(ray1, ray2) / (glm::length(ray1) * glm::length(ray2)), -1.0f, 1.0f));
+
+	for (int i = 0; i < numEdges; i++) {
+		glm::ivec3 ampCell = getAmpCellID(glm::vec3(edges.getEdges()[nearest[i]].midpoint), extents);
+
+		if (glm::any(glm::lessThan(ampCell, glm::ivec3(0))) || glm::any(glm::greaterThanEqual(ampCell, glm::ivec3(gridSize)))) {
+			edgeCells[i] = -1;
+			continue;
+		}
+
+		edgeCells[i] = static_cast<int>(cellIndex(ampCell.x, ampCell.y, ampCell.z));
+	}
+
+	return numEdges;
+
+}
+
+void CPUSolver::solve(const glm::vec3& sourcePos, AmpVolume* ampVolume, BandAmplitude* bands, unsigned int threadCount) {
+
+	if (threadCount == 0) {
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	glm::vec3 gridMin = glm::vec3(extents.xMin, extents.yMin, extents.zMin);
+	size_t storageSize = size_t(ampStorageSize(glm::ivec3(gridSize), layout));
+
+	auto cellPos = [&](uint32_t x, uint32_t y, uint32_t z) {
+		return glm::vec3(x, y, z) * AMP_CELL_SIZE + glm::vec3(AMP_CELL_SIZE / 2.0f) + gridMin;
+	};
+
+	// Hit parameter of each occluded cell, -1 where the source is visible. The diffraction pass
+	// overwrites it with the diffracted amplitude so ampVolume stays untouched until the last pass.
+	std::vector<float> hitT(storageSize);
+	std::vector<BandAmplitude> diffractedBands(storageSize);
+
+	// Direct pass: ampVolume and bands hold the attenuated direct amplitude that diffraction samples.
+	forEachSlice(gridSize.z, threadCount, [&](uint32_t z) {
+		for (uint32_t y = 0; y < gridSize.y; y++) {
+			for (uint32_t x = 0; x < gridSize.x; x++) {
+				size_t flatID = cellIndex(x, y, z);
+
+				// Unsolved cells stay silent through the final pass: no diffraction, zero diffracted bands.
+				if (isSkipped(x, y, z)) {
+					ampVolume[flatID].amp = 0.0f;
+					hitT[flatID] = 0.0f;
+					bands[flatID] = BandAmplitude{};
+					continue;
+				}
+
+				glm::vec3 startPos = cellPos(x, y, z);
+				float dist = glm::length(sourcePos - startPos);
+
+				float t;
+				bool occluded = traverse(startPos, sourcePos, glm::ivec3(x, y, z), t);
+
+				ampVolume[flatID].amp = attenuatedPower(dist) * (occluded ? 0.0f : 1.0f);
+				hitT[flatID] = occluded ? t : -1.0f;
+
+				for (int band = 0; band < BAND_COUNT; band++) {
+					bands[flatID].amp[band] = occluded ? 0.0f : attenuatedPower(dist, BAND_FREQUENCIES[band]);
+				}
+			}
+		}
+	});
+
+	// Diffraction pass, mirroring shader.comp's separate diffraction dispatch: every occluded cell sees the
+	// finished direct pass. Edges are gathered once and reused by every band.
+	forEachSlice(gridSize.z, threadCount, [&](uint32_t z) {
+		int edgeCells[DIFFRACTION_MAX_EDGES];
+
+		for (uint32_t y = 0; y < gridSize.y; y++) {
+			for (uint32_t x = 0; x < gridSize.x; x++) {
+				size_t flatID = cellIndex(x, y, z);
+
+				if (hitT[flatID] < 0.0f || isSkipped(x, y, z)) {
+					continue;
+				}
+
+				glm::vec3 startPos = cellPos(x, y, z);
+				glm::vec3 collisionPoint = startPos + hitT[flatID] * (sourcePos - startPos);
+				float dist = glm::length(sourcePos - startPos);
+
+				float theta;
+				int numEdges = gatherDiffractionEdges(startPos, collisionPoint, sourcePos, edgeCells, theta);
+
+				hitT[flatID] = attenuatedPower(dist) * diffractedAmplitude(edgeCells, numEdges, theta, REFERENCE_FREQUENCY, [&](int cell) { return ampVolume[cell].amp; });
+
+				for (int band = 0; band < BAND_COUNT; band++) {
+					diffractedBands[flatID].amp[band] = attenuatedPower(dist, BAND_FREQUENCIES[band]) *
+						diffractedAmplitude(edgeCells, numEdges, theta, BAND_FREQUENCIES[band], [&](int cell) { return bands[cell].amp[band]; });
+				}
+			}
+		}
+	});
+
+	// Final values match what the passes of shader.comp leave behind: 1 where visible, the diffracted amplitude elsewhere.
+	forEachSlice(gridSize.z, threadCount, [&](uint32_t z) {
+		for (uint32_t y = 0; y < gridSize.y; y++) {
+			for (uint32_t x = 0; x < gridSize.x; x++) {
+				size_t i = cellIndex(x, y, z);
+				ampVolume[i].amp = hitT[i] < 0.0f ? 1.0f : hitT[i];
+
+				if (hitT[i] >= 0.0f) {
+					bands[i] = diffractedBands[i];
+				}
+			}
+		}
+	});
+
+	broadcastFarBricks(ampVolume, threadCount);
+	broadcastFarBricks(bands, threadCount);
+
+}
+
+void CPUSolver::solveSources(const std::vector<glm::vec4>& sources, SourceChannels* channels, unsigned int threadCount) {
+
+	if (threadCount == 0) {
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	glm::vec3 gridMin = glm::vec3(extents.xMin, extents.yMin, extents.zMin);
+
+	forEachSlice(gridSize.z, threadCount, [&](uint32_t z) {
+		for (uint32_t y = 0; y < gridSize.y; y++) {
+			for (uint32_t x = 0; x < gridSize.x; x++) {
+				glm::vec3 startPos = glm::vec3(x, y, z) * AMP_CELL_SIZE + glm::vec3(AMP_CELL_SIZE / 2.0f) + gridMin;
+
+				SourceChannels c{};
+				std::fill(c.source, c.source + TOP_SOURCES, 0xFFFFFFFFu);
+
+				for (uint32_t i = 0; i < sources.size() && !isSkipped(x, y, z); i++) {
+					float t;
+
+					if (traverse(startPos, glm::vec3(sources[i]), glm::ivec3(x, y, z), t)) {
+						continue;
+					}
+
+					addContribution(c, i, sources[i].w * attenuatedPower(glm::length(glm::vec3(sources[i]) - startPos)));
+				}
+
+				channels[cellIndex(x, y, z)] = c;
+			}
+		}
+	});
+
+	broadcastFarBricks(channels, threadCount);
+
+}
@@ -0,0 +1,77 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+
+#include "Geometry.h"
+#include "BVH.h"
+#include "DiffractionEdges.h"
+
+class SparseVolume;
+
+// Triangles tested per kernel call: 16 with AVX-512 (the ReleaseAVX512 configuration), 8 with AVX2 (the
+// other x64 configurations), otherwise 4 with SSE.
+#if defined(__AVX512F__)
+const int PACKET_WIDTH = 16;
+#elif defined(__AVX2__)
+const int PACKET_WIDTH = 8;
+#else
+const int PACKET_WIDTH = 4;
+#endif
+
+// PACKET_WIDTH precomputed triangles in SoA form for the intersection kernel. Unused lanes have zero
+// edges, which the determinant test rejects.
+struct alignas(PACKET_WIDTH * sizeof(float)) TrianglePacket {
+	float v0[3][PACKET_WIDTH];
+	float e1[3][PACKET_WIDTH];
+	float e2[3][PACKET_WIDTH];
+	float normal[3][PACKET_WIDTH];
+	uint32_t face[PACKET_WIDTH];
+};
+
+// C++ port of shader.comp: BVH visibility, attenuatedPower and calculateDiffractedVisibility,
+// spread over all cores by work stealing z slices. Writes the same AmpVolume layout as the GPU, in the
+// storage order given by layout (AMP_LAYOUT_*).
+class CPUSolver {
+
+public:
+	// bvhTriangles holds the precomputed triangles in BVH leaf order, the same array shader.comp reads.
+	CPUSolver(const std::vector<glm::vec4>& positions, const std::vector<Face>& faces, const BVH& bvh, const std::vector<PrecomputedTriangle>& bvhTriangles,
+		const DiffractionEdges& edges, const ModelExtent& extents, const glm::uvec3& gridSize, int layout = AMP_LAYOUT_LINEAR);
+
+	// threadCount 0 uses every hardware thread. bands receives the octave band amplitudes, one BandAmplitude per cell.
+	void solve(const glm::vec3& sourcePos, AmpVolume* ampVolume, BandAmplitude* bands, unsigned int threadCount = 0);
+
+	// Direct amplitude from every source (xyz position, w gain) into one SourceChannels per cell. Mirrors solveSources in shader.comp.
+	void solveSources(const std::vector<glm::vec4>& sources, SourceChannels* channels, unsigned int threadCount = 0);
+
+	// Solve only the cells occupancy->isSolved() picks: solid cells come out silent and far field bricks take
+	// their representative's values, as the GPU leaves them in a sparse pool. nullptr solves every cell.
+	void setOccupancy(const SparseVolume* volume) { occupancy = volume; }
+
+	// Closest front facing hit along start -> end, skipping triangles touching startCell. Mirrors traverseBVH.
+	bool traverse(const glm::vec3& start, const glm::vec3& end, const glm::ivec3& startCell, float& closestT) const;
+
+private:
+	const std::vector<glm::vec4>& positions;
+	const std::vector<Face>& faces;
+	const DiffractionEdges& edges;
+
+	ModelExtent extents;
+	glm::uvec3 gridSize;
+	int layout;
+	const SparseVolume* occupancy = nullptr;
+
+	// Copy of the BVH whose leaves index packets rather than triangles.
+	std::vector<BVHNode> nodes;
+	std::vector<TrianglePacket> packets;
+
+	size_t cellIndex(uint32_t x, uint32_t y, uint32_t z) const { return size_t(ampCellIndex(glm::ivec3(x, y, z), glm::ivec3(gridSize), layout)); }
+	bool isSkipped(uint32_t x, uint32_t y, uint32_t z) const;
+	// Copies each far field brick's representative over the rest of the brick.
+	template<typename Cell>
+	void broadcastFarBricks(Cell* cells, unsigned int threadCount) const;
+	bool touchesCell(uint32_t face, const glm::ivec3& cell) const;
+	// Diffraction edges near collisionPoint as flat amplitude cell ids (-1 outside the grid) and the bend angle theta.
+	int gatherDiffractionEdges(const glm::vec3& startPos, const glm::vec3& collisionPoint, const glm::vec3& sourcePos, int edgeCells[], float& theta) const;
+
+};
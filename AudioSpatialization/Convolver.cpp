@@ -0,0 +1,404 @@
+#include "Convolver.h"
+#include <immintrin.h>
+#include <miniaudio.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+
+namespace {
+
+const double PI = 3.14159265358979323846;
+
+// Bins are padded so the multiply-accumulate runs whole vectors; the padding stays zero in every filter.
+const uint32_t BIN_ALIGNMENT = 8;
+
+// Octave band-pass used to shape each band of a synthesized response.
+const double BAND_Q = 1.414;
+
+// Diffuse tail energy relative to the direct arrival, per band.
+const float DIFFUSE_RATIO = 0.5f;
+
+// Seed for the tail noise, fixed so consecutive responses differ only in level and shape.
+const uint32_t TAIL_SEED = 0x5eed;
+
+}
+
+RealFFT::RealFFT(uint32_t half) : half(half) {
+
+	if (half == 0 || (half & (half - 1)) != 0) {
+		throw std::runtime_error("FFT Size Must Be A Power Of Two\n");
+	}
+
+	uint32_t bits = 0;
+	while ((1u << bits) < half) {
+		bits++;
+	}
+
+	bitReverse.resize(half);
+	for (uint32_t i = 0; i < half; i++) {
+		uint32_t reversed = 0;
+		for (uint32_t b = 0; b < bits; b++) {
+			reversed |= ((i >> b) & 1) << (bits - 1 - b);
+		}
+		bitReverse[i] = reversed;
+	}
+
+	// twiddle k is e^(-i pi k / half), k < half + 1. Every stage of the half point FFT uses the even
+	// entries; the split step of the real transform uses all of them.
+	twiddleRe.resize(half + 1);
+	twiddleIm.resize(half + 1);
+	for (uint32_t k = 0; k <= half; k++) {
+		twiddleRe[k] = float(std::cos(PI * k / half));
+		twiddleIm[k] = float(-std::sin(PI * k / half));
+	}
+
+	splitRe.resize(half);
+	splitIm.resize(half);
+	workRe.resize(half);
+	workIm.resize(half);
+
+}
+
+void RealFFT::transform(float* re, float* im, bool inverse) {
+
+	for (uint32_t i = 0; i < half; i++) {
+		uint32_t j = bitReverse[i];
+		if (i < j) {
+			std::swap(re[i], re[j]);
+			std::swap(im[i], im[j]);
+		}
+	}
+
+	float sign = inverse ? -1.0f : 1.0f;
+
+	for (uint32_t size = 2; size <= half; size <<= 1) {
+		uint32_t step = 2 * half / size;
+
+		for (uint32_t start = 0; start < half; start += size) {
+			for (uint32_t k = 0; k < size / 2; k++) {
+				float wr = twiddleRe[k * step];
+				float wi = sign * twiddleIm[k * step];
+
+				uint32_t a = start + k;
+				uint32_t b = a + size / 2;
+
+				float tr = re[b] * wr - im[b] * wi;
+				float ti = re[b] * wi + im[b] * wr;
+
+				re[b] = re[a] - tr;
+				im[b] = im[a] - ti;
+				re[a] += tr;
+				im[a] += ti;
+			}
+		}
+	}
+
+}
+
+void RealFFT::forward(const float* signal, float* re, float* im) {
+
+	// Even samples become the real part and odd samples the imaginary part of a half size signal.
+	for (uint32_t n = 0; n < half; n++) {
+		workRe[n] = signal[2 * n];
+		workIm[n] = signal[2 * n + 1];
+	}
+
+	transform(workRe.data(), workIm.data(), false);
+
+	// Separate the even and odd spectra and recombine them into the bins of the full size transform.
+	for (uint32_t k = 0; k <= half; k++) {
+		float zr = workRe[k % half];
+		float zi = workIm[k % half];
+		float cr = workRe[(half - k) % half];
+		float ci = -workIm[(half - k) % half];
+
+		float evenRe = 0.5f * (zr + cr);
+		float evenIm = 0.5f * (zi + ci);
+		float oddRe = 0.5f * (zi - ci);
+		float oddIm = -0.5f * (zr - cr);
+
+		re[k] = evenRe + twiddleRe[k] * oddRe - twiddleIm[k] * oddIm;
+		im[k] = evenIm + twiddleRe[k] * oddIm + twiddleIm[k] * oddRe;
+	}
+
+}
+
+void RealFFT::inverse(const float* re, const float* im, float* signal) {
+
+	for (uint32_t k = 0; k < half; k++) {
+		float xr = re[k];
+		float xi = im[k];
+		float cr = re[half - k];
+		float ci = -im[half - k];
+
+		float evenRe = 0.5f * (xr + cr);
+		float evenIm = 0.5f * (xi + ci);
+		float diffRe = 0.5f * (xr - cr);
+		float diffIm = 0.5f * (xi - ci);
+
+		// Undo the forward twiddle with its conjugate.
+		float oddRe = diffRe * twiddleRe[k] + diffIm * twiddleIm[k];
+		float oddIm = diffIm * twiddleRe[k] - diffRe * twiddleIm[k];
+
+		splitRe[k] = evenRe - oddIm;
+		splitIm[k] = evenIm + oddRe;
+	}
+
+	transform(splitRe.data(), splitIm.data(), true);
+
+	float scale = 1.0f / half;
+
+	for (uint32_t n = 0; n < half; n++) {
+		signal[2 * n] = splitRe[n] * scale;
+		signal[2 * n + 1] = splitIm[n] * scale;
+	}
+
+}
+
+// Everything the audio thread touches is sized here, including all three handoff slots.
+Convolver::Convolver(uint32_t blockSize, size_t maxResponseLength) :
+	blockSize(blockSize),
+	bins((blockSize + 1 + BIN_ALIGNMENT - 1) / BIN_ALIGNMENT * BIN_ALIGNMENT),
+	maxPartitions(std::max<uint32_t>(1, uint32_t((maxResponseLength + blockSize - 1) / blockSize))),
+	setupFFT(blockSize),
+	pending(Spectra{ 0, std::vector<float>(size_t(maxPartitions) * bins), std::vector<float>(size_t(maxPartitions) * bins) }),
+	fft(blockSize) {
+
+	filter = pending.read();
+
+	setupBlock.assign(2 * blockSize, 0.0f);
+
+	delayRe.assign(size_t(maxPartitions) * bins, 0.0f);
+	delayIm.assign(size_t(maxPartitions) * bins, 0.0f);
+	window.assign(2 * blockSize, 0.0f);
+	accumRe.assign(bins, 0.0f);
+	accumIm.assign(bins, 0.0f);
+	result.assign(2 * blockSize, 0.0f);
+	fadeResult.assign(2 * blockSize, 0.0f);
+	inputBlock.assign(blockSize, 0.0f);
+	outputBlock.assign(blockSize, 0.0f);
+
+}
+
+void Convolver::setImpulseResponse(const std::vector<float>& response) {
+
+	Spectra& spectra = pending.writeSlot();
+	spectra.partitions = std::min(maxPartitions, uint32_t((response.size() + blockSize - 1) / blockSize));
+
+	// Each partition is zero padded to twice the block so the overlap-save product doesn't wrap.
+	for (uint32_t p = 0; p < spectra.partitions; p++) {
+		size_t first = size_t(p) * blockSize;
+		size_t count = std::min<size_t>(blockSize, response.size() - first);
+
+		std::fill(setupBlock.begin(), setupBlock.end(), 0.0f);
+		std::copy(response.begin() + first, response.begin() + first + count, setupBlock.begin());
+
+		setupFFT.forward(setupBlock.data(), &spectra.re[size_t(p) * bins], &spectra.im[size_t(p) * bins]);
+	}
+
+	pending.publish();
+
+}
+
+void Convolver::convolve(const Spectra& spectra, float* output) {
+
+	std::fill(accumRe.begin(), accumRe.end(), 0.0f);
+	std::fill(accumIm.begin(), accumIm.end(), 0.0f);
+
+	// Partition p of the filter meets the input spectrum from p blocks ago.
+	for (uint32_t p = 0; p < spectra.partitions; p++) {
+		const float* xr = &delayRe[size_t((delayHead + p) % maxPartitions) * bins];
+		const float* xi = &delayIm[size_t((delayHead + p) % maxPartitions) * bins];
+		const float* hr = &spectra.re[size_t(p) * bins];
+		const float* hi = &spectra.im[size_t(p) * bins];
+
+#if defined(__AVX__)
+		for (uint32_t k = 0; k < bins; k += 8) {
+			__m256 ar = _mm256_loadu_ps(xr + k);
+			__m256 ai = _mm256_loadu_ps(xi + k);
+			__m256 br = _mm256_loadu_ps(hr + k);
+			__m256 bi = _mm256_loadu_ps(hi + k);
+
+			__m256 real = _mm256_sub_ps(_mm256_mul_ps(ar, br), _mm256_mul_ps(ai, bi));
+			__m256 imag = _mm256_add_ps(_mm256_mul_ps(ar, bi), _mm256_mul_ps(ai, br));
+
+			_mm256_storeu_ps(&accumRe[k], _mm256_add_ps(_mm256_loadu_ps(&accumRe[k]), real));
+			_mm256_storeu_ps(&accumIm[k], _mm256_add_ps(_mm256_loadu_ps(&accumIm[k]), imag));
+		}
+#else
+		for (uint32_t k = 0; k < bins; k += 4) {
+			__m128 ar = _mm_loadu_ps(xr + k);
+			__m128 ai = _mm_loadu_ps(xi + k);
+			__m128 br = _mm_loadu_ps(hr + k);
+			__m128 bi = _mm_loadu_ps(hi + k);
+
+			__m128 real = _mm_sub_ps(_mm_mul_ps(ar, br), _mm_mul_ps(ai, bi));
+			__m128 imag = _mm_add_ps(_mm_mul_ps(ar, bi), _mm_mul_ps(ai, br));
+
+			_mm_storeu_ps(&accumRe[k], _mm_add_ps(_mm_loadu_ps(&accumRe[k]), real));
+			_mm_storeu_ps(&accumIm[k], _mm_add_ps(_mm_loadu_ps(&accumIm[k]), imag));
+		}
+#endif
+	}
+
+	// Only the second half of the circular result is free of wrap-around.
+	fft.inverse(accumRe.data(), accumIm.data(), output);
+
+}
+
+void Convolver::processBlock() {
+
+	// Slide the two block window along and push its spectrum onto the front of the delay line.
+	std::copy(window.begin() + blockSize, window.end(), window.begin());
+	std::copy(inputBlock.begin(), inputBlock.end(), window.begin() + blockSize);
+
+	delayHead = (delayHead + maxPartitions - 1) % maxPartitions;
+	fft.forward(window.data(), &delayRe[size_t(delayHead) * bins], &delayIm[size_t(delayHead) * bins]);
+
+	if (!pending.update()) {
+		convolve(filter, result.data());
+		std::copy(result.begin() + blockSize, result.end(), outputBlock.begin());
+		return;
+	}
+
+	// A new response arrived: run the old and new filters over this block and fade between them.
+	convolve(filter, fadeResult.data());
+
+	// The read slot stays ours only until the next update() hands it back to the main thread, and the
+	// filter it holds is still needed then as the old side of the next fade, so it is copied out.
+	const Spectra& next = pending.read();
+	size_t used = size_t(next.partitions) * bins;
+
+	filter.partitions = next.partitions;
+	std::copy(next.re.begin(), next.re.begin() + used, filter.re.begin());
+	std::copy(next.im.begin(), next.im.begin() + used, filter.im.begin());
+
+	convolve(filter, result.data());
+
+	for (uint32_t i = 0; i < blockSize; i++) {
+		float t = (i + 1) / float(blockSize);
+		outputBlock[i] = fadeResult[blockSize + i] * (1.0f - t) + result[blockSize + i] * t;
+	}
+
+}
+
+void Convolver::process(const float* input, float* output, uint32_t frameCount) {
+
+	// Output lags input by exactly one block: each finished block is played out while the next one fills.
+	uint32_t done = 0;
+
+	while (done < frameCount) {
+		uint32_t frames = std::min(frameCount - done, blockSize - fill);
+
+		std::copy(input + done, input + done + frames, inputBlock.begin() + fill);
+		std::copy(outputBlock.begin() + fill, outputBlock.begin() + fill + frames, output + done);
+
+		fill += frames;
+		done += frames;
+
+		if (fill == blockSize) {
+			processBlock();
+			fill = 0;
+		}
+	}
+
+}
+
+void Convolver::benchmark(uint32_t sampleRate) {
+
+	const uint32_t blockSize = 256;
+	const uint32_t blocks = 2000;
+	const float lengths[] = { 0.25f, 0.5f, 1.0f, 2.0f, 4.0f };
+
+	std::mt19937 rng(TAIL_SEED);
+	std::uniform_real_distribution<float> noise(-1.0f, 1.0f);
+
+	std::vector<float> input(blockSize), output(blockSize);
+	for (auto& sample : input) {
+		sample = noise(rng);
+	}
+
+	for (float seconds : lengths) {
+		size_t length = size_t(seconds * sampleRate);
+
+		std::vector<float> response(length);
+		for (auto& sample : response) {
+			sample = noise(rng);
+		}
+
+		Convolver convolver(blockSize, length);
+		convolver.setImpulseResponse(response);
+		convolver.process(input.data(), output.data(), blockSize);
+
+		auto start = std::chrono::high_resolution_clock::now();
+
+		for (uint32_t i = 0; i < blocks; i++) {
+			convolver.process(input.data(), output.data(), blockSize);
+		}
+
+		double perBlock = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count() / blocks;
+		double budget = double(blockSize) / sampleRate;
+
+		std::cout << "CONVOLUTION BENCHMARK - " << seconds << " s IR | " << blockSize << " FRAME BLOCKS | " << perBlock * 1e6 << " us/block | " << int(budget / perBlock) << " CHANNELS PER CORE\n";
+	}
+
+}
+
+std::vector<float> synthesizeImpulseResponse(const BandAmplitude& bands, float pathLength, float reverbTime, uint32_t sampleRate, size_t length) {
+
+	std::vector<float> response(length, 0.0f);
+	std::vector<float> band(length);
+
+	// Model units are centimetres.
+	size_t arrival = size_t(pathLength / 100.0f / 343.0f * sampleRate);
+
+	if (arrival >= length) {
+		return response;
+	}
+
+	// Scales unit noise so the tail carries DIFFUSE_RATIO of the direct energy.
+	float tailScale = 0.0f;
+	if (reverbTime > 0.0f) {
+		tailScale = std::sqrt(DIFFUSE_RATIO * 2.0f * 6.91f / (reverbTime * sampleRate));
+	}
+
+	for (int b = 0; b < BAND_COUNT; b++) {
+		std::fill(band.begin(), band.end(), 0.0f);
+
+		if (bands.amp[b] <= 0.0f) {
+			continue;
+		}
+
+		band[arrival] = bands.amp[b];
+
+		std::mt19937 rng(TAIL_SEED + b);
+		std::uniform_real_distribution<float> noise(-1.0f, 1.0f);
+
+		for (size_t i = arrival + 1; i < length && tailScale > 0.0f; i++) {
+			float t = float(i - arrival) / sampleRate;
+			float decay = std::exp(-6.91f * t / reverbTime) * attenuatedPower(t * 343.0f * 100.0f, BAND_FREQUENCIES[b]);
+
+			band[i] = bands.amp[b] * tailScale * decay * noise(rng);
+		}
+
+		ma_bpf2_config filterConfig = ma_bpf2_config_init(ma_format_f32, 1, sampleRate, BAND_FREQUENCIES[b], BAND_Q);
+		ma_bpf2 filter;
+
+		if (ma_bpf2_init(&filterConfig, nullptr, &filter) != MA_SUCCESS) {
+			throw std::runtime_error("Failed to Create Band Filter\n");
+		}
+
+		ma_bpf2_process_pcm_frames(&filter, band.data(), band.data(), length);
+		ma_bpf2_uninit(&filter, nullptr);
+
+		for (size_t i = 0; i < length; i++) {
+			response[i] += band[i];
+		}
+	}
+
+	return response;
+
+}
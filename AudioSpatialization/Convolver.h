@@ -0,0 +1,86 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+
+#include "Geometry.h"
+#include "TripleBuffer.h"
+
+// Radix-2 FFT of a real signal of size 2 * half, done as one complex FFT of size half.
+// Spectra hold half + 1 bins in split real/imaginary arrays; inverse() undoes forward() exactly.
+// Each instance owns its scratch, so use one per thread.
+class RealFFT {
+
+public:
+	RealFFT(uint32_t half);
+
+	void forward(const float* signal, float* re, float* im);
+	void inverse(const float* re, const float* im, float* signal);
+
+private:
+	uint32_t half;
+	std::vector<uint32_t> bitReverse;
+	std::vector<float> twiddleRe, twiddleIm;
+	std::vector<float> splitRe, splitIm;
+	std::vector<float> workRe, workIm;
+
+	void transform(float* re, float* im, bool inverse);
+
+};
+
+// Uniformly partitioned overlap-save convolution of a mono stream with an impulse response.
+// The impulse response is cut into blockSize partitions whose spectra are multiplied against a delay
+// line of input spectra every block, so the cost is flat per block and the latency is exactly blockSize
+// frames whatever the response length. setImpulseResponse runs on the main thread and hands the new
+// spectra over through a triple buffer; process runs on the audio thread, never allocates, and crossfades
+// over one block when the response changes.
+class Convolver {
+
+public:
+	Convolver(uint32_t blockSize, size_t maxResponseLength);
+
+	void setImpulseResponse(const std::vector<float>& response);
+	void process(const float* input, float* output, uint32_t frameCount);
+
+	uint32_t getLatency() { return blockSize; }
+
+	// Times single-threaded blocks across response lengths and reports how many channels one core sustains.
+	static void benchmark(uint32_t sampleRate);
+
+private:
+	struct Spectra {
+		uint32_t partitions = 0;
+		std::vector<float> re, im;
+	};
+
+	uint32_t blockSize;
+	uint32_t bins;
+	uint32_t maxPartitions;
+
+	// Main thread.
+	RealFFT setupFFT;
+	std::vector<float> setupBlock;
+
+	TripleBuffer<Spectra> pending;
+
+	// Audio thread.
+	RealFFT fft;
+	Spectra filter;
+	std::vector<float> delayRe, delayIm;
+	uint32_t delayHead = 0;
+	std::vector<float> window;
+	std::vector<float> accumRe, accumIm;
+	std::vector<float> result, fadeResult;
+	std::vector<float> inputBlock, outputBlock;
+	uint32_t fill = 0;
+
+	void processBlock();
+	void convolve(const Spectra& spectra, float* output);
+
+};
+
+// Builds a response at the listener from the solved octave band amplitudes: the direct arrival after
+// pathLength model units, then an exponentially decaying diffuse tail that reaches -60 dB after
+// reverbTime seconds, with the higher bands losing energy to air absorption as it travels. Each band is
+// shaped by an octave band-pass, and the tail noise is seeded the same way every call so successive
+// responses crossfade without flanging.
+std::vector<float> synthesizeImpulseResponse(const BandAmplitude& bands, float pathLength, float reverbTime, uint32_t sampleRate, size_t length);
@@ -0,0 +1,174 @@
+#include "DiffractionEdges.h"
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+namespace {
+
+const float PI = 3.14159265359f;
+
+// Winding normal of a face, turned to agree with the averaged vertex normal culling uses. Zero when degenerate.
+glm::vec3 faceNormal(const std::vector<glm::vec4>& positions, const Face& F) {
+
+	glm::vec3 p0 = glm::vec3(positions[F.v[0]]);
+	glm::vec3 normal = glm::cross(glm::vec3(positions[F.v[1]]) - p0, glm::vec3(positions[F.v[2]]) - p0);
+	float length = glm::length(normal);
+
+	if (length == 0.0f) {
+		return glm::vec3(0.0f);
+	}
+
+	normal /= length;
+
+	return glm::dot(normal, glm::vec3(F.normal)) < 0.0f ? -normal : normal;
+
+}
+
+}
+
+DiffractionEdges::DiffractionEdges(const std::vector<glm::vec4>& positions, const std::vector<Face>& faces) {
+
+	std::vector<glm::vec3> normals(faces.size());
+
+	// Every face corner's outgoing edge keyed by its two position ids, lower first, so sorting groups an edge's faces.
+	std::vector<std::pair<uint64_t, uint32_t>> faceEdges;
+	faceEdges.reserve(faces.size() * 3);
+
+	for (uint32_t f = 0; f < faces.size(); f++) {
+		normals[f] = faceNormal(positions, faces[f]);
+
+		if (normals[f] == glm::vec3(0.0f)) {
+			continue;
+		}
+
+		for (int corner = 0; corner < 3; corner++) {
+			uint32_t a = faces[f].v[corner];
+			uint32_t b = faces[f].v[(corner + 1) % 3];
+			faceEdges.emplace_back((uint64_t(std::min(a, b)) << 32) | std::max(a, b), f);
+		}
+	}
+
+	std::sort(faceEdges.begin(), faceEdges.end());
+
+	for (size_t first = 0; first < faceEdges.size();) {
+		size_t last = first + 1;
+		while (last < faceEdges.size() && faceEdges[last].first == faceEdges[first].first) {
+			last++;
+		}
+
+		uint32_t a = static_cast<uint32_t>(faceEdges[first].first >> 32);
+		uint32_t b = static_cast<uint32_t>(faceEdges[first].first);
+		glm::vec3 midpoint = (glm::vec3(positions[a]) + glm::vec3(positions[b])) / 2.0f;
+
+		size_t shared = last - first;
+		first = last;
+
+		if (shared != 2) {
+			edges.push_back({ glm::vec4(midpoint, 0.0f) });
+			openEdges++;
+			continue;
+		}
+
+		// A wedge is convex when the second face's opposite corner lies behind the first face.
+		const Face& other = faces[faceEdges[last - 1].second];
+		uint32_t opposite = other.v[0] != a && other.v[0] != b ? other.v[0] : (other.v[1] != a && other.v[1] != b ? other.v[1] : other.v[2]);
+
+		glm::vec3 normalA = normals[faceEdges[last - 2].second];
+		glm::vec3 normalB = normals[faceEdges[last - 1].second];
+
+		if (glm::dot(normalA, glm::vec3(positions[opposite]) - glm::vec3(positions[a])) >= 0.0f) {
+			continue;
+		}
+
+		float bend = std::acos(std::clamp(glm::dot(normalA, normalB), -1.0f, 1.0f));
+
+		if (bend < DIFFRACTION_MIN_BEND) {
+			continue;
+		}
+
+		edges.push_back({ glm::vec4(midpoint, PI - bend) });
+	}
+
+	// Counting sort of the edges into a power of two buckets, at least one per edge.
+	uint32_t tableSize = 1;
+	while (tableSize < edges.size()) {
+		tableSize <<= 1;
+	}
+
+	std::vector<uint32_t> buckets(edges.size());
+	bucketStarts.assign(tableSize + 1, 0);
+
+	for (uint32_t i = 0; i < edges.size(); i++) {
+		buckets[i] = diffractionHash(diffractionHashCell(glm::vec3(edges[i].midpoint)), tableSize);
+		bucketStarts[buckets[i] + 1]++;
+	}
+
+	for (uint32_t b = 0; b < tableSize; b++) {
+		bucketStarts[b + 1] += bucketStarts[b];
+	}
+
+	std::vector<uint32_t> next(bucketStarts.begin(), bucketStarts.end() - 1);
+	bucketEdges.resize(edges.size());
+
+	for (uint32_t i = 0; i < edges.size(); i++) {
+		bucketEdges[next[buckets[i]]++] = i;
+	}
+
+}
+
+int DiffractionEdges::findNearest(const glm::vec3& point, uint32_t nearest[DIFFRACTION_MAX_EDGES]) const {
+
+	glm::ivec3 centre = diffractionHashCell(point);
+	uint32_t tableSize = static_cast<uint32_t>(bucketStarts.size()) - 1;
+
+	float distances[DIFFRACTION_MAX_EDGES];
+	int count = 0;
+
+	for (int ring = 0; ring <= DIFFRACTION_HASH_RINGS; ring++) {
+		// A ring's cells are at least ring - 1 cells from point; past the furthest edge kept, nothing nearer is left.
+		if (count == DIFFRACTION_MAX_EDGES && distances[count - 1] <= (ring - 1) * DIFFRACTION_HASH_CELL) {
+			break;
+		}
+
+		for (int z = -ring; z <= ring; z++) {
+			for (int y = -ring; y <= ring; y++) {
+				for (int x = -ring; x <= ring; x++) {
+					if (std::max(std::abs(x), std::max(std::abs(y), std::abs(z))) != ring) {
+						continue;
+					}
+
+					glm::ivec3 cell = centre + glm::ivec3(x, y, z);
+					uint32_t bucket = diffractionHash(cell, tableSize);
+
+					for (uint32_t i = bucketStarts[bucket]; i < bucketStarts[bucket + 1]; i++) {
+						glm::vec3 midpoint = glm::vec3(edges[bucketEdges[i]].midpoint);
+
+						// Cells share buckets; an edge is only taken from the cell it lies in, so it's seen once.
+						if (diffractionHashCell(midpoint) != cell) {
+							continue;
+						}
+
+						float distance = glm::length(midpoint - point);
+
+						if (distance > DIFFRACTION_SEARCH_RADIUS || (count == DIFFRACTION_MAX_EDGES && distance >= distances[count - 1])) {
+							continue;
+						}
+
+						int slot = std::min(count, DIFFRACTION_MAX_EDGES - 1);
+						for (; slot > 0 && distances[slot - 1] > distance; slot--) {
+							distances[slot] = distances[slot - 1];
+							nearest[slot] = nearest[slot - 1];
+						}
+
+						distances[slot] = distance;
+						nearest[slot] = bucketEdges[i];
+						count = std::min(count + 1, DIFFRACTION_MAX_EDGES);
+					}
+				}
+			}
+		}
+	}
+
+	return count;
+
+}
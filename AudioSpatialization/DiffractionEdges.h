@@ -0,0 +1,63 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <utility>
+
+#include "Geometry.h"
+
+// Edge sound can bend around, matching DiffractionEdge in shader.comp. xyz is the midpoint in model space,
+// w the dihedral angle inside the wedge in radians: 0 for the open edge of a lone face or an edge shared
+// by more than two, up to PI - DIFFRACTION_MIN_BEND for the flattest wedge kept.
+struct DiffractionEdge {
+	glm::vec4 midpoint;
+};
+
+// Edges are taken from within this distance of where a ray was blocked, nearest DIFFRACTION_MAX_EDGES first.
+// Both match shader.comp.
+const float DIFFRACTION_SEARCH_RADIUS = 300.0f;
+const int DIFFRACTION_MAX_EDGES = 16;
+
+// Hash cells are half the search radius across, so the two rings of cells around a point's own cell cover it.
+const float DIFFRACTION_HASH_CELL = DIFFRACTION_SEARCH_RADIUS / 2.0f;
+const int DIFFRACTION_HASH_RINGS = 2;
+
+// Wedges whose faces are within this of flat (about 10 degrees) don't count as edges, and neither do concave ones.
+const float DIFFRACTION_MIN_BEND = 0.1745f;
+
+inline glm::ivec3 diffractionHashCell(const glm::vec3& pos) {
+	return glm::ivec3(glm::floor(pos / DIFFRACTION_HASH_CELL));
+}
+
+// Bucket of a hash cell in a power of two table, same as diffractionHash in shader.comp.
+inline uint32_t diffractionHash(const glm::ivec3& cell, uint32_t tableSize) {
+	return ((uint32_t(cell.x) * 73856093u) ^ (uint32_t(cell.y) * 19349663u) ^ (uint32_t(cell.z) * 83492791u)) & (tableSize - 1u);
+}
+
+// Convex wedge and open edges of the model, extracted once after loading and hashed by midpoint, so the
+// diffraction pass looks up the few edges near a hit instead of rebuilding them from nearby triangles.
+class DiffractionEdges {
+
+public:
+	DiffractionEdges() = default;
+	DiffractionEdges(const std::vector<glm::vec4>& positions, const std::vector<Face>& faces);
+	// Edges and buckets exactly as the getters below returned them, e.g. from a SceneCache.
+	DiffractionEdges(std::vector<DiffractionEdge> edges, std::vector<uint32_t> bucketStarts, std::vector<uint32_t> bucketEdges, uint32_t openEdges)
+		: edges(std::move(edges)), bucketStarts(std::move(bucketStarts)), bucketEdges(std::move(bucketEdges)), openEdges(openEdges) {}
+
+	// Ids of up to DIFFRACTION_MAX_EDGES edges within DIFFRACTION_SEARCH_RADIUS of point, nearest first.
+	// Mirrors findDiffractionEdges in shader.comp.
+	int findNearest(const glm::vec3& point, uint32_t nearest[DIFFRACTION_MAX_EDGES]) const;
+
+	const std::vector<DiffractionEdge>& getEdges() const { return edges; }
+	// Bucket b holds bucketEdges[bucketStarts[b]] up to bucketEdges[bucketStarts[b + 1]]; a power of two buckets plus the end.
+	const std::vector<uint32_t>& getBucketStarts() const { return bucketStarts; }
+	const std::vector<uint32_t>& getBucketEdges() const { return bucketEdges; }
+	uint32_t getOpenEdges() const { return openEdges; }
+
+private:
+	std::vector<DiffractionEdge> edges;
+	std::vector<uint32_t> bucketStarts = { 0, 0 };
+	std::vector<uint32_t> bucketEdges;
+	uint32_t openEdges = 0;
+
+};
@@ -0,0 +1,145 @@
+#pragma once
+
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <cmath>
+
+#include "AmpLayout.h"
+
+// Edge length of one amplitude volume cell, in model units.
+const float AMP_CELL_SIZE = 10.0f;
+
+struct Vertex {
+	glm::vec4 pos;
+	glm::vec4 normal;
+
+	bool operator == (Vertex v) const {
+		if (v.pos == pos && v.normal == normal) {
+			return true;
+		}
+
+		return false;
+	}
+};
+
+struct AmpVolume {
+
+	float amp;
+
+};
+
+// Frequency of the broadband amplitude volume and the multi-source channels; the octave bands scale against it.
+const float REFERENCE_FREQUENCY = 100.0f;
+
+// Viscous air absorption over dist model units, same formula as attenuatedPower in shader.comp.
+inline float attenuatedPower(float dist, float bandFrequency = REFERENCE_FREQUENCY) {
+
+	const float pi = 3.14159265359f;
+	const float eta = 0.0000185f;
+	const float rho = 1.2f;
+
+	float alpha = (2 * eta * std::pow(2 * pi * bandFrequency, 2.0f)) / (3 * rho * std::pow(343.0f, 3.0f));
+
+	return std::exp(-1 * alpha * (dist / 100));
+
+}
+
+// Octave band centres solved per cell, 63 Hz to 8 kHz. Matches bandFrequencies in shader.comp.
+const int BAND_COUNT = 8;
+const float BAND_FREQUENCIES[BAND_COUNT] = { 63.0f, 125.0f, 250.0f, 500.0f, 1000.0f, 2000.0f, 4000.0f, 8000.0f };
+
+struct BandAmplitude {
+
+	float amp[BAND_COUNT];
+
+};
+
+// Most sources one solve accepts, and how many of the strongest are kept per cell.
+const uint32_t MAX_SOURCES = 256;
+const int TOP_SOURCES = 4;
+
+// Per cell result of the multi-source pass: summed direct amplitude and the strongest contributors in
+// descending order. Unused slots hold source 0xFFFFFFFF. Matches SourceChannels in shader.comp.
+struct SourceChannels {
+
+	float sum;
+	uint32_t source[TOP_SOURCES];
+	float amp[TOP_SOURCES];
+
+};
+
+inline void addContribution(SourceChannels& c, uint32_t source, float amp) {
+
+	c.sum += amp;
+
+	for (int k = 0; k < TOP_SOURCES; k++) {
+		if (amp > c.amp[k]) {
+			for (int j = TOP_SOURCES - 1; j > k; j--) {
+				c.source[j] = c.source[j - 1];
+				c.amp[j] = c.amp[j - 1];
+			}
+			c.source[k] = source;
+			c.amp[k] = amp;
+			return;
+		}
+	}
+
+}
+
+struct ModelExtent {
+
+	float xMin;
+	float xMax;
+	float yMin;
+	float yMax;
+	float zMin;
+	float zMax;
+
+};
+
+struct Triangle {
+	Vertex vertices[3];
+
+	bool operator == (Triangle t) const {
+
+		for (int i = 0; i < 3; i++) {
+			if (t.vertices[i] != vertices[i]) {
+				return false;
+			}
+		}
+
+		return true;
+	}
+};
+
+// Compact triangle used by the compute shader: three indices into the shared position array and the
+// averaged vertex normal used for back face culling. Matches the std430 Face struct in shader.comp.
+struct Face {
+	uint32_t v[3];
+	uint32_t pad;
+	glm::vec4 normal;
+};
+
+// Triangle in the form the intersection kernels consume: the first vertex and the two edges leaving it,
+// with the face normal spread over the w components. Built once after the BVH so neither the shader nor
+// the CPU packets recompute edges per ray. Matches BVHTriangle in shader.comp.
+struct PrecomputedTriangle {
+	glm::vec4 v0;
+	glm::vec4 e1;
+	glm::vec4 e2;
+};
+
+inline PrecomputedTriangle precomputeTriangle(const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2, const glm::vec3& normal) {
+	return { glm::vec4(p0, normal.x), glm::vec4(p1 - p0, normal.y), glm::vec4(p2 - p0, normal.z) };
+}
+
+// Amplitude cell containing a model space position, matching getAmpCellID in shader.comp.
+inline glm::ivec3 getAmpCellID(const glm::vec3& pos, const ModelExtent& extents) {
+	return glm::ivec3((pos - glm::vec3(extents.xMin, extents.yMin, extents.zMin)) / AMP_CELL_SIZE);
+}
+
+// Segment/triangle test used by every CPU traversal. Mirrors rayTriangleIntersection in shader.comp:
+// returns the hit parameter along (end - start), or 0 when there is no front facing hit.
+float rayTriangleIntersection(const glm::vec3& start, const glm::vec3& end, const Triangle& T);
+float rayTriangleIntersection(const glm::vec3& start, const glm::vec3& end, const PrecomputedTriangle& T);
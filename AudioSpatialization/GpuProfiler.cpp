@@ -0,0 +1,214 @@
+#include "GpuProfiler.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <stdexcept>
+
+void GpuProfiler::create(VkDevice device, VkPhysicalDevice physicalDevice, uint32_t queueFamily, uint32_t slots) {
+
+	this->device = device;
+	this->slots = slots;
+
+	uint32_t familyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, nullptr);
+	std::vector<VkQueueFamilyProperties> families(familyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, families.data());
+
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+	uint32_t validBits = queueFamily < familyCount ? families[queueFamily].timestampValidBits : 0;
+
+	if (validBits == 0 || properties.limits.timestampPeriod == 0.0f) {
+		return;
+	}
+
+	nanosecondsPerTick = properties.limits.timestampPeriod;
+	timestampMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+
+	VkQueryPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	poolInfo.queryCount = PHASE_COUNT * slots * 2;
+
+	if (vkCreateQueryPool(device, &poolInfo, nullptr, &queryPool) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to Create Timestamp Query Pool\n");
+	}
+
+	pending.assign(PHASE_COUNT * slots, 0);
+
+	for (int phase = 0; phase < PHASE_COUNT; phase++) {
+		ring[phase].assign(RING_SIZE, 0.0);
+	}
+
+}
+
+void GpuProfiler::destroy() {
+
+	if (queryPool != VK_NULL_HANDLE) {
+		vkDestroyQueryPool(device, queryPool, nullptr);
+		queryPool = VK_NULL_HANDLE;
+	}
+
+}
+
+void GpuProfiler::begin(VkCommandBuffer commandBuffer, Phase phase, uint32_t slot) {
+
+	if (!isSupported()) {
+		return;
+	}
+
+	// Whatever the slot held last time is read before its queries are reset.
+	collect();
+
+	vkCmdResetQueryPool(commandBuffer, queryPool, firstQuery(phase, slot), 2);
+	vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, firstQuery(phase, slot));
+
+	pending[phase * slots + slot] = 0;
+
+}
+
+void GpuProfiler::end(VkCommandBuffer commandBuffer, Phase phase, uint32_t slot) {
+
+	if (!isSupported()) {
+		return;
+	}
+
+	vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, firstQuery(phase, slot) + 1);
+
+	pending[phase * slots + slot] = 1;
+
+}
+
+void GpuProfiler::collect() {
+
+	if (!isSupported()) {
+		return;
+	}
+
+	for (int phase = 0; phase < PHASE_COUNT; phase++) {
+		for (uint32_t slot = 0; slot < slots; slot++) {
+			if (!pending[phase * slots + slot]) {
+				continue;
+			}
+
+			// Timestamp and availability for begin, then for end.
+			uint64_t results[4] = {};
+			vkGetQueryPoolResults(device, queryPool, firstQuery(Phase(phase), slot), 2, sizeof(results), results, 2 * sizeof(uint64_t),
+				VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+
+			if (results[1] == 0 || results[3] == 0) {
+				continue;
+			}
+
+			pending[phase * slots + slot] = 0;
+
+			uint64_t ticks = (results[2] - results[0]) & timestampMask;
+
+			ring[phase][ringHead[phase]] = double(ticks) * nanosecondsPerTick / 1000000.0;
+			ringHead[phase] = (ringHead[phase] + 1) % RING_SIZE;
+			ringCount[phase] = std::min(ringCount[phase] + 1, RING_SIZE);
+		}
+	}
+
+}
+
+std::vector<double> GpuProfiler::getSamples(Phase phase) const {
+
+	std::vector<double> samples;
+
+	if (!isSupported()) {
+		return samples;
+	}
+
+	size_t first = (ringHead[phase] + RING_SIZE - ringCount[phase]) % RING_SIZE;
+
+	for (size_t i = 0; i < ringCount[phase]; i++) {
+		samples.push_back(ring[phase][(first + i) % RING_SIZE]);
+	}
+
+	return samples;
+
+}
+
+GpuProfiler::Stats GpuProfiler::getStats(Phase phase) const {
+
+	Stats stats;
+	std::vector<double> samples = getSamples(phase);
+
+	if (samples.empty()) {
+		return stats;
+	}
+
+	stats.count = samples.size();
+	stats.lastMs = samples.back();
+
+	std::sort(samples.begin(), samples.end());
+
+	// Nearest rank percentiles.
+	stats.minMs = samples.front();
+	stats.medianMs = samples[(samples.size() - 1) / 2];
+	stats.p99Ms = samples[static_cast<size_t>(std::ceil(0.99 * samples.size())) - 1];
+
+	return stats;
+
+}
+
+const char* GpuProfiler::getPhaseName(Phase phase) {
+
+	const char* names[PHASE_COUNT] = { "SOLVE", "VISIBILITY", "DIRECT", "DIFFRACTION", "PACK", "DRAW" };
+	return names[phase];
+
+}
+
+void GpuProfiler::write(const std::string& path) const {
+
+	std::ofstream file(path);
+
+	if (!file.is_open()) {
+		throw std::runtime_error("Failed to Open GPU Profile Output File\n");
+	}
+
+	bool json = path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0;
+
+	if (json) {
+		file << "{\n\t\"supported\": " << (isSupported() ? "true" : "false") << ",\n\t\"phases\": {";
+	}
+	else {
+		file << "phase,count,min_ms,median_ms,p99_ms,samples_ms\n";
+	}
+
+	for (int phase = 0; phase < PHASE_COUNT; phase++) {
+		Stats stats = getStats(Phase(phase));
+		std::vector<double> samples = getSamples(Phase(phase));
+
+		if (json) {
+			file << (phase > 0 ? "," : "") << "\n\t\t\"" << getPhaseName(Phase(phase)) << "\": { \"count\": " << stats.count << ", \"minMs\": " << stats.minMs
+				<< ", \"medianMs\": " << stats.medianMs << ", \"p99Ms\": " << stats.p99Ms << ", \"samplesMs\": [";
+
+			for (size_t i = 0; i < samples.size(); i++) {
+				file << (i > 0 ? ", " : "") << samples[i];
+			}
+
+			file << "] }";
+		}
+		else {
+			file << getPhaseName(Phase(phase)) << "," << stats.count << "," << stats.minMs << "," << stats.medianMs << "," << stats.p99Ms << ",";
+
+			for (size_t i = 0; i < samples.size(); i++) {
+				file << (i > 0 ? " " : "") << samples[i];
+			}
+
+			file << "\n";
+		}
+	}
+
+	if (json) {
+		file << "\n\t}\n}\n";
+	}
+
+	if (!file.good()) {
+		throw std::runtime_error("Failed to Write GPU Profile Output File\n");
+	}
+
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <vector>
+#include <string>
+#include <cstdint>
+
+// GPU time of the compute solve, each of its passes, and the draw pass from timestamp queries. Each phase has a begin/end pair
+// of queries per slot (frame in flight), written around the phase's commands. Results are picked up
+// without waiting once the GPU has finished with a slot, and the last RING_SIZE durations of every phase
+// are kept for min/median/p99. Does nothing when the queue has no timestamp support.
+class GpuProfiler {
+
+public:
+	// PHASE_SOLVE spans the pass phases, which follow SolvePass order in VKConfig.h. PHASE_PACK is only written under LOG8.
+	enum Phase { PHASE_SOLVE, PHASE_VISIBILITY, PHASE_DIRECT, PHASE_DIFFRACTION, PHASE_PACK, PHASE_DRAW, PHASE_COUNT };
+
+	struct Stats {
+		size_t count = 0;
+		double lastMs = 0.0;
+		double minMs = 0.0;
+		double medianMs = 0.0;
+		double p99Ms = 0.0;
+	};
+
+	static const size_t RING_SIZE = 512;
+
+	void create(VkDevice device, VkPhysicalDevice physicalDevice, uint32_t queueFamily, uint32_t slots);
+	void destroy();
+
+	bool isSupported() const { return queryPool != VK_NULL_HANDLE; }
+
+	// Outside a render pass: resetting the slot's queries is a transfer command.
+	void begin(VkCommandBuffer commandBuffer, Phase phase, uint32_t slot);
+	void end(VkCommandBuffer commandBuffer, Phase phase, uint32_t slot);
+
+	// Moves every finished slot's duration into its ring; slots still in flight are left for a later call.
+	void collect();
+
+	Stats getStats(Phase phase) const;
+	// Oldest first.
+	std::vector<double> getSamples(Phase phase) const;
+	static const char* getPhaseName(Phase phase);
+
+	// Stats and every kept sample, as JSON when the path ends in .json and CSV otherwise.
+	void write(const std::string& path) const;
+
+private:
+	VkDevice device = VK_NULL_HANDLE;
+	VkQueryPool queryPool = VK_NULL_HANDLE;
+	uint32_t slots = 0;
+	double nanosecondsPerTick = 1.0;
+	uint64_t timestampMask = ~0ull;
+
+	// Slots whose queries were written and not yet read, per phase.
+	std::vector<uint8_t> pending;
+
+	std::vector<double> ring[PHASE_COUNT];
+	size_t ringHead[PHASE_COUNT] = {};
+	size_t ringCount[PHASE_COUNT] = {};
+
+	uint32_t firstQuery(Phase phase, uint32_t slot) const { return (phase * slots + slot) * 2; }
+
+};
@@ -0,0 +1,250 @@
+#include "SceneCache.h"
+#include "DiffractionEdges.h"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+const char SCENE_CACHE_MAGIC[8] = "ASSCENE";
+
+// Maps the whole file read only. False when it can't be opened; an empty file maps to null with 0 bytes.
+bool mapFile(const std::string& path, const uint8_t*& view, size_t& bytes) {
+
+	view = nullptr;
+	bytes = 0;
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+
+	if (file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+
+	LARGE_INTEGER size;
+	bool mapped = GetFileSizeEx(file, &size) != 0;
+
+	if (mapped && size.QuadPart > 0) {
+		HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		view = mapping != nullptr ? static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0)) : nullptr;
+		mapped = view != nullptr;
+		bytes = mapped ? static_cast<size_t>(size.QuadPart) : 0;
+
+		// The view keeps both the mapping and the file open until it is unmapped.
+		if (mapping != nullptr) {
+			CloseHandle(mapping);
+		}
+	}
+
+	CloseHandle(file);
+#else
+	int file = ::open(path.c_str(), O_RDONLY);
+
+	if (file < 0) {
+		return false;
+	}
+
+	struct stat status;
+	bool mapped = fstat(file, &status) == 0;
+
+	if (mapped && status.st_size > 0) {
+		void* address = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+		mapped = address != MAP_FAILED;
+		view = mapped ? static_cast<const uint8_t*>(address) : nullptr;
+		bytes = mapped ? static_cast<size_t>(status.st_size) : 0;
+	}
+
+	::close(file);
+#endif
+
+	return mapped;
+
+}
+
+void unmapFile(const uint8_t* view, size_t bytes) {
+
+	if (view == nullptr) {
+		return;
+	}
+
+#ifdef _WIN32
+	UnmapViewOfFile(view);
+#else
+	munmap(const_cast<uint8_t*>(view), bytes);
+#endif
+
+}
+
+uint64_t alignSection(uint64_t offset) {
+	return (offset + SCENE_CACHE_ALIGNMENT - 1) / SCENE_CACHE_ALIGNMENT * SCENE_CACHE_ALIGNMENT;
+}
+
+uint32_t floatBits(float value) {
+
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	return bits;
+
+}
+
+}
+
+SceneCache::~SceneCache() {
+
+	close();
+
+}
+
+uint64_t SceneCache::key(const std::string& modelPath, const BVH& bvh) {
+
+	const uint8_t* model;
+	size_t bytes;
+
+	if (!mapFile(modelPath, model, bytes)) {
+		throw std::runtime_error("Failed to Open Model File " + modelPath + "\n");
+	}
+
+	uint64_t hash = 14695981039346656037ull;
+	auto mix = [&hash](uint32_t word) {
+		hash = (hash ^ word) * 1099511628211ull;
+	};
+
+	// A word at a time, then the odd bytes and the length.
+	size_t words = bytes / sizeof(uint32_t);
+
+	for (size_t i = 0; i < words; i++) {
+		uint32_t word;
+		memcpy(&word, model + i * sizeof(uint32_t), sizeof(word));
+		mix(word);
+	}
+
+	for (size_t i = words * sizeof(uint32_t); i < bytes; i++) {
+		mix(model[i]);
+	}
+
+	mix(static_cast<uint32_t>(bytes));
+	mix(static_cast<uint32_t>(uint64_t(bytes) >> 32));
+
+	unmapFile(model, bytes);
+
+	// The same file builds something else when any of these change.
+	uint32_t parameters[] = {
+		SCENE_CACHE_VERSION, bvh.minLeafSize, bvh.maxLeafSize, BVH_MAX_DEPTH, floatBits(DIFFRACTION_HASH_CELL), floatBits(DIFFRACTION_MIN_BEND),
+		sizeof(Vertex), sizeof(Face), sizeof(BVHNode), sizeof(PrecomputedTriangle), sizeof(DiffractionEdge), sizeof(SceneCacheHeader)
+	};
+
+	for (uint32_t parameter : parameters) {
+		mix(parameter);
+	}
+
+	return hash;
+
+}
+
+bool SceneCache::open(const std::string& path, uint64_t key) {
+
+	close();
+
+	if (!mapFile(path, mapped, mappedBytes) || mappedBytes < sizeof(SceneCacheHeader)) {
+		close();
+		return false;
+	}
+
+	const SceneCacheHeader& header = getHeader();
+
+	bool valid = memcmp(header.magic, SCENE_CACHE_MAGIC, sizeof(header.magic)) == 0 && header.version == SCENE_CACHE_VERSION
+		&& header.sectionCount == SCENE_SECTION_COUNT && header.key == key;
+
+	for (int section = 0; valid && section < SCENE_SECTION_COUNT; section++) {
+		valid = header.offsets[section] % SCENE_CACHE_ALIGNMENT == 0 && header.offsets[section] <= mappedBytes
+			&& header.bytes[section] <= mappedBytes - header.offsets[section];
+	}
+
+	if (!valid) {
+		close();
+	}
+
+	return valid;
+
+}
+
+void SceneCache::close() {
+
+	unmapFile(mapped, mappedBytes);
+	mapped = nullptr;
+	mappedBytes = 0;
+
+}
+
+void SceneCache::write(const std::string& path, uint64_t key, const ModelExtent& extents, uint32_t openEdges,
+	const void* const sections[SCENE_SECTION_COUNT], const uint64_t bytes[SCENE_SECTION_COUNT]) {
+
+	// Zeroed whole, padding included, so equal scenes write equal files.
+	SceneCacheHeader header;
+	memset(&header, 0, sizeof(header));
+
+	memcpy(header.magic, SCENE_CACHE_MAGIC, sizeof(header.magic));
+	header.version = SCENE_CACHE_VERSION;
+	header.sectionCount = SCENE_SECTION_COUNT;
+	header.key = key;
+	header.extents = extents;
+	header.openEdges = openEdges;
+
+	uint64_t offset = alignSection(sizeof(SceneCacheHeader));
+
+	for (int section = 0; section < SCENE_SECTION_COUNT; section++) {
+		header.offsets[section] = offset;
+		header.bytes[section] = bytes[section];
+		offset = alignSection(offset + bytes[section]);
+	}
+
+	std::string partial = path + ".partial";
+	std::ofstream file(partial, std::ios::binary | std::ios::trunc);
+
+	if (!file.is_open()) {
+		throw std::runtime_error("Failed to Open Scene Cache File\n");
+	}
+
+	const char padding[SCENE_CACHE_ALIGNMENT] = {};
+	uint64_t written = sizeof(SceneCacheHeader);
+
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+	for (int section = 0; section < SCENE_SECTION_COUNT; section++) {
+		file.write(padding, static_cast<std::streamsize>(header.offsets[section] - written));
+
+		if (bytes[section] > 0) {
+			file.write(static_cast<const char*>(sections[section]), static_cast<std::streamsize>(bytes[section]));
+		}
+
+		written = header.offsets[section] + bytes[section];
+	}
+
+	file.close();
+
+	if (!file.good()) {
+		std::remove(partial.c_str());
+		throw std::runtime_error("Failed to Write Scene Cache File\n");
+	}
+
+	// rename won't replace an existing file everywhere, so the old one goes first.
+	std::remove(path.c_str());
+
+	if (std::rename(partial.c_str(), path.c_str()) != 0) {
+		std::remove(partial.c_str());
+		throw std::runtime_error("Failed to Replace Scene Cache File\n");
+	}
+
+}
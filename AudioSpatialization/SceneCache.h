@@ -0,0 +1,90 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <cstdint>
+
+#include "Geometry.h"
+#include "BVH.h"
+
+// Bumped whenever loadModel or one of the builders below changes what it produces, so older files are rebuilt.
+const uint32_t SCENE_CACHE_VERSION = 2;
+
+// Everything a warm start would otherwise parse or build, one section each: the per corner vertices from
+// loadModel, the welded positions and faces, the octree grid, the BVH with its precomputed triangles, and
+// the diffraction edges with their hash buckets.
+enum SceneCacheSection {
+	SCENE_VERTICES,
+	SCENE_POSITIONS,
+	SCENE_FACES,
+	SCENE_OCTREE,
+	SCENE_MIDPOINTS,
+	SCENE_SIZES,
+	SCENE_OFFSETS,
+	SCENE_BVH_NODES,
+	SCENE_BVH_TRI_INDICES,
+	SCENE_BVH_TRIANGLES,
+	SCENE_EDGES,
+	SCENE_EDGE_BUCKET_STARTS,
+	SCENE_EDGE_BUCKET_EDGES,
+	SCENE_SECTION_COUNT
+};
+
+// Start of the file. Sections follow at SCENE_CACHE_ALIGNMENT aligned offsets, so each can be read in place.
+struct SceneCacheHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t sectionCount;
+	uint64_t key;
+	ModelExtent extents;
+	uint32_t openEdges;
+	uint64_t offsets[SCENE_SECTION_COUNT];
+	uint64_t bytes[SCENE_SECTION_COUNT];
+};
+
+const uint64_t SCENE_CACHE_ALIGNMENT = 64;
+
+// Binary snapshot of a model's geometry and acceleration structures, memory mapped on load. Sections are
+// only valid while the cache stays open; copy out what has to outlive it.
+class SceneCache {
+
+public:
+	SceneCache() = default;
+	~SceneCache();
+
+	SceneCache(const SceneCache&) = delete;
+	SceneCache& operator=(const SceneCache&) = delete;
+
+	// FNV-1a over the model file, then over every parameter that changes what gets built from it.
+	static uint64_t key(const std::string& modelPath, const BVH& bvh);
+
+	// Maps path and checks it was written for key by this version. False, with nothing kept mapped, when
+	// the file is missing, stale or damaged.
+	bool open(const std::string& path, uint64_t key);
+	void close();
+	bool isOpen() const { return mapped != nullptr; }
+
+	const SceneCacheHeader& getHeader() const { return *reinterpret_cast<const SceneCacheHeader*>(mapped); }
+	size_t getBytes() const { return mappedBytes; }
+
+	const void* data(SceneCacheSection section) const { return mapped + getHeader().offsets[section]; }
+	uint64_t size(SceneCacheSection section) const { return getHeader().bytes[section]; }
+
+	template<typename T>
+	size_t count(SceneCacheSection section) const { return static_cast<size_t>(size(section) / sizeof(T)); }
+
+	template<typename T>
+	void read(SceneCacheSection section, std::vector<T>& out) const {
+		const T* first = static_cast<const T*>(data(section));
+		out.assign(first, first + count<T>(section));
+	}
+
+	// One pointer and byte count per section. Written beside path first and renamed over it, so a
+	// reader never maps half a file.
+	static void write(const std::string& path, uint64_t key, const ModelExtent& extents, uint32_t openEdges,
+		const void* const sections[SCENE_SECTION_COUNT], const uint64_t bytes[SCENE_SECTION_COUNT]);
+
+private:
+	const uint8_t* mapped = nullptr;
+	size_t mappedBytes = 0;
+
+};
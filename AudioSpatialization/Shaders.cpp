@@ -72,7 +72,8 @@ std::vector<char> Shader::readFile(const std::string& filename) {
     std::ifstream file(filename, std::ios::ate | std::ios::binary);
 
     if (!file.is_open()) {
-        throw std::runtime_error("failed to open file!");
+        // The .spv files are build outputs of Shaders/compile.bat, not checked in.
+        throw std::runtime_error("Failed to Open " + filename + " - build the project to compile the shaders\n");
     }
 
     size_t fileSize = (size_t)file.tellg();
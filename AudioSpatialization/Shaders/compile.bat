@@ -1,5 +1,16 @@
-.\Shaders\glslc.exe .\Shaders\shader.vert -o .\Shaders\shader_vert.spv
-.\Shaders\glslc.exe .\Shaders\shader.frag -o .\Shaders\shader_frag.spv
-.\Shaders\glslc.exe .\Shaders\shader.comp -o .\Shaders\shader_comp.spv
+@echo off
+rem Compiles every shader next to this script. Run as the pre-build step, so Shaders\*.spv always match the sources.
+rem Uses a glslc.exe placed beside the shaders if there is one, otherwise the Vulkan SDK's.
 
-pause
\ No newline at end of file
+set SHADERS=%~dp0
+set GLSLC=%SHADERS%glslc.exe
+if not exist "%GLSLC%" set GLSLC=%VULKAN_SDK%\Bin\glslc.exe
+
+if not exist "%GLSLC%" (
+	echo error: glslc.exe not found beside the shaders or in %%VULKAN_SDK%%\Bin
+	exit /b 1
+)
+
+"%GLSLC%" "%SHADERS%shader.vert" -o "%SHADERS%shader_vert.spv" || exit /b 1
+"%GLSLC%" "%SHADERS%shader.frag" -o "%SHADERS%shader_frag.spv" || exit /b 1
+"%GLSLC%" "%SHADERS%shader.comp" -o "%SHADERS%shader_comp.spv" || exit /b 1
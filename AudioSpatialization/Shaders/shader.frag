@@ -1,4 +1,7 @@
 #version 450
+#extension GL_GOOGLE_include_directive : require
+
+#include "../AmpLayout.h"
 
 layout(location = 0) in vec3 fragColor;
 layout(location = 1) in vec3 pos;
@@ -12,23 +15,41 @@ layout(binding=0) uniform Transform {
     vec3 cameraFront;
 } transform;
 
-struct AmpVolume {
-    
-    float amp;
-
-};
+// Matches SceneUniform in VKConfig.h.
+layout(binding = 1) uniform Scene {
+    ivec4 gridExtent;
+    vec4 gridOffset;
+    vec4 sourcePos;
+    vec4 previousSourcePos;
+} scene;
 
+// Packed in ampFormat, see AmpLayout.h.
 layout(std430, set = 1, binding = 0) readonly buffer AmplitudeIn {
-   AmpVolume ampIn[ ];
+   uint ampIn[ ];
 };
 
-int xExtent = 523;//372;
-int yExtent = 105;//155;
-int zExtent = 523;//228;
+// Specialization constant 3, the same layout the compute pipeline writes.
+layout(constant_id = 3) const int ampLayout = AMP_LAYOUT_LINEAR;
+// Specialization constant 4: read the 3D image shader.comp fills instead of the buffer.
+layout(constant_id = 4) const bool useAmpImage = false;
+// Specialization constant 5, the element format shader.comp packs.
+layout(constant_id = 5) const int ampFormat = AMP_FORMAT_FLOAT;
+// Specialization constant 6: ampIn is a sparse pool, found through brickEntries.
+layout(constant_id = 6) const bool sparseVolume = false;
+
+layout(set = 1, binding = 6) uniform sampler3D ampTexture;
+
+// Matches BrickTable in shader.comp.
+layout(std430, set = 1, binding = 7) readonly buffer BrickTable {
+    uint openBricks;
+    uint farBricks;
+    uint brickEntries[ ];
+};
 
-float minX = 3925.2;//1920.95;
-float minY = 895.222;//1429.43;
-float minZ = 3500.24;//1182.81;
+// LOG8 scale per AMP_SCALE_CELLS run, matching AmpScale in shader.comp.
+layout(std430, set = 1, binding = 10) readonly buffer AmpScale {
+    float ampScale[ ];
+};
 
 layout(location = 0) out vec4 outColor;
 
@@ -38,7 +59,43 @@ vec3 modelColor = vec3(0.5);
 
 vec3 lightPos = vec3(0.0, 5.0, 0.0);
 
+// Amplitude at a position in cell units: trilinear through the sampler, whose texel centres sit at
+// cell + 0.5, or the nearest cell of the buffer.
+float sampleAmp(vec3 cell, ivec3 extent) {
+
+    if (useAmpImage) {
+        return texture(ampTexture, cell / vec3(extent)).r;
+    }
+
+    int index = ampCellIndex(ivec3(cell), extent, ampLayout);
+
+    // Solid bricks have no storage and read as silent.
+    if (sparseVolume) {
+        ivec3 clamped = clamp(ivec3(cell), ivec3(0), extent - 1);
+        index = ampPoolCell(brickEntries[ampBrickID(clamped, extent)], clamped);
+
+        if (index < 0) {
+            return 0.0;
+        }
+    }
+
+    float scale = ampFormat == AMP_FORMAT_LOG8 ? ampScale[ampScaleIndex(index)] : 1.0;
+
+    return ampDecodeCell(ampIn[ampWordIndex(index, ampFormat)], index, ampFormat, scale);
+
+}
+
 void main() {
+
+    int xExtent = scene.gridExtent.x;
+    int yExtent = scene.gridExtent.y;
+    int zExtent = scene.gridExtent.z;
+
+    float minX = scene.gridOffset.x;
+    float minY = scene.gridOffset.y;
+    float minZ = scene.gridOffset.z;
+
+    float cellSize = scene.gridOffset.w;
     
     vec3 lightDir = normalize(lightPos - pos);
     vec3 centerPos = normalize(pos - vec3(0.0));
@@ -47,9 +104,6 @@ void main() {
 
     float alpha = abs(dot(centerPos, normal) - 1.0);
 
-    int yStride = xExtent;
-    int zStride = (yExtent) * (xExtent);
-
     //outColor = vec4(diffuse * amp, alpha);
     //outColor = vec4(vec3(ampIn[index].amp), 1.0);
 
@@ -69,13 +123,11 @@ void main() {
     for (float i = 0; i < dist; i += sampleStep) {
         vec3 volumeSample = localCamera + i * normalize(pos - localCamera);
         
-        ivec3 modifiedSample = ivec3((volumeSample + vec3(minX, minY, minZ))/10.0);
+        float amp = sampleAmp((volumeSample + vec3(minX, minY, minZ))/cellSize, ivec3(xExtent, yExtent, zExtent));
 
-        int index = int(modifiedSample.x + modifiedSample.y*yStride + modifiedSample.z*zStride);
+        accum += amp / 10.0;
 
-        accum += ampIn[index].amp / 10.0;
-
-        color += mix(vec3(1.0, 0.0, 0.0), vec3(0.0, 1.0, 0.0), ampIn[index].amp);
+        color += mix(vec3(1.0, 0.0, 0.0), vec3(0.0, 1.0, 0.0), amp);
         numSamples++;
 
         if (accum >= 0.8) {
@@ -95,11 +147,9 @@ void main() {
 
     finalColor = vec4((color/numSamples), 1.0);//mix(vec4(diffuse*modelColor, 1.0), vec4(color/numSamples, 1.0), accum/2.0);
 
-    vec3 modifiedSample = (pos + vec3(minX, minY, minZ))/10.0;
-
-    int index = int(int(modifiedSample.x) + int(modifiedSample.y)*xExtent + int(modifiedSample.z)*xExtent * yExtent);
+    vec3 modifiedSample = (pos + vec3(minX, minY, minZ))/cellSize;
 
-    float posAmp = (ampIn[index].amp);
+    float posAmp = sampleAmp(modifiedSample, ivec3(xExtent, yExtent, zExtent));
 
     vec4 overlay = mix(vec4(1.0, 0.0, 0.0, 1.0), vec4(0.0, 1.0, 0.0, 1.0), posAmp);
     if (posAmp < 0.0) {
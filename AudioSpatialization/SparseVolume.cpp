@@ -0,0 +1,294 @@
+#include "SparseVolume.h"
+#include "CPUSolver.h"
+#include <algorithm>
+#include <execution>
+#include <numeric>
+
+namespace {
+
+const int MAX_CROSSINGS = 256;
+
+// Front facing surfaces crossed going from start to end, stepping just past each hit to find the next.
+int countCrossings(const CPUSolver& solver, glm::vec3 start, const glm::vec3& end) {
+
+	glm::vec3 dir = glm::normalize(end - start);
+	float step = AMP_CELL_SIZE * 0.001f;
+	int crossings = 0;
+
+	float t;
+	while (crossings < MAX_CROSSINGS && solver.traverse(start, end, glm::ivec3(-1), t)) {
+		crossings++;
+		start += (end - start) * t + dir * step;
+
+		if (glm::dot(end - start, dir) <= 0.0f) {
+			break;
+		}
+	}
+
+	return crossings;
+
+}
+
+}
+
+SparseVolume::SparseVolume(const std::vector<glm::vec4>& positions, const std::vector<Face>& faces, const CPUSolver& solver, const ModelExtent& extents, const glm::uvec3& gridSize) :
+	extent(glm::ivec3(gridSize)) {
+
+	glm::ivec3 bricks = ampBrickCount(extent);
+	size_t brickCount = size_t(bricks.x) * bricks.y * bricks.z;
+
+	// Bricks within a cell of a triangle's bounding box are open.
+	std::vector<uint8_t> open(brickCount, 0);
+
+	for (const Face& F : faces) {
+		glm::vec3 lower = glm::min(glm::min(glm::vec3(positions[F.v[0]]), glm::vec3(positions[F.v[1]])), glm::vec3(positions[F.v[2]]));
+		glm::vec3 upper = glm::max(glm::max(glm::vec3(positions[F.v[0]]), glm::vec3(positions[F.v[1]])), glm::vec3(positions[F.v[2]]));
+
+		glm::ivec3 first = glm::clamp(getAmpCellID(lower, extents) - glm::ivec3(1), glm::ivec3(0), extent - 1) >> AMP_BRICK_SHIFT;
+		glm::ivec3 last = glm::clamp(getAmpCellID(upper, extents) + glm::ivec3(1), glm::ivec3(0), extent - 1) >> AMP_BRICK_SHIFT;
+
+		for (int z = first.z; z <= last.z; z++) {
+			for (int y = first.y; y <= last.y; y++) {
+				for (int x = first.x; x <= last.x; x++) {
+					open[x + y * bricks.x + size_t(z) * bricks.x * bricks.y] = 1;
+				}
+			}
+		}
+	}
+
+	glm::vec3 gridMin = glm::vec3(extents.xMin, extents.yMin, extents.zMin);
+	float skyY = gridMin.y + (extent.y + 1) * AMP_CELL_SIZE;
+
+	std::vector<uint8_t> solid(brickCount, 0);
+
+	for (uint32_t brick = 0; brick < brickCount; brick++) {
+		if (open[brick]) {
+			continue;
+		}
+
+		// Nothing crosses the brick, so one point decides it. Going down from the sky, a point inside a
+		// closed solid passes more up facing tops than the down facing bottoms going back up.
+		glm::vec3 centre = glm::vec3(representative(brickOrigin(brick))) * AMP_CELL_SIZE + glm::vec3(AMP_CELL_SIZE / 2.0f) + gridMin;
+		glm::vec3 sky = glm::vec3(centre.x, skyY, centre.z);
+
+		solid[brick] = countCrossings(solver, sky, centre) > countCrossings(solver, centre, sky);
+	}
+
+	layoutPool(open, solid);
+	geometryOpen = open;
+
+}
+
+void SparseVolume::layoutPool(const std::vector<uint8_t>& open, const std::vector<uint8_t>& solid) {
+
+	entries.assign(open.size(), AMP_BRICK_SOLID);
+	farEntries.assign(open.size(), AMP_BRICK_SOLID);
+
+	uint32_t next = 0;
+
+	for (uint32_t brick = 0; brick < open.size(); brick++) {
+		if (open[brick]) {
+			entries[brick] = next;
+			next += AMP_BRICK_CELLS;
+		}
+	}
+
+	for (uint32_t brick = 0; brick < open.size(); brick++) {
+		if (!open[brick] && !solid[brick]) {
+			entries[brick] = farEntries[brick] = AMP_BRICK_FAR | next++;
+		}
+	}
+
+	// Slots start on a whole brick, so a LOG8 scale run (AmpLayout.h) never spans two bricks.
+	refineBase = (next + AMP_BRICK_CELLS - 1) / AMP_BRICK_CELLS * AMP_BRICK_CELLS;
+	refineSlots.clear();
+
+	listWork();
+
+}
+
+void SparseVolume::listWork() {
+
+	workBricks.clear();
+
+	std::vector<uint32_t> farList;
+
+	for (uint32_t brick = 0; brick < entries.size(); brick++) {
+		if (entries[brick] == AMP_BRICK_SOLID) {
+			continue;
+		}
+
+		if ((entries[brick] & AMP_BRICK_FAR) != 0u) {
+			farList.push_back(brick);
+		}
+		else {
+			workBricks.push_back(brick);
+		}
+	}
+
+	openBricks = static_cast<uint32_t>(workBricks.size());
+	farBricks = static_cast<uint32_t>(farList.size());
+
+	workBricks.insert(workBricks.end(), farList.begin(), farList.end());
+
+}
+
+std::vector<float> SparseVolume::solveCoarse(const CPUSolver& solver, const glm::vec3& sourcePos, const ModelExtent& extents) const {
+
+	glm::vec3 gridMin = glm::vec3(extents.xMin, extents.yMin, extents.zMin);
+	std::vector<float> coarse(entries.size(), 0.0f);
+
+	std::vector<uint32_t> bricks(entries.size());
+	std::iota(bricks.begin(), bricks.end(), 0u);
+
+	std::for_each(std::execution::par, bricks.begin(), bricks.end(), [&](uint32_t brick) {
+		if (entries[brick] == AMP_BRICK_SOLID) {
+			return;
+		}
+
+		glm::ivec3 cell = representative(brickOrigin(brick));
+		glm::vec3 centre = glm::vec3(cell) * AMP_CELL_SIZE + glm::vec3(AMP_CELL_SIZE / 2.0f) + gridMin;
+
+		float t;
+		if (!solver.traverse(centre, sourcePos, cell, t)) {
+			coarse[brick] = attenuatedPower(glm::length(sourcePos - centre));
+		}
+	});
+
+	return coarse;
+
+}
+
+uint32_t SparseVolume::refine(const std::vector<float>& coarse, const glm::vec3& sourcePos, const ModelExtent& extents, float threshold, uint32_t maxRefined) {
+
+	glm::ivec3 bricks = ampBrickCount(extent);
+	glm::ivec3 sourceCell = getAmpCellID(sourcePos, extents);
+	int sourceBrick = glm::all(glm::greaterThanEqual(sourceCell, glm::ivec3(0))) && glm::all(glm::lessThan(sourceCell, extent)) ? ampBrickID(sourceCell, extent) : -1;
+
+	std::vector<uint8_t> open = geometryOpen;
+	std::vector<uint8_t> solid(entries.size(), 0);
+
+	for (uint32_t brick = 0; brick < entries.size(); brick++) {
+		solid[brick] = entries[brick] == AMP_BRICK_SOLID;
+	}
+
+	const glm::ivec3 steps[6] = { { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 } };
+	std::vector<uint32_t> refined;
+
+	for (uint32_t brick = 0; brick < entries.size(); brick++) {
+		if (open[brick] || solid[brick]) {
+			continue;
+		}
+
+		glm::ivec3 position = brickOrigin(brick) >> AMP_BRICK_SHIFT;
+		bool split = int(brick) == sourceBrick;
+
+		for (int i = 0; i < 6 && !split; i++) {
+			glm::ivec3 neighbour = position + steps[i];
+
+			if (glm::any(glm::lessThan(neighbour, glm::ivec3(0))) || glm::any(glm::greaterThanEqual(neighbour, bricks))) {
+				continue;
+			}
+
+			uint32_t other = neighbour.x + neighbour.y * bricks.x + neighbour.z * bricks.x * bricks.y;
+
+			// Solid neighbours have no amplitude to compare.
+			if (solid[other]) {
+				continue;
+			}
+
+			split = std::abs(coarse[brick] - coarse[other]) > threshold || (coarse[brick] > 0.0f) != (coarse[other] > 0.0f);
+		}
+
+		if (split) {
+			refined.push_back(brick);
+		}
+	}
+
+	uint32_t wanted = static_cast<uint32_t>(refined.size());
+
+	if (wanted > maxRefined) {
+		glm::ivec3 sourceBrickPos = sourceCell >> AMP_BRICK_SHIFT;
+		auto distance = [&](uint32_t brick) {
+			glm::ivec3 d = (brickOrigin(brick) >> AMP_BRICK_SHIFT) - sourceBrickPos;
+			return d.x * d.x + d.y * d.y + d.z * d.z;
+		};
+
+		std::nth_element(refined.begin(), refined.begin() + maxRefined, refined.end(), [&](uint32_t a, uint32_t b) { return distance(a) < distance(b); });
+		refined.resize(maxRefined);
+	}
+
+	std::vector<uint8_t> keep(entries.size(), 0);
+	for (uint32_t brick : refined) {
+		keep[brick] = 1;
+	}
+
+	changedBricks.clear();
+
+	for (uint32_t& brick : refineSlots) {
+		if (brick != AMP_BRICK_SOLID && !keep[brick]) {
+			entries[brick] = farEntries[brick];
+			changedBricks.push_back(brick);
+			brick = AMP_BRICK_SOLID;
+		}
+	}
+
+	uint32_t slot = 0;
+
+	for (uint32_t brick : refined) {
+		// Already refined, and staying in its slot.
+		if ((entries[brick] & AMP_BRICK_FAR) == 0u) {
+			continue;
+		}
+
+		while (slot < refineSlots.size() && refineSlots[slot] != AMP_BRICK_SOLID) {
+			slot++;
+		}
+
+		if (slot == refineSlots.size()) {
+			refineSlots.push_back(AMP_BRICK_SOLID);
+		}
+
+		refineSlots[slot] = brick;
+		entries[brick] = refineBase + slot * AMP_BRICK_CELLS;
+		changedBricks.push_back(brick);
+	}
+
+	listWork();
+
+	return wanted;
+
+}
+
+void SparseVolume::reserveRefined(uint32_t capacity) {
+
+	if (capacity > refineSlots.size()) {
+		refineSlots.resize(capacity, AMP_BRICK_SOLID);
+	}
+
+}
+
+bool SparseVolume::isSolved(const glm::ivec3& cell) const {
+
+	uint32_t entry = entries[ampBrickID(cell, extent)];
+
+	if (entry == AMP_BRICK_SOLID) {
+		return false;
+	}
+
+	return (entry & AMP_BRICK_FAR) == 0u || cell == representative(cell);
+
+}
+
+glm::ivec3 SparseVolume::representative(const glm::ivec3& cell) const {
+
+	return glm::min((cell & ~AMP_BRICK_MASK) + AMP_BRICK_SIZE / 2, extent - 1);
+
+}
+
+glm::ivec3 SparseVolume::brickOrigin(uint32_t brick) const {
+
+	glm::ivec3 bricks = ampBrickCount(extent);
+	return glm::ivec3(brick % bricks.x, (brick / bricks.x) % bricks.y, brick / (bricks.x * bricks.y)) << AMP_BRICK_SHIFT;
+
+}
@@ -0,0 +1,130 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+
+#include "Geometry.h"
+#include "AmpLayout.h"
+
+class CPUSolver;
+
+// Occupancy of the amplitude grid by 8x8x8 brick, and the brick pool the GPU solves into instead of the
+// dense volume. A brick any triangle comes within a cell of is open and keeps a full brick of pool cells.
+// Every other brick is uniformly inside or outside the geometry: inside ones (buildings, under the ground)
+// are solid and get no storage, outside ones are far field and are solved once, at the representative
+// cell near their centre, with the result standing for the whole brick.
+//
+// That makes two levels, one value per brick and one per cell. An adaptive solve traces the coarse level
+// first (solveCoarse) and refines the far field bricks it can't stand for into open ones (refine).
+//
+// The pool holds the geometry's open bricks, then every far field cell, then whole brick slots for refined
+// bricks. A brick keeps its far field cell while refined and its slot while it stays refined, so moving the
+// source only changes the pool cells of the bricks that change class (getChangedBricks).
+class SparseVolume {
+
+public:
+	SparseVolume() = default;
+	// solver only supplies traverse(); it isn't kept.
+	SparseVolume(const std::vector<glm::vec4>& positions, const std::vector<Face>& faces, const CPUSolver& solver, const ModelExtent& extents, const glm::uvec3& gridSize);
+
+	bool isValid() const { return !entries.empty(); }
+
+	// Coarse level: direct amplitude from sourcePos at every brick's representative, indexed by brick,
+	// 0 where the source is hidden and for solid bricks. Traced in parallel.
+	std::vector<float> solveCoarse(const CPUSolver& solver, const glm::vec3& sourcePos, const ModelExtent& extents) const;
+	// Opens every far field brick holding sourcePos, or with a face neighbour whose coarse amplitude is more
+	// than threshold away or that sees the source when it doesn't. Each call starts over from the bricks the
+	// geometry opens: bricks no longer wanted go back to their far field cell, new ones take free slots, and
+	// slots are added while there are fewer than maxRefined. Returns how many bricks asked to be refined;
+	// only the maxRefined of them nearest the source are.
+	uint32_t refine(const std::vector<float>& coarse, const glm::vec3& sourcePos, const ModelExtent& extents, float threshold, uint32_t maxRefined = UINT32_MAX);
+	// Grows the refined slots to capacity, so later refines never move the pool's end.
+	void reserveRefined(uint32_t capacity);
+	// Bricks the last refine opened or sent back to the far field; every other brick kept its pool cells.
+	const std::vector<uint32_t>& getChangedBricks() const { return changedBricks; }
+
+	// Pool cell holding cell, -1 inside solid bricks.
+	int poolCell(const glm::ivec3& cell) const { return ampPoolCell(entries[ampBrickID(cell, extent)], cell); }
+	bool isSolid(const glm::ivec3& cell) const { return entries[ampBrickID(cell, extent)] == AMP_BRICK_SOLID; }
+	// Whether a solver has to trace cell: every cell of an open brick, one per far field brick.
+	bool isSolved(const glm::ivec3& cell) const;
+	glm::ivec3 representative(const glm::ivec3& cell) const;
+
+	// Brick table entries (AMP_BRICK_*), and the bricks to solve: open ones first, then far field ones.
+	const std::vector<uint32_t>& getEntries() const { return entries; }
+	const std::vector<uint32_t>& getWorkBricks() const { return workBricks; }
+	uint32_t getOpenBricks() const { return openBricks; }
+	uint32_t getFarBricks() const { return farBricks; }
+	uint32_t getSolidBricks() const { return static_cast<uint32_t>(entries.size()) - openBricks - farBricks; }
+	// Storage, up to the end of the last refined slot, free ones included.
+	size_t getPoolCells() const { return size_t(refineBase) + refineSlots.size() * AMP_BRICK_CELLS; }
+	// Open bricks times AMP_BRICK_CELLS plus one cell per far field brick: the invocations a solve needs.
+	size_t getWorkItems() const { return size_t(openBricks) * AMP_BRICK_CELLS + farBricks; }
+
+	// Pool cells -> dense volume in the given layout. Solid cells get solid, far field cells their brick's value.
+	template<typename Cell>
+	void expand(const Cell* pool, Cell* dense, int layout, const Cell& solid) const;
+	// Dense volume in the given layout -> pool cells.
+	template<typename Cell>
+	void gather(const Cell* dense, Cell* pool, int layout) const;
+
+private:
+	glm::ivec3 extent{ 0 };
+	std::vector<uint32_t> entries;
+	// Open bricks before any refinement.
+	std::vector<uint8_t> geometryOpen;
+	std::vector<uint32_t> workBricks;
+	uint32_t openBricks = 0;
+	uint32_t farBricks = 0;
+	// Far field entry of every brick that is neither geometry open nor solid, refined or not.
+	std::vector<uint32_t> farEntries;
+	// Brick refined into each slot, AMP_BRICK_SOLID when free. Slot i starts at pool cell refineBase + i * AMP_BRICK_CELLS.
+	std::vector<uint32_t> refineSlots;
+	uint32_t refineBase = 0;
+	std::vector<uint32_t> changedBricks;
+
+	glm::ivec3 brickOrigin(uint32_t brick) const;
+	// Numbers the pool: open bricks first in brick order, then the bricks that are neither open nor solid as far field.
+	void layoutPool(const std::vector<uint8_t>& open, const std::vector<uint8_t>& solid);
+	// Work list and counts from the entries: open bricks first in brick order, then far field ones.
+	void listWork();
+
+};
+
+template<typename Cell>
+void SparseVolume::expand(const Cell* pool, Cell* dense, int layout, const Cell& solid) const {
+
+	for (int z = 0; z < extent.z; z++) {
+		for (int y = 0; y < extent.y; y++) {
+			for (int x = 0; x < extent.x; x++) {
+				glm::ivec3 cell(x, y, z);
+				int index = poolCell(cell);
+				dense[ampCellIndex(cell, extent, layout)] = index < 0 ? solid : pool[index];
+			}
+		}
+	}
+
+}
+
+template<typename Cell>
+void SparseVolume::gather(const Cell* dense, Cell* pool, int layout) const {
+
+	for (uint32_t i = 0; i < workBricks.size(); i++) {
+		glm::ivec3 origin = brickOrigin(workBricks[i]);
+
+		if (i >= openBricks) {
+			glm::ivec3 cell = representative(origin);
+			pool[poolCell(cell)] = dense[ampCellIndex(cell, extent, layout)];
+			continue;
+		}
+
+		// Cells of an edge brick past the grid have pool storage but no dense cell; they keep what they hold.
+		for (int local = 0; local < AMP_BRICK_CELLS; local++) {
+			glm::ivec3 cell = origin + glm::ivec3(local & AMP_BRICK_MASK, (local >> AMP_BRICK_SHIFT) & AMP_BRICK_MASK, local >> (2 * AMP_BRICK_SHIFT));
+
+			if (glm::all(glm::lessThan(cell, extent))) {
+				pool[poolCell(cell)] = dense[ampCellIndex(cell, extent, layout)];
+			}
+		}
+	}
+
+}
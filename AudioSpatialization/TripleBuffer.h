@@ -0,0 +1,65 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+// Wait-free handoff of the latest value from one producer thread to one consumer thread. The producer fills
+// its private slot and swaps it with the shared middle slot; the consumer swaps the middle slot for its own
+// only when the producer has flagged it fresh. Neither side blocks or allocates, and the consumer always
+// reads a complete value, never a mix of two writes. Values the consumer misses are simply overwritten.
+template <typename T>
+class TripleBuffer {
+
+public:
+	TripleBuffer(const T& initial = T()) {
+
+		slots[0] = initial;
+		slots[1] = initial;
+		slots[2] = initial;
+
+	}
+
+	// Producer side.
+	T& writeSlot() { return slots[writeIndex]; }
+
+	void publish() {
+
+		uint8_t previous = middle.exchange(writeIndex | FRESH, std::memory_order_acq_rel);
+		writeIndex = previous & INDEX_MASK;
+
+	}
+
+	void write(const T& value) {
+
+		writeSlot() = value;
+		publish();
+
+	}
+
+	// Consumer side. Returns true when a newer value replaced the one read last time.
+	bool update() {
+
+		if ((middle.load(std::memory_order_relaxed) & FRESH) == 0) {
+			return false;
+		}
+
+		uint8_t previous = middle.exchange(readIndex, std::memory_order_acq_rel);
+		readIndex = previous & INDEX_MASK;
+
+		return true;
+
+	}
+
+	const T& read() const { return slots[readIndex]; }
+
+private:
+	static const uint8_t INDEX_MASK = 3;
+	static const uint8_t FRESH = 4;
+
+	T slots[3];
+
+	// Each index lives on its own cache line so the two threads don't contend on the slots they own.
+	alignas(64) uint8_t writeIndex = 0;
+	alignas(64) std::atomic<uint8_t> middle{ 1 };
+	alignas(64) uint8_t readIndex = 2;
+
+};
@@ -4,17 +4,29 @@
 #include <iostream>
 #include <algorithm>
 #include <set>
+#include <numeric>
+#include <cstring>
+#include <execution>
+#include <chrono>
+#include <cfloat>
+#include <string>
+#include <ctime>
+#include <sstream>
 #define TINYOBJLOADER_IMPLEMENTATION
 #include <tiny_obj_loader.h>
 
 std::vector<const char*> VulkanClass::getRequiredExtensions() {
 
-	uint32_t glfwExtentionCount = 0;
-	const char** glfwExtensions;
+	std::vector<const char*> extensions;
 
-	glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtentionCount);
+	if (!headless) {
+		uint32_t glfwExtentionCount = 0;
+		const char** glfwExtensions;
 
-	std::vector<const char*> extensions(glfwExtensions, glfwExtensions + glfwExtentionCount);
+		glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtentionCount);
+
+		extensions.assign(glfwExtensions, glfwExtensions + glfwExtentionCount);
+	}
 
 	if (enableValidationLayers) {
 		extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
@@ -55,9 +67,17 @@ VulkanClass::VulkanClass() {
 
 }
 
-VulkanClass::VulkanClass(GLFWwindow* win) {
+VulkanClass::VulkanClass(GLFWwindow* win, const std::string& modelPath, int layout, bool volumeImage, int format, bool sparse, float refine, bool cache, int trace) {
 
 	window = win;
+	MODEL_PATH = modelPath;
+	ampLayout = layout;
+	ampFormat = format;
+	useAmpImage = volumeImage;
+	sparseVolume = sparse || refine > 0.0f;
+	refineThreshold = refine;
+	useSceneCache = cache;
+	traversal = trace;
 	createInstance();
 
 	createSurface();
@@ -74,6 +94,7 @@ VulkanClass::VulkanClass(GLFWwindow* win) {
 	createDescriptorSetLayout();
 	createAmpDescriptorSetLayout();
 	createPosDescriptorSetLayout();
+	createBVHDescriptorSetLayout();
 	createDescriptorPools();
 
 	basicShader = new Shader("shader", logicalDevice);
@@ -83,13 +104,23 @@ VulkanClass::VulkanClass(GLFWwindow* win) {
 
 	createCommandPool();
 	createCommandBuffer();
+	gpuProfiler.create(logicalDevice, physicalDevice, QueueFamilyIndex.graphicsFamily, swapChain.MAX_FRAMES_IN_FLIGHT);
 
 	createVertexBuffer();
 	//createIndexBuffer();
+	// The geometry comes first: a sparse volume sizes every per cell buffer after it.
+	createSceneGeometry();
+	createSparseVolume();
 	createAmpBuffer();
-	createOctree();
+	createAmpReadbackBuffer();
+	createAmpImage();
+	createVisibilityBuffer();
+	createSourceBuffers();
+	createBrickBuffers();
+	createSceneBuffer();
 	createTriangleBuffer();
 	createAuxilaryOctreeBuffers();
+	createBVHBuffers();
 
 	createComputePipeline();
 	createGraphicsPipeline();
@@ -100,40 +131,185 @@ VulkanClass::VulkanClass(GLFWwindow* win) {
 
 }
 
-VulkanClass::~VulkanClass() {
+VulkanClass::VulkanClass(const std::string& modelPath, bool cpuOnly, int layout, int format, bool sparse, float refine, bool cache, int trace) {
+
+	// Compute only: no window, surface, swap chain or graphics pipeline, so any device with a compute queue will do (lavapipe included).
+	headless = true;
+	window = nullptr;
+	MODEL_PATH = modelPath;
+	ampLayout = layout;
+	ampFormat = format;
+	sparseVolume = sparse || refine > 0.0f;
+	refineThreshold = refine;
+	useSceneCache = cache;
+	traversal = trace;
+	deviceExtensions.clear();
+
+	// No Vulkan at all; only the geometry CPUSolver traces against.
+	this->cpuOnly = cpuOnly;
+	if (cpuOnly) {
+		loadModel();
+		setupScene();
+		createSceneGeometry();
+		createSparseVolume();
+		return;
+	}
 
-	vkDestroyImageView(logicalDevice, depthImageView, nullptr);
-	vkDestroyImage(logicalDevice, depthImage, nullptr);
-	vkFreeMemory(logicalDevice, depthImageMemory, nullptr);
+	createInstance();
 
-	for (size_t i = 0; i < swapChain.framebuffers.size(); i++) {
-		vkDestroyFramebuffer(logicalDevice, swapChain.framebuffers[i], nullptr);
-	}
+	physicalDevice = findPhysicalDevice();
+	createLogicalDevice();
 
-	for (size_t i = 0; i < swapChain.imageViews.size(); i++) {
-		vkDestroyImageView(logicalDevice, swapChain.imageViews[i], nullptr);
+	loadModel();
+
+	createDescriptorSetLayout();
+	createAmpDescriptorSetLayout();
+	createPosDescriptorSetLayout();
+	createBVHDescriptorSetLayout();
+	createDescriptorPools();
+
+	basicShader = new Shader("shader", logicalDevice);
+
+	createCommandPool();
+	createCommandBuffer();
+	gpuProfiler.create(logicalDevice, physicalDevice, QueueFamilyIndex.graphicsFamily, 1);
+
+	createSceneGeometry();
+	createSparseVolume();
+	createAmpBuffer();
+	createAmpReadbackBuffer();
+	createAmpImage();
+	createVisibilityBuffer();
+	createSourceBuffers();
+	createBrickBuffers();
+	createSceneBuffer();
+	createTriangleBuffer();
+	createAuxilaryOctreeBuffers();
+	createBVHBuffers();
+
+	createComputePipeline();
+
+	createSyncObjects();
+
+}
+
+VulkanClass::~VulkanClass() {
+
+	if (cpuOnly) {
+		free(ampVolume);
+		return;
 	}
 
-	vkDestroySwapchainKHR(logicalDevice, swapChain.__swapChain, nullptr);
+	if (!headless) {
+		vkDestroyImageView(logicalDevice, depthImageView, nullptr);
+		vkDestroyImage(logicalDevice, depthImage, nullptr);
+		vkFreeMemory(logicalDevice, depthImageMemory, nullptr);
+
+		for (size_t i = 0; i < swapChain.framebuffers.size(); i++) {
+			vkDestroyFramebuffer(logicalDevice, swapChain.framebuffers[i], nullptr);
+		}
+
+		for (size_t i = 0; i < swapChain.imageViews.size(); i++) {
+			vkDestroyImageView(logicalDevice, swapChain.imageViews[i], nullptr);
+		}
+
+		vkDestroySwapchainKHR(logicalDevice, swapChain.__swapChain, nullptr);
 
-	vkDestroyBuffer(logicalDevice, vertexBuffer, nullptr);
-	vkFreeMemory(logicalDevice, vertexBufferMemory, nullptr);
+		vkDestroyBuffer(logicalDevice, vertexBuffer, nullptr);
+		vkFreeMemory(logicalDevice, vertexBufferMemory, nullptr);
+	}
 
-	//vkDestroyDescriptorPool(logicalDevice, imguiDescriptorPool, nullptr);
-	//ImGui_ImplVulkan_Shutdown();
+	if (guiEnabled) {
+		ImGui_ImplVulkan_Shutdown();
+		ImGui_ImplGlfw_Shutdown();
+		ImGui::DestroyContext();
+		vkDestroyDescriptorPool(logicalDevice, imguiDescriptorPool, nullptr);
+	}
 
 	vkDestroyBuffer(logicalDevice, ampBuffer, nullptr);
 	vkFreeMemory(logicalDevice, ampBufferMemory, nullptr);
 
+	vkDestroyBuffer(logicalDevice, ampReadbackBuffer, nullptr);
+	vkFreeMemory(logicalDevice, ampReadbackMemory, nullptr);
+
+	vkDestroyBuffer(logicalDevice, ampScaleBuffer, nullptr);
+	vkFreeMemory(logicalDevice, ampScaleMemory, nullptr);
+
+	vkDestroyBuffer(logicalDevice, ampScaleReadbackBuffer, nullptr);
+	vkFreeMemory(logicalDevice, ampScaleReadbackMemory, nullptr);
+
+	vkDestroySampler(logicalDevice, ampSampler, nullptr);
+	vkDestroyImageView(logicalDevice, ampImageView, nullptr);
+	vkDestroyImage(logicalDevice, ampImage, nullptr);
+	vkFreeMemory(logicalDevice, ampImageMemory, nullptr);
+
+	vkDestroyBuffer(logicalDevice, sceneBuffer, nullptr);
+	vkFreeMemory(logicalDevice, sceneBufferMemory, nullptr);
+
+	vkDestroyBuffer(logicalDevice, visibilityBuffer, nullptr);
+	vkFreeMemory(logicalDevice, visibilityBufferMemory, nullptr);
+
+	vkDestroyBuffer(logicalDevice, hitBuffer, nullptr);
+	vkFreeMemory(logicalDevice, hitBufferMemory, nullptr);
+
+	vkDestroyBuffer(logicalDevice, sourceBuffer, nullptr);
+	vkFreeMemory(logicalDevice, sourceBufferMemory, nullptr);
+
+	destroyChannelBuffers();
+
+	vkDestroyBuffer(logicalDevice, bandBuffer, nullptr);
+	vkFreeMemory(logicalDevice, bandBufferMemory, nullptr);
+
+	vkDestroyBuffer(logicalDevice, bandReadbackBuffer, nullptr);
+	vkFreeMemory(logicalDevice, bandReadbackMemory, nullptr);
+
+	vkDestroyBuffer(logicalDevice, brickTableBuffer, nullptr);
+	vkFreeMemory(logicalDevice, brickTableMemory, nullptr);
+
+	vkDestroyBuffer(logicalDevice, workBrickBuffer, nullptr);
+	vkFreeMemory(logicalDevice, workBrickMemory, nullptr);
+
+	vkDestroyBuffer(logicalDevice, dispatchArgsBuffer, nullptr);
+	vkFreeMemory(logicalDevice, dispatchArgsMemory, nullptr);
+
+	gpuProfiler.destroy();
+
 	vkDestroyBuffer(logicalDevice, posBuffer, nullptr);
 	vkFreeMemory(logicalDevice, posBufferMemory, nullptr);
 
+	vkDestroyBuffer(logicalDevice, faceBuffer, nullptr);
+	vkFreeMemory(logicalDevice, faceBufferMemory, nullptr);
+
+	vkDestroyBuffer(logicalDevice, octreeBuffer, nullptr);
+	vkFreeMemory(logicalDevice, octreeBufferMemory, nullptr);
+
 	vkDestroyBuffer(logicalDevice, midpointsBuffer, nullptr);
 	vkFreeMemory(logicalDevice, midpointsBufferMemory, nullptr);
 
 	vkDestroyBuffer(logicalDevice, sizesBuffer, nullptr);
 	vkFreeMemory(logicalDevice, sizesBufferMemory, nullptr);
 
+	vkDestroyBuffer(logicalDevice, offsetsBuffer, nullptr);
+	vkFreeMemory(logicalDevice, offsetsBufferMemory, nullptr);
+
+	vkDestroyBuffer(logicalDevice, bvhNodeBuffer, nullptr);
+	vkFreeMemory(logicalDevice, bvhNodeBufferMemory, nullptr);
+
+	vkDestroyBuffer(logicalDevice, bvhTriangleBuffer, nullptr);
+	vkFreeMemory(logicalDevice, bvhTriangleBufferMemory, nullptr);
+
+	vkDestroyBuffer(logicalDevice, bvhFaceIdBuffer, nullptr);
+	vkFreeMemory(logicalDevice, bvhFaceIdBufferMemory, nullptr);
+
+	vkDestroyBuffer(logicalDevice, edgeBuffer, nullptr);
+	vkFreeMemory(logicalDevice, edgeBufferMemory, nullptr);
+
+	vkDestroyBuffer(logicalDevice, edgeBucketStartBuffer, nullptr);
+	vkFreeMemory(logicalDevice, edgeBucketStartBufferMemory, nullptr);
+
+	vkDestroyBuffer(logicalDevice, edgeBucketBuffer, nullptr);
+	vkFreeMemory(logicalDevice, edgeBucketBufferMemory, nullptr);
+
 	for (size_t i = 0; i < swapChain.MAX_FRAMES_IN_FLIGHT; i++) {
 		vkDestroyBuffer(logicalDevice, transformBuffer[i], nullptr);
 		vkFreeMemory(logicalDevice, transformBufferMemory[i], nullptr);
@@ -146,14 +322,21 @@ VulkanClass::~VulkanClass() {
 	vkDestroyDescriptorSetLayout(logicalDevice, posDescriptorSetLayout, nullptr);
 	vkDestroyDescriptorSetLayout(logicalDevice, midpointsDescriptorSetLayout, nullptr);
 	vkDestroyDescriptorSetLayout(logicalDevice, sizesDescriptorSetLayout, nullptr);
+	vkDestroyDescriptorSetLayout(logicalDevice, bvhDescriptorSetLayout, nullptr);
 
-	vkDestroyPipeline(logicalDevice, graphicsPipeline, nullptr);
-	vkDestroyPipelineLayout(logicalDevice, pipelineLayout, nullptr);
+	if (!headless) {
+		vkDestroyPipeline(logicalDevice, graphicsPipeline, nullptr);
+		vkDestroyPipelineLayout(logicalDevice, pipelineLayout, nullptr);
+	}
 
-	vkDestroyPipeline(logicalDevice, computePipeline, nullptr);
+	for (VkPipeline pipeline : computePipelines) {
+		vkDestroyPipeline(logicalDevice, pipeline, nullptr);
+	}
 	vkDestroyPipelineLayout(logicalDevice, computePipelineLayout, nullptr);
 
-	vkDestroyRenderPass(logicalDevice, renderPass, nullptr);
+	if (!headless) {
+		vkDestroyRenderPass(logicalDevice, renderPass, nullptr);
+	}
 
 	delete basicShader;
 
@@ -177,7 +360,9 @@ VulkanClass::~VulkanClass() {
 
 	vkDestroyDevice(logicalDevice, nullptr);
 
-	vkDestroySurfaceKHR(instance, surface, nullptr);
+	if (!headless) {
+		vkDestroySurfaceKHR(instance, surface, nullptr);
+	}
 
 	vkDestroyInstance(instance, nullptr);
 
@@ -186,7 +371,13 @@ VulkanClass::~VulkanClass() {
 void VulkanClass::createInstance() {
 
 	if (enableValidationLayers && !checkValidationLayerSupport()) {
-		throw std::runtime_error("Validation Layers Requested But Not Found\n");
+		// Batch and CI machines often only have the ICD installed, so run there without validation.
+		if (!headless) {
+			throw std::runtime_error("Validation Layers Requested But Not Found\n");
+		}
+
+		std::cout << "VALIDATION LAYERS NOT FOUND - CONTINUING WITHOUT VALIDATION\n";
+		enableValidationLayers = false;
 	}
 
 	VkApplicationInfo appInfo{};
@@ -235,24 +426,38 @@ bool VulkanClass::findQueueFamilies(VkPhysicalDevice device) {
 	std::vector<VkQueueFamilyProperties> queueFamilies(physicalDeviceQueueFamilyCount);
 	vkGetPhysicalDeviceQueueFamilyProperties(device, &physicalDeviceQueueFamilyCount, queueFamilies.data());
 
+	// Graphics and compute work share one queue. Headless only needs that queue to support compute.
+	VkQueueFlags requiredFlags = headless ? VK_QUEUE_COMPUTE_BIT : (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT);
+
+	bool queueFound = false;
+	bool presentFound = headless;
+
 	uint32_t i = 0;
 	for (auto queueFamily : queueFamilies) {
-		if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT & VK_QUEUE_COMPUTE_BIT > 0) {
+		if (!queueFound && (queueFamily.queueFlags & requiredFlags) == requiredFlags) {
 			QueueFamilyIndex.graphicsFamily = i;
-			return true;
+			QueueFamilyIndex.computeFamily = i;
+			queueFound = true;
 		}
 
-		VkBool32 presentSupport = VK_FALSE;
-		vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+		if (!presentFound) {
+			VkBool32 presentSupport = VK_FALSE;
+			vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
 
-		if (presentSupport) {
-			QueueFamilyIndex.presentFamily = i;
+			if (presentSupport) {
+				QueueFamilyIndex.presentFamily = i;
+				presentFound = true;
+			}
 		}
 
 		i++;
 	}
 
-	return false;
+	if (headless) {
+		QueueFamilyIndex.presentFamily = QueueFamilyIndex.graphicsFamily;
+	}
+
+	return queueFound && presentFound;
 
 }
 
@@ -314,7 +519,13 @@ VkPhysicalDevice VulkanClass::findPhysicalDevice() {
 			requiredExtensions.erase(extension.extensionName);
 		}
 
-		if (!findQueueFamilies(device) || !requiredExtensions.empty() || !(features.tessellationShader) || !checkSwapChainSupport(device) || properties.deviceType != VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU) {
+		if (headless) {
+			// Take the first device with a compute queue, but let a discrete GPU replace a CPU implementation.
+			if (!findQueueFamilies(device) || (selectedDevice != NULL && properties.deviceType != VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU)) {
+				continue;
+			}
+		}
+		else if (!findQueueFamilies(device) || !requiredExtensions.empty() || !(features.tessellationShader) || !checkSwapChainSupport(device) || properties.deviceType != VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU) {
 			continue;
 		}
 
@@ -328,6 +539,9 @@ VkPhysicalDevice VulkanClass::findPhysicalDevice() {
 		throw std::runtime_error("Cannot Find Suitable Physical Device\n");
 	}
 
+	// Later devices in the loop overwrite the queue family indices, so take them from the selected one again.
+	findQueueFamilies(selectedDevice);
+
 	return selectedDevice;
 
 }
@@ -354,9 +568,11 @@ void VulkanClass::createLogicalDevice() {
 	vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
 
 	VkPhysicalDeviceFeatures requiredFeatures{};
-	requiredFeatures.tessellationShader = VK_TRUE;
-	requiredFeatures.fillModeNonSolid = VK_TRUE;
-	requiredFeatures.wideLines = VK_TRUE;
+	if (!headless) {
+		requiredFeatures.tessellationShader = VK_TRUE;
+		requiredFeatures.fillModeNonSolid = VK_TRUE;
+		requiredFeatures.wideLines = VK_TRUE;
+	}
 
 	VkDeviceCreateInfo logicalDeviceCreateInfo{};
 
@@ -583,10 +799,14 @@ void VulkanClass::createDescriptorSetLayout() {
 	transformLayoutBinding.descriptorCount = 1;
 	transformLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
 
+	// binding 1 is the scene block: grid extent, model offset, cell size and source position
+	VkDescriptorSetLayoutBinding transformLayoutBindings[2] = { transformLayoutBinding, transformLayoutBinding };
+	transformLayoutBindings[1].binding = 1;
+
 	VkDescriptorSetLayoutCreateInfo transformLayoutInfo{};
 	transformLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-	transformLayoutInfo.bindingCount = 1;
-	transformLayoutInfo.pBindings = &transformLayoutBinding;
+	transformLayoutInfo.bindingCount = 2;
+	transformLayoutInfo.pBindings = transformLayoutBindings;
 
 	if (vkCreateDescriptorSetLayout(logicalDevice, &transformLayoutInfo, nullptr, &transformDescriptorSetLayout) != VK_SUCCESS) {
 		throw std::runtime_error("Failed to create Transform Descriptor Set layout\n");
@@ -606,7 +826,16 @@ void VulkanClass::createPosDescriptorSetLayout() {
 	posLayoutInfo.bindingCount = 1;
 	posLayoutInfo.pBindings = &posLayoutBinding;
 
-	if (vkCreateDescriptorSetLayout(logicalDevice, &posLayoutInfo, nullptr, &posDescriptorSetLayout) != VK_SUCCESS) {
+	// binding 0 holds the shared vertex positions, binding 1 the faces indexing them, binding 2 the face ids binned per cell
+	VkDescriptorSetLayoutBinding geometryLayoutBindings[3] = { posLayoutBinding, posLayoutBinding, posLayoutBinding };
+	geometryLayoutBindings[1].binding = 1;
+	geometryLayoutBindings[2].binding = 2;
+
+	VkDescriptorSetLayoutCreateInfo geometryLayoutInfo = posLayoutInfo;
+	geometryLayoutInfo.bindingCount = 3;
+	geometryLayoutInfo.pBindings = geometryLayoutBindings;
+
+	if (vkCreateDescriptorSetLayout(logicalDevice, &geometryLayoutInfo, nullptr, &posDescriptorSetLayout) != VK_SUCCESS) {
 		throw std::runtime_error("Failed to create Pos Descriptor Set layout\n");
 	}
 
@@ -614,24 +843,72 @@ void VulkanClass::createPosDescriptorSetLayout() {
 		throw std::runtime_error("Failed to create Pos Descriptor Set layout\n");
 	}
 
-	if (vkCreateDescriptorSetLayout(logicalDevice, &posLayoutInfo, nullptr, &sizesDescriptorSetLayout) != VK_SUCCESS) {
+	// binding 0 holds the per cell triangle counts, binding 1 their exclusive prefix sum
+	VkDescriptorSetLayoutBinding sizesLayoutBindings[2] = { posLayoutBinding, posLayoutBinding };
+	sizesLayoutBindings[1].binding = 1;
+
+	VkDescriptorSetLayoutCreateInfo sizesLayoutInfo = posLayoutInfo;
+	sizesLayoutInfo.bindingCount = 2;
+	sizesLayoutInfo.pBindings = sizesLayoutBindings;
+
+	if (vkCreateDescriptorSetLayout(logicalDevice, &sizesLayoutInfo, nullptr, &sizesDescriptorSetLayout) != VK_SUCCESS) {
 		throw std::runtime_error("Failed to create Pos Descriptor Set layout\n");
 	}
 
 }
 
+void VulkanClass::createBVHDescriptorSetLayout() {
+
+	// Nodes, triangles and face ids, then the diffraction edges, their hash buckets and the edge ids they point into.
+	std::vector<VkDescriptorSetLayoutBinding> bvhLayoutBindings(6);
+
+	for (uint32_t i = 0; i < bvhLayoutBindings.size(); i++) {
+		bvhLayoutBindings[i].binding = i;
+		bvhLayoutBindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		bvhLayoutBindings[i].descriptorCount = 1;
+		bvhLayoutBindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	}
+
+	VkDescriptorSetLayoutCreateInfo bvhLayoutInfo{};
+	bvhLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	bvhLayoutInfo.bindingCount = static_cast<uint32_t>(bvhLayoutBindings.size());
+	bvhLayoutInfo.pBindings = bvhLayoutBindings.data();
+
+	if (vkCreateDescriptorSetLayout(logicalDevice, &bvhLayoutInfo, nullptr, &bvhDescriptorSetLayout) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create BVH Descriptor Set layout\n");
+	}
+
+}
+
 void VulkanClass::createAmpDescriptorSetLayout() {
 
-	VkDescriptorSetLayoutBinding ampLayoutBinding{};
-	ampLayoutBinding.binding = 0;
-	ampLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-	ampLayoutBinding.descriptorCount = 1;
-	ampLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
+	std::vector<VkDescriptorSetLayoutBinding> ampLayoutBindings(11);
+
+	for (uint32_t i = 0; i < ampLayoutBindings.size(); i++) {
+		ampLayoutBindings[i].binding = i;
+		ampLayoutBindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		ampLayoutBindings[i].descriptorCount = 1;
+		ampLayoutBindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	}
+
+	// The fragment shader only reads the amplitudes; visibility bits, channels, sources and bands are compute only.
+	ampLayoutBindings[0].stageFlags |= VK_SHADER_STAGE_FRAGMENT_BIT;
+
+	// The 3D image: written as a storage image by the solve, sampled by the renderer.
+	ampLayoutBindings[5].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	ampLayoutBindings[6].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	ampLayoutBindings[6].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+	// Brick table, read by both to find a sparse pool's cells, then the compute only work list and hit distances.
+	ampLayoutBindings[7].stageFlags |= VK_SHADER_STAGE_FRAGMENT_BIT;
+
+	// LOG8 scales, needed by both to decode the amplitudes.
+	ampLayoutBindings[10].stageFlags |= VK_SHADER_STAGE_FRAGMENT_BIT;
 
 	VkDescriptorSetLayoutCreateInfo ampLayoutInfo{};
 	ampLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-	ampLayoutInfo.bindingCount = 1;
-	ampLayoutInfo.pBindings = &ampLayoutBinding;
+	ampLayoutInfo.bindingCount = static_cast<uint32_t>(ampLayoutBindings.size());
+	ampLayoutInfo.pBindings = ampLayoutBindings.data();
 
 	if (vkCreateDescriptorSetLayout(logicalDevice, &ampLayoutInfo, nullptr, &AmpDescriptorSetLayout) != VK_SUCCESS) {
 		throw std::runtime_error("Failed to create Amplitude Descriptor Set layout\n");
@@ -643,7 +920,7 @@ void VulkanClass::createDescriptorPools() {
 
 	VkDescriptorPoolSize poolSize;
 	poolSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	poolSize.descriptorCount = static_cast<uint32_t>(swapChain.MAX_FRAMES_IN_FLIGHT);
+	poolSize.descriptorCount = static_cast<uint32_t>(2 * swapChain.MAX_FRAMES_IN_FLIGHT);
 
 	VkDescriptorPoolCreateInfo poolInfo{};
 	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
@@ -655,10 +932,15 @@ void VulkanClass::createDescriptorPools() {
 		throw std::runtime_error("Failed to Create Uniform Descriptor Pool\n");
 	}
 
-	poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-	poolSize.descriptorCount = 4;
+	VkDescriptorPoolSize ampPoolSizes[3] = {
+		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 24 },
+		{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1 },
+		{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1 }
+	};
 
-	poolInfo.maxSets = 4;
+	poolInfo.poolSizeCount = 3;
+	poolInfo.pPoolSizes = ampPoolSizes;
+	poolInfo.maxSets = 5;
 
 	if (vkCreateDescriptorPool(logicalDevice, &poolInfo, nullptr, &ampDescriptorPool) != VK_SUCCESS) {
 		throw std::runtime_error("Failed to Create Amplitude Descriptor Pool\n");
@@ -730,10 +1012,7 @@ void VulkanClass::createPosDescriptorSet() {
 	VkDescriptorBufferInfo bufferInfo{};
 	bufferInfo.buffer = posBuffer;
 	bufferInfo.offset = 0;
-	bufferInfo.range = sizeof(Triangle) * triangles.size();
-
-	int floatSize = sizeof(float);
-	int size = sizeof(Triangle);
+	bufferInfo.range = sizeof(glm::vec4) * positions.size();
 
 	VkWriteDescriptorSet ampWrite{};
 	ampWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
@@ -746,6 +1025,22 @@ void VulkanClass::createPosDescriptorSet() {
 
 	vkUpdateDescriptorSets(logicalDevice, 1, &ampWrite, 0, nullptr);
 
+	bufferInfo.buffer = faceBuffer;
+	bufferInfo.range = sizeof(Face) * faces.size();
+
+	ampWrite.dstBinding = 1;
+
+	vkUpdateDescriptorSets(logicalDevice, 1, &ampWrite, 0, nullptr);
+
+	bufferInfo.buffer = octreeBuffer;
+	bufferInfo.range = sizeof(uint32_t) * Octree.size();
+
+	ampWrite.dstBinding = 2;
+
+	vkUpdateDescriptorSets(logicalDevice, 1, &ampWrite, 0, nullptr);
+
+	ampWrite.dstBinding = 0;
+
 	allocInfo.pSetLayouts = &midpointsDescriptorSetLayout;
 
 	if (vkAllocateDescriptorSets(logicalDevice, &allocInfo, &midpointsDescriptorSet) != VK_SUCCESS) {
@@ -775,6 +1070,77 @@ void VulkanClass::createPosDescriptorSet() {
 
 	vkUpdateDescriptorSets(logicalDevice, 1, &ampWrite, 0, nullptr);
 
+	bufferInfo.buffer = offsetsBuffer;
+	bufferInfo.range = sizeof(unsigned int) * Offsets.size();
+
+	ampWrite.dstBinding = 1;
+
+	vkUpdateDescriptorSets(logicalDevice, 1, &ampWrite, 0, nullptr);
+
+}
+
+void VulkanClass::createBVHDescriptorSet() {
+
+	VkDescriptorSetAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = ampDescriptorPool;
+	allocInfo.descriptorSetCount = 1;
+	allocInfo.pSetLayouts = &bvhDescriptorSetLayout;
+
+	if (vkAllocateDescriptorSets(logicalDevice, &allocInfo, &bvhDescriptorSet) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to Create BVH Descriptor Set\n");
+	}
+
+	VkDescriptorBufferInfo nodeInfo{};
+	nodeInfo.buffer = bvhNodeBuffer;
+	nodeInfo.offset = 0;
+	nodeInfo.range = sizeof(BVHNode) * bvh.nodes.size();
+
+	VkDescriptorBufferInfo triangleInfo{};
+	triangleInfo.buffer = bvhTriangleBuffer;
+	triangleInfo.offset = 0;
+	triangleInfo.range = sizeof(PrecomputedTriangle) * bvhTriangles.size();
+
+	VkDescriptorBufferInfo faceIdInfo{};
+	faceIdInfo.buffer = bvhFaceIdBuffer;
+	faceIdInfo.offset = 0;
+	faceIdInfo.range = sizeof(uint32_t) * bvh.triIndices.size();
+
+	VkDescriptorBufferInfo edgeInfo{};
+	edgeInfo.buffer = edgeBuffer;
+	edgeInfo.offset = 0;
+	edgeInfo.range = VK_WHOLE_SIZE;
+
+	VkDescriptorBufferInfo bucketStartInfo{};
+	bucketStartInfo.buffer = edgeBucketStartBuffer;
+	bucketStartInfo.offset = 0;
+	bucketStartInfo.range = VK_WHOLE_SIZE;
+
+	VkDescriptorBufferInfo bucketInfo{};
+	bucketInfo.buffer = edgeBucketBuffer;
+	bucketInfo.offset = 0;
+	bucketInfo.range = VK_WHOLE_SIZE;
+
+	std::vector<VkWriteDescriptorSet> bvhWrites(6);
+
+	for (uint32_t i = 0; i < bvhWrites.size(); i++) {
+		bvhWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		bvhWrites[i].dstSet = bvhDescriptorSet;
+		bvhWrites[i].dstBinding = i;
+		bvhWrites[i].dstArrayElement = 0;
+		bvhWrites[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		bvhWrites[i].descriptorCount = 1;
+	}
+
+	bvhWrites[0].pBufferInfo = &nodeInfo;
+	bvhWrites[1].pBufferInfo = &triangleInfo;
+	bvhWrites[2].pBufferInfo = &faceIdInfo;
+	bvhWrites[3].pBufferInfo = &edgeInfo;
+	bvhWrites[4].pBufferInfo = &bucketStartInfo;
+	bvhWrites[5].pBufferInfo = &bucketInfo;
+
+	vkUpdateDescriptorSets(logicalDevice, static_cast<uint32_t>(bvhWrites.size()), bvhWrites.data(), 0, nullptr);
+
 }
 
 void VulkanClass::createAmpDescriptorSet() {
@@ -792,18 +1158,81 @@ void VulkanClass::createAmpDescriptorSet() {
 	VkDescriptorBufferInfo bufferInfo{};
 	bufferInfo.buffer = ampBuffer;
 	bufferInfo.offset = 0;
-	bufferInfo.range = sizeof(AmpVolume) * ampVolumeSize;
-
-	VkWriteDescriptorSet ampWrite{};
-	ampWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-	ampWrite.dstSet = ampDescriptorSet;
-	ampWrite.dstBinding = 0;
-	ampWrite.dstArrayElement = 0;
-	ampWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-	ampWrite.descriptorCount = 1;
-	ampWrite.pBufferInfo = &bufferInfo;
+	bufferInfo.range = ampBufferBytes;
+
+	VkDescriptorBufferInfo visibilityInfo{};
+	visibilityInfo.buffer = visibilityBuffer;
+	visibilityInfo.offset = 0;
+	visibilityInfo.range = VK_WHOLE_SIZE;
+
+	VkDescriptorBufferInfo channelInfo{};
+	channelInfo.buffer = channelBuffer;
+	channelInfo.offset = 0;
+	channelInfo.range = sizeof(SourceChannels) * channelCells;
+
+	VkDescriptorBufferInfo sourceInfo{};
+	sourceInfo.buffer = sourceBuffer;
+	sourceInfo.offset = 0;
+	sourceInfo.range = sizeof(glm::vec4) * MAX_SOURCES;
+
+	VkDescriptorBufferInfo bandInfo{};
+	bandInfo.buffer = bandBuffer;
+	bandInfo.offset = 0;
+	bandInfo.range = sizeof(BandAmplitude) * ampGpuCells;
+
+	VkDescriptorBufferInfo brickTableInfo{};
+	brickTableInfo.buffer = brickTableBuffer;
+	brickTableInfo.offset = 0;
+	brickTableInfo.range = VK_WHOLE_SIZE;
+
+	VkDescriptorBufferInfo workBrickInfo{};
+	workBrickInfo.buffer = workBrickBuffer;
+	workBrickInfo.offset = 0;
+	workBrickInfo.range = VK_WHOLE_SIZE;
+
+	VkDescriptorBufferInfo hitInfo{};
+	hitInfo.buffer = hitBuffer;
+	hitInfo.offset = 0;
+	hitInfo.range = VK_WHOLE_SIZE;
+
+	VkDescriptorBufferInfo scaleInfo{};
+	scaleInfo.buffer = ampScaleBuffer;
+	scaleInfo.offset = 0;
+	scaleInfo.range = ampScaleBytes;
+
+	VkDescriptorImageInfo storageImageInfo{};
+	storageImageInfo.imageView = ampImageView;
+	storageImageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+	VkDescriptorImageInfo sampledImageInfo = storageImageInfo;
+	sampledImageInfo.sampler = ampSampler;
+
+	std::vector<VkWriteDescriptorSet> ampWrites(11);
+
+	for (uint32_t i = 0; i < ampWrites.size(); i++) {
+		ampWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		ampWrites[i].dstSet = ampDescriptorSet;
+		ampWrites[i].dstBinding = i;
+		ampWrites[i].dstArrayElement = 0;
+		ampWrites[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		ampWrites[i].descriptorCount = 1;
+	}
 
-	vkUpdateDescriptorSets(logicalDevice, 1, &ampWrite, 0, nullptr);
+	ampWrites[0].pBufferInfo = &bufferInfo;
+	ampWrites[1].pBufferInfo = &visibilityInfo;
+	ampWrites[2].pBufferInfo = &channelInfo;
+	ampWrites[3].pBufferInfo = &sourceInfo;
+	ampWrites[4].pBufferInfo = &bandInfo;
+	ampWrites[5].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	ampWrites[5].pImageInfo = &storageImageInfo;
+	ampWrites[6].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	ampWrites[6].pImageInfo = &sampledImageInfo;
+	ampWrites[7].pBufferInfo = &brickTableInfo;
+	ampWrites[8].pBufferInfo = &workBrickInfo;
+	ampWrites[9].pBufferInfo = &hitInfo;
+	ampWrites[10].pBufferInfo = &scaleInfo;
+
+	vkUpdateDescriptorSets(logicalDevice, static_cast<uint32_t>(ampWrites.size()), ampWrites.data(), 0, nullptr);
 
 }
 
@@ -839,6 +1268,13 @@ void VulkanClass::createTransformDescriptorSet() {
 		transformWrite.pBufferInfo = &bufferInfo;
 
 		vkUpdateDescriptorSets(logicalDevice, 1, &transformWrite, 0, nullptr);
+
+		bufferInfo.buffer = sceneBuffer;
+		bufferInfo.range = sizeof(SceneUniform);
+
+		transformWrite.dstBinding = 1;
+
+		vkUpdateDescriptorSets(logicalDevice, 1, &transformWrite, 0, nullptr);
 	}
 
 }
@@ -856,27 +1292,57 @@ void VulkanClass::createComputePipeline() {
 	VkPipelineLayoutCreateInfo pipelineInfo{};
 	pipelineInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
 
-	std::vector<VkDescriptorSetLayout> setLayouts = { AmpDescriptorSetLayout, posDescriptorSetLayout, midpointsDescriptorSetLayout, sizesDescriptorSetLayout, transformDescriptorSetLayout };
+	std::vector<VkDescriptorSetLayout> setLayouts = { AmpDescriptorSetLayout, posDescriptorSetLayout, midpointsDescriptorSetLayout, sizesDescriptorSetLayout, transformDescriptorSetLayout, bvhDescriptorSetLayout };
 	pipelineInfo.setLayoutCount = setLayouts.size();
 	pipelineInfo.pSetLayouts = setLayouts.data();
 
-	if (vkCreatePipelineLayout(logicalDevice, &pipelineInfo, nullptr, &computePipelineLayout) != VK_SUCCESS) {
+	// Called again by the workgroup tuner, which only swaps the pipeline and keeps the layout.
+	if (computePipelineLayout == VK_NULL_HANDLE && vkCreatePipelineLayout(logicalDevice, &pipelineInfo, nullptr, &computePipelineLayout) != VK_SUCCESS) {
 		throw std::runtime_error("Failed to Create Compute Pipeline Layout\n");
 	}
 
+	for (VkPipeline& pipeline : computePipelines) {
+		if (pipeline != VK_NULL_HANDLE) {
+			vkDestroyPipeline(logicalDevice, pipeline, nullptr);
+		}
+	}
+
+	// 0..2 workgroup size, 3 volume layout, 4 whether the 3D image is written, 5 element format, 6 sparse pool, 7 solve pass,
+	// 8 visibility traversal.
+	std::vector<VkSpecializationMapEntry> specEntries(9);
+	for (uint32_t i = 0; i < specEntries.size(); i++) {
+		specEntries[i].constantID = i;
+		specEntries[i].offset = i * sizeof(uint32_t);
+		specEntries[i].size = sizeof(uint32_t);
+	}
+
+	uint32_t specData[9] = { computeLocalSize.x, computeLocalSize.y, computeLocalSize.z, static_cast<uint32_t>(ampLayout), static_cast<uint32_t>(useAmpImage), static_cast<uint32_t>(ampFormat),
+		static_cast<uint32_t>(sparseVolume), 0, static_cast<uint32_t>(traversal) };
+
+	VkSpecializationInfo specInfo{};
+	specInfo.mapEntryCount = static_cast<uint32_t>(specEntries.size());
+	specInfo.pMapEntries = specEntries.data();
+	specInfo.dataSize = sizeof(specData);
+	specInfo.pData = specData;
+
 	VkComputePipelineCreateInfo computePipelineInfo{};
 	computePipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
 	computePipelineInfo.layout = computePipelineLayout;
 	computePipelineInfo.stage = basicShader->computeShaderStageInfo;
+	computePipelineInfo.stage.pSpecializationInfo = &specInfo;
 
-	VkResult computeCreate = vkCreateComputePipelines(logicalDevice, VK_NULL_HANDLE, 1, &computePipelineInfo, nullptr, &computePipeline);
+	for (uint32_t pass = 0; pass < SOLVE_PASS_COUNT; pass++) {
+		specData[7] = pass;
 
-	if (computeCreate != VK_SUCCESS) {
-		std::cout << "Failed to Create Compute Pipeline | ERROR - " << computeCreate << "\n";
-		throw std::runtime_error("Failed to Create Compute Pipeline\n");
+		VkResult computeCreate = vkCreateComputePipelines(logicalDevice, VK_NULL_HANDLE, 1, &computePipelineInfo, nullptr, &computePipelines[pass]);
+
+		if (computeCreate != VK_SUCCESS) {
+			std::cout << "Failed to Create Compute Pipeline | ERROR - " << computeCreate << "\n";
+			throw std::runtime_error("Failed to Create Compute Pipeline\n");
+		}
 	}
 
-	std::cout << "compute pipeline created\n";
+	std::cout << "compute pipeline created - LOCAL SIZE " << computeLocalSize.x << " X " << computeLocalSize.y << " X " << computeLocalSize.z << "\n";
 
 }
 
@@ -997,10 +1463,33 @@ void VulkanClass::createGraphicsPipeline() {
 
 	//CREATING GRAPHICS PIPELINE
 
+	// shader.frag reads the volume with the same layout and format constants as shader.comp, and samples the 3D image instead when 4 is set.
+	VkSpecializationMapEntry fragmentEntries[4] = {
+		{ 3, 0, sizeof(uint32_t) },
+		{ 4, sizeof(uint32_t), sizeof(uint32_t) },
+		{ 5, 2 * sizeof(uint32_t), sizeof(uint32_t) },
+		{ 6, 3 * sizeof(uint32_t), sizeof(uint32_t) }
+	};
+
+	uint32_t fragmentData[4] = { static_cast<uint32_t>(ampLayout), static_cast<uint32_t>(useAmpImage), static_cast<uint32_t>(ampFormat), static_cast<uint32_t>(sparseVolume) };
+
+	VkSpecializationInfo fragmentSpecInfo{};
+	fragmentSpecInfo.mapEntryCount = 4;
+	fragmentSpecInfo.pMapEntries = fragmentEntries;
+	fragmentSpecInfo.dataSize = sizeof(fragmentData);
+	fragmentSpecInfo.pData = fragmentData;
+
+	std::vector<VkPipelineShaderStageCreateInfo> stages = basicShader->graphicsShaderStageInfos;
+	for (auto& stage : stages) {
+		if (stage.stage == VK_SHADER_STAGE_FRAGMENT_BIT) {
+			stage.pSpecializationInfo = &fragmentSpecInfo;
+		}
+	}
+
 	VkGraphicsPipelineCreateInfo graphicsPipelineInfo{};
 	graphicsPipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-	graphicsPipelineInfo.stageCount = basicShader->graphicsShaderStageInfos.size();
-	graphicsPipelineInfo.pStages = basicShader->graphicsShaderStageInfos.data();
+	graphicsPipelineInfo.stageCount = static_cast<uint32_t>(stages.size());
+	graphicsPipelineInfo.pStages = stages.data();
 	//graphicsPipelineInfo.pTessellationState = VK_NULL_HANDLE; &tessellationInfo;
 	graphicsPipelineInfo.pDynamicState = &dynamicState;
 	graphicsPipelineInfo.pColorBlendState = &colorBlendGlobal;
@@ -1095,7 +1584,7 @@ void VulkanClass::createCommandPool() {
 
 }
 
-void VulkanClass::recordComputeCommandBuffer(VkCommandBuffer commandBuffer) {
+void VulkanClass::recordComputeCommandBuffer(VkCommandBuffer commandBuffer, uint32_t zLayers) {
 
 	VkCommandBufferBeginInfo beginInfo{};
 	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
@@ -1104,12 +1593,120 @@ void VulkanClass::recordComputeCommandBuffer(VkCommandBuffer commandBuffer) {
 		throw std::runtime_error("Failed to Begin Recording Compute Command Buffer\n");
 	}
 
-	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipeline);
-
-	std::vector<VkDescriptorSet> descriptorSets = { ampDescriptorSet, posDescriptorSet, midpointsDescriptorSet, sizesDescriptorSet, transformDescriptorSet[0] };
+	std::vector<VkDescriptorSet> descriptorSets = { ampDescriptorSet, posDescriptorSet, midpointsDescriptorSet, sizesDescriptorSet, transformDescriptorSet[0], bvhDescriptorSet };
 	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipelineLayout, 0, descriptorSets.size(), descriptorSets.data(), 0, 0);
 
-	vkCmdDispatch(commandBuffer, 523, 105, 522);// 372, 155, 228);
+	// Tuning slabs aren't solves, so only full dispatches are timed.
+	bool timed = zLayers >= ampGridSize.z;
+	if (timed) {
+		gpuProfiler.begin(commandBuffer, GpuProfiler::PHASE_SOLVE, 0);
+	}
+
+	if (sparseVolume) {
+		// One invocation per work item, laid out over x and y so large pools stay inside the workgroup count limits.
+		// shader.comp discards the invocations past the work list; zLayers takes the same share of it.
+		uint64_t items = uint64_t(occupancy.getWorkItems()) * std::min(zLayers, ampGridSize.z) / ampGridSize.z;
+		uint32_t groupSize = computeLocalSize.x * computeLocalSize.y * computeLocalSize.z;
+		uint32_t groups = static_cast<uint32_t>(std::max<uint64_t>(1, (items + groupSize - 1) / groupSize));
+
+		VkDispatchIndirectCommand args{};
+		args.x = std::min(groups, 65535u);
+		args.y = (groups + args.x - 1) / args.x;
+		args.z = 1;
+		memcpy(dispatchArgsMap, &args, sizeof(args));
+	}
+
+	// Every pass covers the same cells. Each one's writes (visibility bits, hit distances, then amplitudes,
+	// bands and the image) are made visible to the next before it starts, so nothing reads a cell mid solve.
+	VkMemoryBarrier passBarrier{};
+	passBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	passBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	passBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+	// The direct and diffraction passes only ever raise a LOG8 scale, so every solve starts them from silence.
+	if (ampFormat == AMP_FORMAT_LOG8) {
+		vkCmdFillBuffer(commandBuffer, ampScaleBuffer, 0, VK_WHOLE_SIZE, 0);
+
+		VkMemoryBarrier fillBarrier = passBarrier;
+		fillBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &fillBarrier, 0, nullptr, 0, nullptr);
+	}
+
+	for (uint32_t pass = 0; pass < SOLVE_PASS_COUNT; pass++) {
+		GpuProfiler::Phase phase = GpuProfiler::Phase(GpuProfiler::PHASE_VISIBILITY + pass);
+
+		if (pass == SOLVE_PASS_PACK && ampFormat != AMP_FORMAT_LOG8) {
+			continue;
+		}
+
+		if (pass > 0) {
+			vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &passBarrier, 0, nullptr, 0, nullptr);
+		}
+
+		if (timed) {
+			gpuProfiler.begin(commandBuffer, phase, 0);
+		}
+
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipelines[pass]);
+
+		if (sparseVolume) {
+			vkCmdDispatchIndirect(commandBuffer, dispatchArgsBuffer, 0);
+		}
+		else {
+			// Round up to whole workgroups; shader.comp discards the invocations past the grid edge.
+			glm::uvec3 groupCount = (glm::uvec3(ampGridSize.x, ampGridSize.y, std::min(zLayers, ampGridSize.z)) + computeLocalSize - 1u) / computeLocalSize;
+
+			vkCmdDispatch(commandBuffer, groupCount.x, groupCount.y, groupCount.z);
+		}
+
+		if (timed) {
+			gpuProfiler.end(commandBuffer, phase, 0);
+		}
+	}
+
+	if (timed) {
+		gpuProfiler.end(commandBuffer, GpuProfiler::PHASE_SOLVE, 0);
+	}
+
+	// Copy the solve into the mapped readbacks so host queries never need a staging round trip.
+	auto readBack = [&](VkBuffer buffer, VkBuffer readback, VkDeviceSize size) {
+		VkBufferMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.buffer = buffer;
+		barrier.size = size;
+
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+
+		VkBufferCopy copyRegion{};
+		copyRegion.size = size;
+		vkCmdCopyBuffer(commandBuffer, buffer, readback, 1, &copyRegion);
+
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+		barrier.buffer = readback;
+
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+	};
+
+	readBack(ampBuffer, ampReadbackBuffer, ampBufferBytes);
+
+	if (ampFormat == AMP_FORMAT_LOG8) {
+		readBack(ampScaleBuffer, ampScaleReadbackBuffer, ampScaleBytes);
+	}
+
+	// Tuning slabs leave the bands half written, so only a full dispatch replaces the host copy.
+	if (timed) {
+		readBack(bandBuffer, bandReadbackBuffer, sizeof(BandAmplitude) * ampGpuCells);
+	}
+
+	// Channels are only written with sources listed, by full solves or for the cells of changed bricks, the same test solveVisibility makes.
+	if (timed && scene.gridExtent.w > 0 && (scene.previousSourcePos.w == 0.0f || freshBricks)) {
+		readBack(channelBuffer, channelReadbackBuffer, sizeof(SourceChannels) * channelCells);
+	}
 
 	if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
 		throw std::runtime_error("Failed to Record Compute Command Buffer\n");
@@ -1142,10 +1739,27 @@ void VulkanClass::recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t in
 	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
 	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
 	barrier.buffer = ampBuffer;
-	barrier.size = sizeof(AmpVolume) * ampVolumeSize;
+	barrier.size = ampBufferBytes;
 
 	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
 
+	if (useAmpImage) {
+		VkImageMemoryBarrier imageBarrier{};
+		imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		imageBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		imageBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		imageBarrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+		imageBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+		imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		imageBarrier.image = ampImage;
+		imageBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageBarrier);
+	}
+
+	gpuProfiler.begin(commandBuffer, GpuProfiler::PHASE_DRAW, currentFrame);
+
 	vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
 
 	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
@@ -1164,8 +1778,6 @@ void VulkanClass::recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t in
 	scissorRect.offset = { 0,0 };
 	vkCmdSetScissor(commandBuffer, 0, 1, &scissorRect);
 
-	//ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), commandBuffer);
-
 	VkBuffer vertexBuffers[] = { vertexBuffer };
 	VkDeviceSize offsets[] = { 0 };
 
@@ -1175,10 +1787,16 @@ void VulkanClass::recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t in
 	std::vector<VkDescriptorSet> descriptorSets = { transformDescriptorSet[currentFrame] , ampDescriptorSet };
 	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, static_cast<uint32_t>(descriptorSets.size()), descriptorSets.data(), 0, 0);
 
-	vkCmdDraw(commandBuffer, vertices.size(), 1, 0, 0);
+	vkCmdDraw(commandBuffer, posBufferSize, 1, 0, 0);
+
+	if (guiEnabled) {
+		ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), commandBuffer);
+	}
 
 	vkCmdEndRenderPass(commandBuffer);
 
+	gpuProfiler.end(commandBuffer, GpuProfiler::PHASE_DRAW, currentFrame);
+
 	if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
 		throw std::runtime_error("Failed To Record Command Buffer\n");
 	}
@@ -1242,10 +1860,20 @@ void VulkanClass::createSyncObjects() {
 
 void VulkanClass::dispatch() {
 
+	refineForSource();
+
 	vkResetFences(logicalDevice, 1, &computeInFlightFence);
 
+	// Once the volume holds a finished solve, only cells whose view of the source may have changed are traced again.
+	scene.sourcePos = glm::vec4(sourcePos, 1.0f);
+	scene.previousSourcePos = glm::vec4(solvedSourcePos, ampSolved ? 1.0f : 0.0f);
+	memcpy(sceneBufferMap, &scene, sizeof(SceneUniform));
+
+	*static_cast<uint32_t*>(visibilityBufferMap) = 0;
+
 	vkResetCommandBuffer(computeCommandBuffer, 0);
-	recordComputeCommandBuffer(computeCommandBuffer);
+	recordComputeCommandBuffer(computeCommandBuffer, ampGridSize.z);
+	freshBricks = false;
 
 	VkSubmitInfo submitInfo{};
 	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
@@ -1263,51 +1891,150 @@ void VulkanClass::dispatch() {
 		throw std::runtime_error("Failed to Submit Compute Command\n");
 	}
 
-}
+	solvedSourcePos = sourcePos;
+	ampSolved = true;
+	ampDecodedStale = true;
 
-void VulkanClass::draw(uint32_t& imageIndex) {
+}
 
-	uint32_t index;
+uint32_t VulkanClass::getTracedCellCount() {
 
-	VkResult result = vkAcquireNextImageKHR(logicalDevice, swapChain.__swapChain, UINT32_MAX, imageAvailableSemaphore[imageIndex], VK_NULL_HANDLE, &index);
-	if (result == VK_ERROR_OUT_OF_DATE_KHR) {
-		recreateSwapChain();
-		std::cout << "NO WORK SUBMITTED\n";
-		return;
-	}
+	return *static_cast<uint32_t*>(visibilityBufferMap);
 
-	vkResetFences(logicalDevice, 1, &inFlightFence[imageIndex]);
+}
 
-	vkResetCommandBuffer(commandBuffer[imageIndex], 0);
+void VulkanClass::tuneComputeWorkgroupSize() {
 
-	recordCommandBuffer(commandBuffer[imageIndex], index, imageIndex);
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
 
-	VkSubmitInfo submitInfo{};
-	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	// The specialization constants change the shader being timed, so each combination is tuned apart.
+	std::string deviceKey = std::to_string(properties.vendorID) + ":" + std::to_string(properties.deviceID) + ":" + std::to_string(properties.driverVersion)
+		+ ":" + AMP_LAYOUT_NAMES[ampLayout] + ":" + AMP_FORMAT_NAMES[ampFormat] + (sparseVolume ? ":SPARSE" : ":DENSE") + (useAmpImage ? ":IMAGE" : ":BUFFER")
+		+ ":" + TRAVERSAL_NAMES[traversal];
 
-	VkSemaphore waitSemaphores[] = { imageAvailableSemaphore[imageIndex] };
-	VkSemaphore signalSemaphores[] = { renderFinishedSempahore[imageIndex] };
-	VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
-	submitInfo.waitSemaphoreCount = 1;
-	submitInfo.pWaitSemaphores = waitSemaphores;
-	submitInfo.pWaitDstStageMask = waitStages;
-	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = &commandBuffer[imageIndex];
-	submitInfo.signalSemaphoreCount = 1;
-	submitInfo.pSignalSemaphores = signalSemaphores;
+	std::ifstream cacheIn(WORKGROUP_CACHE_PATH);
+	std::string cachedKey;
+	glm::uvec3 cachedSize;
 
-	if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFence[imageIndex]) != VK_SUCCESS) {
-		VkResult error = vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFence[imageIndex]);
-		throw std::runtime_error("Failed To Submit Draw Command\n");
+	while (cacheIn >> cachedKey >> cachedSize.x >> cachedSize.y >> cachedSize.z) {
+		if (cachedKey == deviceKey) {
+			computeLocalSize = cachedSize;
+			createComputePipeline();
+			std::cout << "WORKGROUP SIZE LOADED FROM CACHE FOR " << properties.deviceName << "\n";
+			return;
+		}
 	}
 
-	VkPresentInfoKHR presentInfo{};
-	presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
-	presentInfo.waitSemaphoreCount = 1;
-	presentInfo.pWaitSemaphores = signalSemaphores;
+	cacheIn.close();
 
-	VkSwapchainKHR swapChains[] = { swapChain.__swapChain };
-	presentInfo.swapchainCount = 1;
+	std::vector<glm::uvec3> candidates = {
+		{ 4, 4, 4 }, { 8, 4, 4 }, { 8, 8, 1 }, { 8, 4, 8 }, { 8, 8, 4 },
+		{ 16, 4, 4 }, { 8, 8, 8 }, { 16, 8, 4 }, { 32, 1, 4 }, { 64, 1, 1 }
+	};
+
+	const VkPhysicalDeviceLimits& limits = properties.limits;
+
+	// Only a slab of z layers is traced per candidate, enough to fill the device without paying for a full solve.
+	const uint32_t slabLayers = 16;
+
+	glm::uvec3 bestSize = computeLocalSize;
+	double bestTime = DBL_MAX;
+
+	for (const auto& candidate : candidates) {
+		if (candidate.x > limits.maxComputeWorkGroupSize[0] || candidate.y > limits.maxComputeWorkGroupSize[1] ||
+			candidate.z > limits.maxComputeWorkGroupSize[2] || candidate.x * candidate.y * candidate.z > limits.maxComputeWorkGroupInvocations) {
+			continue;
+		}
+
+		computeLocalSize = candidate;
+		createComputePipeline();
+
+		double candidateTime = DBL_MAX;
+
+		// The first run warms up the pipeline, the faster of the two is kept.
+		for (int run = 0; run < 2; run++) {
+			vkResetFences(logicalDevice, 1, &computeInFlightFence);
+			vkResetCommandBuffer(computeCommandBuffer, 0);
+			recordComputeCommandBuffer(computeCommandBuffer, slabLayers);
+
+			VkSubmitInfo submitInfo{};
+			submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+			submitInfo.commandBufferCount = 1;
+			submitInfo.pCommandBuffers = &computeCommandBuffer;
+
+			auto start = std::chrono::high_resolution_clock::now();
+
+			if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, computeInFlightFence) != VK_SUCCESS) {
+				throw std::runtime_error("Failed to Submit Workgroup Tuning Dispatch\n");
+			}
+
+			vkWaitForFences(logicalDevice, 1, &computeInFlightFence, VK_TRUE, UINT64_MAX);
+
+			candidateTime = std::min(candidateTime, std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count());
+		}
+
+		std::cout << "WORKGROUP " << candidate.x << " X " << candidate.y << " X " << candidate.z << " - " << candidateTime << " ms\n";
+
+		if (candidateTime < bestTime) {
+			bestTime = candidateTime;
+			bestSize = candidate;
+		}
+	}
+
+	computeLocalSize = bestSize;
+	createComputePipeline();
+
+	std::ofstream cacheOut(WORKGROUP_CACHE_PATH, std::ios::app);
+	cacheOut << deviceKey << " " << bestSize.x << " " << bestSize.y << " " << bestSize.z << "\n";
+
+	std::cout << "WORKGROUP SIZE TUNED FOR " << properties.deviceName << " - " << bestSize.x << " X " << bestSize.y << " X " << bestSize.z << "\n";
+
+}
+
+void VulkanClass::draw(uint32_t& imageIndex) {
+
+	uint32_t index;
+
+	VkResult result = vkAcquireNextImageKHR(logicalDevice, swapChain.__swapChain, UINT32_MAX, imageAvailableSemaphore[imageIndex], VK_NULL_HANDLE, &index);
+	if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+		recreateSwapChain();
+		std::cout << "NO WORK SUBMITTED\n";
+		return;
+	}
+
+	vkResetFences(logicalDevice, 1, &inFlightFence[imageIndex]);
+
+	vkResetCommandBuffer(commandBuffer[imageIndex], 0);
+
+	recordCommandBuffer(commandBuffer[imageIndex], index, imageIndex);
+
+	VkSubmitInfo submitInfo{};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+
+	VkSemaphore waitSemaphores[] = { imageAvailableSemaphore[imageIndex] };
+	VkSemaphore signalSemaphores[] = { renderFinishedSempahore[imageIndex] };
+	VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
+	submitInfo.waitSemaphoreCount = 1;
+	submitInfo.pWaitSemaphores = waitSemaphores;
+	submitInfo.pWaitDstStageMask = waitStages;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &commandBuffer[imageIndex];
+	submitInfo.signalSemaphoreCount = 1;
+	submitInfo.pSignalSemaphores = signalSemaphores;
+
+	if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFence[imageIndex]) != VK_SUCCESS) {
+		VkResult error = vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFence[imageIndex]);
+		throw std::runtime_error("Failed To Submit Draw Command\n");
+	}
+
+	VkPresentInfoKHR presentInfo{};
+	presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+	presentInfo.waitSemaphoreCount = 1;
+	presentInfo.pWaitSemaphores = signalSemaphores;
+
+	VkSwapchainKHR swapChains[] = { swapChain.__swapChain };
+	presentInfo.swapchainCount = 1;
 	presentInfo.pSwapchains = swapChains;
 	presentInfo.pImageIndices = &index;
 
@@ -1397,6 +2124,8 @@ void VulkanClass::initImGui() {
 	// clear font textures from cpu data
 	ImGui_ImplVulkan_DestroyFontUploadObjects();
 
+	guiEnabled = true;
+
 }
 
 void VulkanClass::drawGui() {
@@ -1406,13 +2135,31 @@ void VulkanClass::drawGui() {
 
 	ImGui::NewFrame();
 
-	ImGui::ShowDemoWindow();
+	gpuProfiler.collect();
+
+	ImGui::Begin("GPU Timings");
+
+	if (!gpuProfiler.isSupported()) {
+		ImGui::Text("Timestamps not supported on this queue");
+	}
+
+	for (int phase = 0; phase < GpuProfiler::PHASE_COUNT; phase++) {
+		GpuProfiler::Stats stats = gpuProfiler.getStats(GpuProfiler::Phase(phase));
+		std::vector<double> samples = gpuProfiler.getSamples(GpuProfiler::Phase(phase));
+		std::vector<float> plot(samples.begin(), samples.end());
+
+		ImGui::Text("%s - LAST %.3f ms | MIN %.3f | MEDIAN %.3f | P99 %.3f (%zu)", GpuProfiler::getPhaseName(GpuProfiler::Phase(phase)),
+			stats.lastMs, stats.minMs, stats.medianMs, stats.p99Ms, stats.count);
+		ImGui::PlotLines(GpuProfiler::getPhaseName(GpuProfiler::Phase(phase)), plot.data(), static_cast<int>(plot.size()), 0, nullptr, 0.0f, FLT_MAX, ImVec2(0.0f, 60.0f));
+	}
+
+	ImGui::End();
 
 	ImGui::Render();
 
 }
 
-void VulkanClass::loadModel() {
+void VulkanClass::parseModel() {
 
 	tinyobj::attrib_t attrib;
 	std::vector<tinyobj::shape_t> shapes;
@@ -1488,19 +2235,48 @@ void VulkanClass::loadModel() {
 	extents.zMax = maxZ;
 	extents.zMin = minZ;
 
-	int x = (maxX - minX) / 10.0;
-	int y = (maxY - minY) / 10.0;
-	int z = (maxZ - minZ) / 10.0;
+}
+
+void VulkanClass::loadModel() {
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	// A cache written from this exact file by these builders replaces the parse; only the grid is sized here then.
+	if (useSceneCache) {
+		sceneCacheKey = SceneCache::key(MODEL_PATH, bvh);
+		sceneCached = sceneCache.open(MODEL_PATH + ".scene", sceneCacheKey);
+	}
+
+	if (sceneCached) {
+		extents = sceneCache.getHeader().extents;
+		posBufferSize = static_cast<unsigned int>(sceneCache.count<Vertex>(SCENE_VERTICES));
+
+		double time = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+		std::cout << "SCENE CACHE - HIT " << MODEL_PATH << ".scene | " << (sceneCache.getBytes() >> 20) << " MB | " << time * 1000.0 << " ms\n";
+	}
+	else {
+		parseModel();
+	}
+
+	int x = (extents.xMax - extents.xMin) / AMP_CELL_SIZE;
+	int y = (extents.yMax - extents.yMin) / AMP_CELL_SIZE;
+	int z = (extents.zMax - extents.zMin) / AMP_CELL_SIZE;
 
-	ampVolumeSize = (x * y * z);
+	ampCellCount = (x * y * z);
+	ampVolumeSize = ampStorageSize(glm::ivec3(x, y, z), ampLayout);
+	ampGridSize = glm::uvec3(x, y, z);
+	ampBufferBytes = sizeof(uint32_t) * ampWordCount(static_cast<int>(ampVolumeSize), ampFormat);
+	ampScaleBytes = sizeof(float) * ampScaleCount(static_cast<int>(ampVolumeSize));
 
-	ampVolume = (AmpVolume*)malloc(ampVolumeSize * sizeof(AmpVolume));
+	// Bricked storage pads the grid out to whole bricks; the padding is never sampled but starts zeroed.
+	ampVolume = (AmpVolume*)calloc(ampVolumeSize, sizeof(AmpVolume));
 
 	std::cout << "MINIMUMS - " << extents.xMin << " | " << extents.yMin << " | " << extents.zMin << "\n";
 
-	std::cout << "AMPLITUDE VOLUME SIZE - " << (maxX - minX) / 10.0 << " X " << (maxY - minY) / 10.0 << " X " << (maxZ - minZ) / 10.0 << " = " << ampVolumeSize << "\n";
+	std::cout << "AMPLITUDE VOLUME SIZE - " << (extents.xMax - extents.xMin) / 10.0 << " X " << (extents.yMax - extents.yMin) / 10.0 << " X " << (extents.zMax - extents.zMin) / 10.0 << " = " << ampCellCount << " | " << AMP_LAYOUT_NAMES[ampLayout] << " LAYOUT, " << ampVolumeSize << " STORED | " << AMP_FORMAT_NAMES[ampFormat] << " " << (ampBufferBytes >> 20) << " MB, BANDS FLOAT "
+		<< ((sizeof(BandAmplitude) * ampVolumeSize) >> 20) << " MB, CHANNELS " << ((sizeof(SourceChannels) * ampVolumeSize) >> 20) << " MB WITH SOURCES\n";
 
-	srand(glfwGetTime());
+	srand(static_cast<unsigned int>(time(nullptr)));
 
 	float densities[101];
 
@@ -1517,9 +2293,7 @@ void VulkanClass::loadModel() {
 	for (unsigned int i = 0; i < x; i++) {
 		for (unsigned int j = 0; j < y; j++) {
 			for (unsigned int k = 0; k < z; k++) {
-				int yStride = int(maxX - minX) / 10;
-				int zStride = (int(maxY - minY) / 10) * (int(maxX - minX) / 10);
-				index = i + j * yStride + k * zStride;
+				index = ampCellIndex(glm::ivec3(i, j, k), glm::ivec3(x, y, z), ampLayout);
 				int factor = ampVolumeSize / 100;
 				if (index >= 0 && index < ampVolumeSize) {
 					ampVolume[index].amp = densities[(int)(index / factor)];
@@ -1572,7 +2346,7 @@ void VulkanClass::createVertexBuffer() {
 	VkBufferCreateInfo bufferInfo{};
 	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
 	bufferInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
-	bufferInfo.size = sizeof(Vertex) * vertices.size();
+	bufferInfo.size = sizeof(Vertex) * posBufferSize;
 	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
 	if (vkCreateBuffer(logicalDevice, &bufferInfo, nullptr, &vertexBuffer) != VK_SUCCESS) {
@@ -1594,19 +2368,386 @@ void VulkanClass::createVertexBuffer() {
 
 	vkBindBufferMemory(logicalDevice, vertexBuffer, vertexBufferMemory, 0);
 
+	// Copied out of the mapped scene cache when there is one; the parsed vertices are never built then.
 	vkMapMemory(logicalDevice, vertexBufferMemory, 0, bufferInfo.size, 0, &vertexBufferMap);
-	memcpy(vertexBufferMap, vertices.data(), (size_t)bufferInfo.size);
+	memcpy(vertexBufferMap, sceneCached ? sceneCache.data(SCENE_VERTICES) : vertices.data(), (size_t)bufferInfo.size);
 	vkUnmapMemory(logicalDevice, vertexBufferMemory);
 
 }
 
-void VulkanClass::createOctree() {
+void VulkanClass::createSceneBuffer() {
+
+	setupScene();
+
+	createHostBuffer(&scene, sizeof(SceneUniform), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, sceneBuffer, sceneBufferMemory);
+	vkMapMemory(logicalDevice, sceneBufferMemory, 0, sizeof(SceneUniform), 0, &sceneBufferMap);
+
+}
+
+void VulkanClass::createVisibilityBuffer() {
+
+	// tracedCells, one visibility bit per amplitude cell, then as many fresh bits for writeChangedBricks. The
+	// visibility bits are left uninitialised, as the first dispatch is always a full solve; the fresh ones start clear.
+	size_t maskWords = (ampGpuCells + 31) / 32;
+	VkDeviceSize bufferSize = sizeof(uint32_t) * (1 + 2 * maskWords);
+
+	createHostBuffer(nullptr, bufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, visibilityBuffer, visibilityBufferMemory);
+	vkMapMemory(logicalDevice, visibilityBufferMemory, 0, bufferSize, 0, &visibilityBufferMap);
+	memset(static_cast<uint32_t*>(visibilityBufferMap) + 1 + maskWords, 0, sizeof(uint32_t) * maskWords);
+
+	// Hit distances never leave the GPU, so they stay in device local memory.
+	VkBufferCreateInfo hitInfo{};
+	hitInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	hitInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+	hitInfo.size = sizeof(float) * ampGpuCells;
+	hitInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	if (vkCreateBuffer(logicalDevice, &hitInfo, nullptr, &hitBuffer) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to Create Hit Distance Buffer\n");
+	}
+
+	VkMemoryRequirements memRequirements;
+	vkGetBufferMemoryRequirements(logicalDevice, hitBuffer, &memRequirements);
+
+	VkMemoryAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = memRequirements.size;
+	allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+	if (vkAllocateMemory(logicalDevice, &allocInfo, nullptr, &hitBufferMemory) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to Allocate Hit Distance Buffer Memory\n");
+	}
+
+	vkBindBufferMemory(logicalDevice, hitBuffer, hitBufferMemory, 0);
+
+}
+
+void VulkanClass::createSourceBuffers() {
+
+	createHostBuffer(nullptr, sizeof(glm::vec4) * MAX_SOURCES, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, sourceBuffer, sourceBufferMemory);
+	vkMapMemory(logicalDevice, sourceBufferMemory, 0, sizeof(glm::vec4) * MAX_SOURCES, 0, &sourceBufferMap);
+
+	// Only the listed sources write channels, so until loadSources finds some a single cell keeps the binding valid.
+	createChannelBuffers(1);
+
+	VkDeviceSize bandSize = sizeof(BandAmplitude) * ampGpuCells;
+
+	createDeviceBuffer(bandSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, bandBuffer, bandBufferMemory);
+	createReadbackBuffer(bandSize, bandReadbackBuffer, bandReadbackMemory, bandReadbackMap, bandReadbackCoherent);
+
+}
+
+void VulkanClass::createChannelBuffers(size_t cells) {
+
+	channelCells = cells;
+
+	VkDeviceSize bufferSize = sizeof(SourceChannels) * cells;
+
+	createDeviceBuffer(bufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, channelBuffer, channelBufferMemory);
+	createReadbackBuffer(bufferSize, channelReadbackBuffer, channelReadbackMemory, channelReadbackMap, channelReadbackCoherent);
+
+}
+
+void VulkanClass::destroyChannelBuffers() {
 
-	std::vector<std::vector<Triangle>> octree;
-	for (int i = 0; i < (8 * 8 * 8); i++) {
-		octree.push_back(std::vector<Triangle>(0));
+	vkDestroyBuffer(logicalDevice, channelBuffer, nullptr);
+	vkFreeMemory(logicalDevice, channelBufferMemory, nullptr);
+
+	vkDestroyBuffer(logicalDevice, channelReadbackBuffer, nullptr);
+	vkFreeMemory(logicalDevice, channelReadbackMemory, nullptr);
+
+}
+
+void VulkanClass::loadSources(const std::string& path) {
+
+	// One source per line: x y z in model units, then an optional gain and audio clip path.
+	std::ifstream file(path);
+
+	if (!file.is_open()) {
+		throw std::runtime_error("Failed to Open Source List\n");
+	}
+
+	sources.clear();
+	sourceClips.clear();
+
+	std::string line;
+	while (std::getline(file, line)) {
+		std::istringstream fields(line);
+		glm::vec4 source(0.0f, 0.0f, 0.0f, 1.0f);
+
+		if (!(fields >> source.x >> source.y >> source.z)) {
+			continue;
+		}
+		std::string clip;
+		fields >> source.w >> clip;
+
+		sources.push_back(source);
+		sourceClips.push_back(clip);
+	}
+
+	if (sources.size() > MAX_SOURCES) {
+		throw std::runtime_error("Source List Exceeds MAX_SOURCES\n");
+	}
+
+	scene.gridExtent.w = static_cast<int>(sources.size());
+
+	if (!cpuOnly) {
+		memcpy(sourceBufferMap, sources.data(), sizeof(glm::vec4) * sources.size());
+	}
+
+	// First sources: grow the placeholder channel volume to a cell each and point the descriptor at it.
+	if (!cpuOnly && !sources.empty() && channelCells < ampGpuCells) {
+		vkDeviceWaitIdle(logicalDevice);
+
+		destroyChannelBuffers();
+		createChannelBuffers(ampGpuCells);
+
+		if (ampDescriptorSet != VK_NULL_HANDLE) {
+			VkDescriptorBufferInfo channelInfo{};
+			channelInfo.buffer = channelBuffer;
+			channelInfo.offset = 0;
+			channelInfo.range = sizeof(SourceChannels) * channelCells;
+
+			VkWriteDescriptorSet channelWrite{};
+			channelWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			channelWrite.dstSet = ampDescriptorSet;
+			channelWrite.dstBinding = 2;
+			channelWrite.dstArrayElement = 0;
+			channelWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			channelWrite.descriptorCount = 1;
+			channelWrite.pBufferInfo = &channelInfo;
+
+			vkUpdateDescriptorSets(logicalDevice, 1, &channelWrite, 0, nullptr);
+		}
+
+		std::cout << "SOURCE CHANNELS - " << ((sizeof(SourceChannels) * channelCells) >> 20) << " MB\n";
+	}
+
+	// New sources invalidate every cell, so the next dispatch is a full solve.
+	ampSolved = false;
+
+	std::cout << "SOURCES LOADED - " << sources.size() << " FROM " << path << "\n";
+
+}
+
+void VulkanClass::setupScene() {
+
+	// The source sits where the compute shader used to hard-code it: 4000, 500, 4000 units into the grid, centred in its cell.
+	sourcePos = glm::vec3(extents.xMin, extents.yMin, extents.zMin) + glm::vec3(4000.0f, 500.0f, 4000.0f) + glm::vec3(AMP_CELL_SIZE / 2.0f);
+
+	scene.gridExtent = glm::ivec4(ampGridSize, 0);
+	scene.gridOffset = glm::vec4(-extents.xMin, -extents.yMin, -extents.zMin, AMP_CELL_SIZE);
+	scene.sourcePos = glm::vec4(sourcePos, 1.0f);
+	scene.previousSourcePos = glm::vec4(sourcePos, 0.0f);
+
+}
+
+void VulkanClass::createSceneGeometry() {
+
+	if (sceneCached) {
+		loadSceneCache();
+		return;
+	}
+
+	createIndexedGeometry();
+	createOctree();
+	createBVH();
+	createDiffractionEdges();
+	writeSceneCache();
+
+}
+
+void VulkanClass::loadSceneCache() {
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	sceneCache.read(SCENE_POSITIONS, positions);
+	sceneCache.read(SCENE_FACES, faces);
+	sceneCache.read(SCENE_OCTREE, Octree);
+	sceneCache.read(SCENE_MIDPOINTS, midpointsGPU);
+	sceneCache.read(SCENE_SIZES, Sizes);
+	sceneCache.read(SCENE_OFFSETS, Offsets);
+	sceneCache.read(SCENE_BVH_NODES, bvh.nodes);
+	sceneCache.read(SCENE_BVH_TRI_INDICES, bvh.triIndices);
+	sceneCache.read(SCENE_BVH_TRIANGLES, bvhTriangles);
+
+	// midpointsGPU is the x, y and z cell boundaries one after another.
+	size_t axisSize = midpointsGPU.size() / 3;
+	midpoints.clear();
+	for (size_t i = 0; i < 3; i++) {
+		midpoints.emplace_back(midpointsGPU.begin() + i * axisSize, midpointsGPU.begin() + (i + 1) * axisSize);
+	}
+
+	std::vector<DiffractionEdge> edges;
+	std::vector<uint32_t> bucketStarts;
+	std::vector<uint32_t> bucketEdges;
+	sceneCache.read(SCENE_EDGES, edges);
+	sceneCache.read(SCENE_EDGE_BUCKET_STARTS, bucketStarts);
+	sceneCache.read(SCENE_EDGE_BUCKET_EDGES, bucketEdges);
+	diffractionEdges = DiffractionEdges(std::move(edges), std::move(bucketStarts), std::move(bucketEdges), sceneCache.getHeader().openEdges);
+
+	double time = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+	std::cout << "SCENE CACHE - " << positions.size() << " POSITIONS | " << faces.size() << " FACES | " << bvh.nodes.size() << " BVH NODES | "
+		<< diffractionEdges.getEdges().size() << " DIFFRACTION EDGES | " << time * 1000.0 << " ms\n";
+
+}
+
+void VulkanClass::writeSceneCache() {
+
+	if (!useSceneCache) {
+		return;
+	}
+
+	const std::vector<DiffractionEdge>& edges = diffractionEdges.getEdges();
+	const std::vector<uint32_t>& bucketStarts = diffractionEdges.getBucketStarts();
+	const std::vector<uint32_t>& bucketEdges = diffractionEdges.getBucketEdges();
+
+	// In SceneCacheSection order.
+	const void* sections[SCENE_SECTION_COUNT] = {
+		vertices.data(), positions.data(), faces.data(), Octree.data(), midpointsGPU.data(), Sizes.data(), Offsets.data(),
+		bvh.nodes.data(), bvh.triIndices.data(), bvhTriangles.data(), edges.data(), bucketStarts.data(), bucketEdges.data()
+	};
+
+	uint64_t bytes[SCENE_SECTION_COUNT] = {
+		sizeof(Vertex) * vertices.size(), sizeof(glm::vec4) * positions.size(), sizeof(Face) * faces.size(), sizeof(uint32_t) * Octree.size(),
+		sizeof(float) * midpointsGPU.size(), sizeof(unsigned int) * Sizes.size(), sizeof(unsigned int) * Offsets.size(),
+		sizeof(BVHNode) * bvh.nodes.size(), sizeof(uint32_t) * bvh.triIndices.size(), sizeof(PrecomputedTriangle) * bvhTriangles.size(),
+		sizeof(DiffractionEdge) * edges.size(), sizeof(uint32_t) * bucketStarts.size(), sizeof(uint32_t) * bucketEdges.size()
+	};
+
+	// Without the cache only the next start is slower, so a failed write doesn't stop this one.
+	try {
+		SceneCache::write(MODEL_PATH + ".scene", sceneCacheKey, extents, diffractionEdges.getOpenEdges(), sections, bytes);
+		std::cout << "SCENE CACHE - WROTE " << MODEL_PATH << ".scene\n";
+	}
+	catch (const std::exception& e) {
+		std::cout << "WARNING - SCENE CACHE NOT WRITTEN - " << e.what();
+	}
+
+}
+
+void VulkanClass::loadCachedTriangles() {
+
+	// After a cache hit only the debug traversals want the per corner triangles, which are the cached vertices three at a time.
+	if (sceneCached && triangles.empty()) {
+		sceneCache.read(SCENE_VERTICES, triangles);
+	}
+
+}
+
+void VulkanClass::createIndexedGeometry() {
+
+	// Weld the per corner vertices from loadModel into one position array and give every triangle a 32 byte face.
+	// Only the averaged normal is ever used by the visibility pass, so it is folded into the face up front.
+	uint32_t numTriangles = static_cast<uint32_t>(triangles.size());
+	uint32_t numCorners = 3 * numTriangles;
+	auto cornerPos = [&](uint32_t corner) -> const glm::vec4& { return triangles[corner / 3].vertices[corner % 3].pos; };
+
+	// Sorting the corners by position, ties by corner, puts equal positions in runs led by their first corner.
+	std::vector<uint32_t> cornerOrder(numCorners);
+	std::iota(cornerOrder.begin(), cornerOrder.end(), 0);
+
+	std::sort(std::execution::par, cornerOrder.begin(), cornerOrder.end(), [&](uint32_t a, uint32_t b) {
+		const glm::vec4& p = cornerPos(a);
+		const glm::vec4& q = cornerPos(b);
+		for (int c = 0; c < 4; c++) {
+			if (p[c] != q[c]) {
+				return p[c] < q[c];
+			}
+		}
+		return a < b;
+	});
+
+	std::vector<uint32_t> leader(numCorners);
+	std::vector<uint32_t> leads(numCorners, 0);
+
+	for (uint32_t runStart = 0; runStart < numCorners;) {
+		uint32_t runEnd = runStart + 1;
+		while (runEnd < numCorners && cornerPos(cornerOrder[runEnd]) == cornerPos(cornerOrder[runStart])) {
+			runEnd++;
+		}
+
+		for (uint32_t i = runStart; i < runEnd; i++) {
+			leader[cornerOrder[i]] = cornerOrder[runStart];
+		}
+
+		leads[cornerOrder[runStart]] = 1;
+		runStart = runEnd;
+	}
+
+	// Numbering the leaders in corner order keeps the positions in the order they first appear.
+	std::vector<uint32_t> positionIDs(numCorners);
+	std::exclusive_scan(std::execution::par, leads.begin(), leads.end(), positionIDs.begin(), 0u);
+	uint32_t numPositions = numCorners > 0 ? positionIDs.back() + leads.back() : 0;
+
+	positions.resize(numPositions);
+	faces.resize(numTriangles);
+
+	std::vector<uint32_t> faceOrder(numTriangles);
+	std::iota(faceOrder.begin(), faceOrder.end(), 0);
+
+	std::for_each(std::execution::par, faceOrder.begin(), faceOrder.end(), [&](uint32_t i) {
+		glm::vec3 normal(0.0f);
+
+		for (uint32_t v = 0; v < 3; v++) {
+			uint32_t corner = 3 * i + v;
+			uint32_t id = positionIDs[leader[corner]];
+
+			if (leader[corner] == corner) {
+				positions[id] = cornerPos(corner);
+			}
+
+			faces[i].v[v] = id;
+			normal += glm::vec3(triangles[i].vertices[v].normal);
+		}
+
+		faces[i].pad = 0;
+		faces[i].normal = glm::vec4(glm::normalize(normal / 3.0f), 0.0f);
+	});
+
+	std::cout << "INDEXED GEOMETRY - " << positions.size() << " POSITIONS | " << faces.size() << " FACES\n";
+
+}
+
+static uint64_t hashTriangle(const Triangle& T) {
+
+	// FNV-1a over the vertex data; adding 0.0f folds -0.0 into +0.0 so equal triangles hash equally.
+	uint64_t hash = 14695981039346656037ull;
+
+	for (int v = 0; v < 3; v++) {
+		for (int c = 0; c < 4; c++) {
+			float values[2] = { T.vertices[v].pos[c] + 0.0f, T.vertices[v].normal[c] + 0.0f };
+			for (float value : values) {
+				uint32_t bits;
+				memcpy(&bits, &value, sizeof(bits));
+				hash = (hash ^ bits) * 1099511628211ull;
+			}
+		}
+	}
+
+	return hash;
+
+}
+
+static unsigned int octreeCellIndex(const glm::vec3& pos, const std::vector<std::vector<float>>& midpoints) {
+
+	unsigned int Index[3] = { 0, 0, 0 };
+
+	for (unsigned int j = 0; j < 3; j++) {
+		for (unsigned int k = 0; k < midpoints[j].size() - 1; k++) {
+			if (pos[j] > midpoints[j][k] && pos[j] < midpoints[j][k + 1]) {
+				Index[j] = k;
+			}
+		}
 	}
 
+	return Index[0] + 8 * Index[1] + 64 * Index[2];
+
+}
+
+void VulkanClass::createOctree() {
+
 	midpoints.push_back(std::vector<float>({ extents.xMin, extents.xMax }));
 	midpoints.push_back(std::vector<float>({ extents.yMin, extents.yMax }));
 	midpoints.push_back(std::vector<float>({ extents.zMin, extents.zMax }));
@@ -1626,32 +2767,77 @@ void VulkanClass::createOctree() {
 		}
 	}
 
-	for (unsigned int i = 0; i < triangles.size(); i++) {
+	uint32_t numTriangles = static_cast<uint32_t>(triangles.size());
 
-		for (unsigned int l = 0; l < 3; l++) {
-			unsigned int Index[3] = {0, 0, 0};
-			for (unsigned int j = 0; j < 3; j++) {
-				float coord = triangles[i].vertices[l].pos[j];
-				for (unsigned int k = 0; k < midpoints[j].size() - 1; k++) {
-					if (coord > midpoints[j][k] && coord < midpoints[j][k + 1]) {
-						Index[j] = k;
-					}
+	// Identical faces only need to be binned once; hash them, then keep the first of every run of equal triangles.
+	std::vector<uint64_t> triangleHashes(numTriangles);
+	std::vector<uint32_t> hashOrder(numTriangles);
+	std::iota(hashOrder.begin(), hashOrder.end(), 0);
+
+	std::for_each(std::execution::par, hashOrder.begin(), hashOrder.end(), [&](uint32_t i) {
+		triangleHashes[i] = hashTriangle(triangles[i]);
+	});
+
+	std::sort(std::execution::par, hashOrder.begin(), hashOrder.end(), [&](uint32_t a, uint32_t b) {
+		return triangleHashes[a] != triangleHashes[b] ? triangleHashes[a] < triangleHashes[b] : a < b;
+	});
+
+	std::vector<uint8_t> duplicate(numTriangles, 0);
+
+	for (uint32_t runStart = 0; runStart < numTriangles;) {
+		uint32_t runEnd = runStart + 1;
+		while (runEnd < numTriangles && triangleHashes[hashOrder[runEnd]] == triangleHashes[hashOrder[runStart]]) {
+			runEnd++;
+		}
+
+		for (uint32_t i = runStart + 1; i < runEnd; i++) {
+			for (uint32_t j = runStart; j < i; j++) {
+				if (!duplicate[hashOrder[j]] && triangles[hashOrder[j]] == triangles[hashOrder[i]]) {
+					duplicate[hashOrder[i]] = 1;
+					break;
 				}
 			}
+		}
+
+		runStart = runEnd;
+	}
+
+	// Every triangle lands in the cells of its three vertices; encode each as (cell << 32 | triangle)
+	// so a single sort groups the bins and orders each bin by triangle index.
+	const uint64_t INVALID_KEY = ~0ull;
+	std::vector<uint64_t> binKeys(3 * size_t(numTriangles));
 
-			unsigned int flattenedIndex = Index[0] + 8 * Index[1] + 64 * Index[2];
-			if (std::find(octree[flattenedIndex].begin(), octree[flattenedIndex].end(), triangles[i]) == octree[flattenedIndex].end())
-				octree[flattenedIndex].push_back(triangles[i]);
+	std::for_each(std::execution::par, hashOrder.begin(), hashOrder.end(), [&](uint32_t i) {
+		for (unsigned int l = 0; l < 3; l++) {
+			uint64_t key = INVALID_KEY;
+			if (!duplicate[i]) {
+				key = (uint64_t(octreeCellIndex(glm::vec3(triangles[i].vertices[l].pos), midpoints)) << 32) | i;
+			}
+			binKeys[3 * size_t(i) + l] = key;
 		}
+	});
 
+	std::sort(std::execution::par, binKeys.begin(), binKeys.end());
+	binKeys.erase(std::unique(binKeys.begin(), binKeys.end()), binKeys.end());
+	binKeys.erase(std::lower_bound(binKeys.begin(), binKeys.end(), INVALID_KEY), binKeys.end());
+
+	// The grid only stores face ids; the geometry itself lives once in faces/positions.
+	std::vector<uint32_t> cellTriangles(binKeys.size());
+	Sizes.assign(8 * 8 * 8, 0);
+
+	for (size_t i = 0; i < binKeys.size(); i++) {
+		cellTriangles[i] = static_cast<uint32_t>(binKeys[i] & 0xFFFFFFFFu);
+		Sizes[binKeys[i] >> 32]++;
 	}
 
-	Octree = octree[0];
-	Sizes.push_back(octree[0].size());
+	Octree = std::move(cellTriangles);
 
-	for (int i = 1; i < (8 * 8 * 8); i++) {
-		Octree.insert(Octree.end(), octree[i].begin(), octree[i].end());
-		Sizes.push_back(octree[i].size());
+	// Exclusive scan of Sizes, so the shaders can index a cell's first triangle directly.
+	Offsets.resize(Sizes.size());
+	unsigned int runningOffset = 0;
+	for (size_t i = 0; i < Sizes.size(); i++) {
+		Offsets[i] = runningOffset;
+		runningOffset += Sizes[i];
 	}
 
 	//std::cout << "OCTREE VIEW\n";
@@ -1720,14 +2906,410 @@ void VulkanClass::createAuxilaryOctreeBuffers() {
 	memcpy(sizesBufferMap, Sizes.data(), (size_t)bufferInfo.size);
 	vkUnmapMemory(logicalDevice, sizesBufferMemory);
 
+	createHostBuffer(Offsets.data(), sizeof(unsigned int) * Offsets.size(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, offsetsBuffer, offsetsBufferMemory);
+
 }
 
-void VulkanClass::createTriangleBuffer() {
+void VulkanClass::createBVH() {
+
+	bvh.build(triangles);
+
+	// Edges and normal are computed once here, in leaf order, for both the shader and the CPU packets.
+	bvhTriangles.resize(bvh.triIndices.size());
+	for (size_t i = 0; i < bvh.triIndices.size(); i++) {
+		const Face& F = faces[bvh.triIndices[i]];
+		bvhTriangles[i] = precomputeTriangle(glm::vec3(positions[F.v[0]]), glm::vec3(positions[F.v[1]]), glm::vec3(positions[F.v[2]]), glm::vec3(F.normal));
+	}
+
+	uint32_t leaves = 0;
+	for (const auto& node : bvh.nodes) {
+		if (node.count > 0) {
+			leaves++;
+		}
+	}
+
+	uint32_t depth = bvh.depth();
+
+	std::cout << "BVH COMPLETE - " << bvh.nodes.size() << " NODES | " << leaves << " LEAVES | DEPTH " << depth << "\n";
+
+	// subdivide caps the depth, so this only fires if that ever breaks; a deeper tree would overflow the traversal stacks.
+	if (depth > BVH_MAX_DEPTH) {
+		throw std::runtime_error("BVH Depth Exceeds the Traversal Stack\n");
+	}
+
+}
+
+void VulkanClass::createHostBuffer(const void* data, VkDeviceSize size, VkBufferUsageFlags usage, VkBuffer& buffer, VkDeviceMemory& memory) {
+
+	VkBufferCreateInfo bufferInfo{};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.usage = usage;
+	bufferInfo.size = size;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	if (vkCreateBuffer(logicalDevice, &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to Create Host Visible Buffer\n");
+	}
+
+	VkMemoryRequirements memRequirements;
+	vkGetBufferMemoryRequirements(logicalDevice, buffer, &memRequirements);
+
+	VkMemoryAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = memRequirements.size;
+	allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+	if (vkAllocateMemory(logicalDevice, &allocInfo, nullptr, &memory) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to Allocate Host Visible Buffer Memory\n");
+	}
+
+	vkBindBufferMemory(logicalDevice, buffer, memory, 0);
+
+	if (data != nullptr) {
+		void* map;
+		vkMapMemory(logicalDevice, memory, 0, size, 0, &map);
+		memcpy(map, data, (size_t)size);
+		vkUnmapMemory(logicalDevice, memory);
+	}
+
+}
+
+void VulkanClass::createDeviceBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkBuffer& buffer, VkDeviceMemory& memory) {
+
+	VkBufferCreateInfo bufferInfo{};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.usage = usage;
+	bufferInfo.size = size;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	if (vkCreateBuffer(logicalDevice, &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to Create Device Local Buffer\n");
+	}
+
+	VkMemoryRequirements memRequirements;
+	vkGetBufferMemoryRequirements(logicalDevice, buffer, &memRequirements);
+
+	VkMemoryAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = memRequirements.size;
+	allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+	if (vkAllocateMemory(logicalDevice, &allocInfo, nullptr, &memory) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to Allocate Device Local Buffer Memory\n");
+	}
+
+	vkBindBufferMemory(logicalDevice, buffer, memory, 0);
+
+}
+
+void VulkanClass::createBVHBuffers() {
+
+	createHostBuffer(bvh.nodes.data(), sizeof(BVHNode) * bvh.nodes.size(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, bvhNodeBuffer, bvhNodeBufferMemory);
+	createHostBuffer(bvhTriangles.data(), sizeof(PrecomputedTriangle) * bvhTriangles.size(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, bvhTriangleBuffer, bvhTriangleBufferMemory);
+	createHostBuffer(bvh.triIndices.data(), sizeof(uint32_t) * bvh.triIndices.size(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, bvhFaceIdBuffer, bvhFaceIdBufferMemory);
+
+	// A model without a single sharp edge still needs buffers to bind; its one empty bucket never reads them.
+	std::vector<DiffractionEdge> edges = diffractionEdges.getEdges();
+	std::vector<uint32_t> bucketEdges = diffractionEdges.getBucketEdges();
+
+	if (edges.empty()) {
+		edges.push_back({ glm::vec4(0.0f) });
+		bucketEdges.push_back(0);
+	}
+
+	const std::vector<uint32_t>& bucketStarts = diffractionEdges.getBucketStarts();
+
+	createHostBuffer(edges.data(), sizeof(DiffractionEdge) * edges.size(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, edgeBuffer, edgeBufferMemory);
+	createHostBuffer(bucketStarts.data(), sizeof(uint32_t) * bucketStarts.size(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, edgeBucketStartBuffer, edgeBucketStartBufferMemory);
+	createHostBuffer(bucketEdges.data(), sizeof(uint32_t) * bucketEdges.size(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, edgeBucketBuffer, edgeBucketBufferMemory);
+
+}
+
+void VulkanClass::createDiffractionEdges() {
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	diffractionEdges = DiffractionEdges(positions, faces);
+
+	double time = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+	size_t edgeCount = diffractionEdges.getEdges().size();
+
+	std::cout << "DIFFRACTION EDGES - " << edgeCount - diffractionEdges.getOpenEdges() << " WEDGE | " << diffractionEdges.getOpenEdges() << " OPEN | "
+		<< diffractionEdges.getBucketStarts().size() - 1 << " BUCKETS | " << time * 1000.0 << " ms\n";
+
+}
+
+void VulkanClass::createSparseVolume() {
+
+	ampGpuCells = ampVolumeSize;
+
+	if (!sparseVolume) {
+		return;
+	}
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	CPUSolver solver(positions, faces, bvh, bvhTriangles, diffractionEdges, extents, ampGridSize, ampLayout);
+	occupancy = SparseVolume(positions, faces, solver, extents, ampGridSize);
+
+	// The coarse level is traced for the starting source, so it has to be placed first.
+	uint32_t refinedBricks = 0;
+	if (refineThreshold > 0.0f) {
+		setupScene();
+		refinedBricks = occupancy.refine(occupancy.solveCoarse(solver, sourcePos, extents), sourcePos, extents, refineThreshold);
+		refinedSourcePos = sourcePos;
+		refineCapacity = std::min(std::max(2 * refinedBricks, REFINE_CAPACITY_MIN), occupancy.getFarBricks() + refinedBricks);
+		occupancy.reserveRefined(refineCapacity);
+	}
+
+	double time = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+	// Refined bricks take whole brick slots at the end of the pool, reserved up to the capacity.
+	ampGpuCells = occupancy.getPoolCells();
+	ampBufferBytes = sizeof(uint32_t) * ampWordCount(static_cast<int>(ampGpuCells), ampFormat);
+	ampScaleBytes = sizeof(float) * ampScaleCount(static_cast<int>(ampGpuCells));
+
+	std::cout << "SPARSE VOLUME - " << occupancy.getOpenBricks() << " OPEN | " << occupancy.getFarBricks() << " FAR FIELD | " << occupancy.getSolidBricks() << " SOLID BRICKS | "
+		<< ampGpuCells << " POOL CELLS (" << 100.0 * ampGpuCells / ampCellCount << "%) | " << (ampBufferBytes >> 20) << " MB + "
+		<< ((sizeof(BandAmplitude) * ampGpuCells) >> 20) << " MB BANDS + " << ((sizeof(SourceChannels) * ampGpuCells) >> 20) << " MB CHANNELS WITH SOURCES | " << time * 1000.0 << " ms\n";
+
+	if (refineThreshold > 0.0f) {
+		std::cout << "ADAPTIVE REFINEMENT - " << refinedBricks << " FAR FIELD BRICKS REFINED AT THRESHOLD " << refineThreshold << " | ROOM FOR " << refineCapacity << "\n";
+	}
+
+}
+
+void VulkanClass::refineForSource() {
+
+	if (refineThreshold <= 0.0f || sourcePos == refinedSourcePos) {
+		return;
+	}
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	CPUSolver solver(positions, faces, bvh, bvhTriangles, diffractionEdges, extents, ampGridSize, ampLayout);
+	uint32_t wanted = occupancy.refine(occupancy.solveCoarse(solver, sourcePos, extents), sourcePos, extents, refineThreshold, refineCapacity);
+	refinedSourcePos = sourcePos;
+
+	// Bricks that kept their class kept their pool cells, so the next solve stays incremental and only
+	// the changed bricks are traced from scratch.
+	const std::vector<uint32_t>& changed = occupancy.getChangedBricks();
+
+	if (!cpuOnly && !changed.empty()) {
+		writeChangedBricks(changed);
+	}
+
+	double time = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+	std::cout << "ADAPTIVE REFINEMENT - " << std::min(wanted, refineCapacity) << " FAR FIELD BRICKS REFINED FOR THE MOVED SOURCE, " << changed.size() << " CHANGED | " << time * 1000.0 << " ms\n";
+
+	if (wanted > refineCapacity) {
+		std::cout << "WARNING - " << wanted - refineCapacity << " BRICKS FARTHEST FROM THE SOURCE LEFT COARSE, THE POOL ONLY HAS ROOM FOR " << refineCapacity << "\n";
+	}
+
+}
+
+void VulkanClass::createBrickBuffers() {
+
+	// Refinement moves bricks between open and far field, so neither size changes after this.
+	size_t tableSize = 2 + (sparseVolume ? occupancy.getEntries().size() : 1);
+	size_t workSize = std::max<size_t>(1, occupancy.getWorkBricks().size());
+
+	createHostBuffer(nullptr, sizeof(uint32_t) * tableSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, brickTableBuffer, brickTableMemory);
+	createHostBuffer(nullptr, sizeof(uint32_t) * workSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, workBrickBuffer, workBrickMemory);
+	writeBrickBuffers();
+
+	// Written by recordComputeCommandBuffer, which knows the workgroup size.
+	createHostBuffer(nullptr, sizeof(VkDispatchIndirectCommand), VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, dispatchArgsBuffer, dispatchArgsMemory);
+	vkMapMemory(logicalDevice, dispatchArgsMemory, 0, sizeof(VkDispatchIndirectCommand), 0, &dispatchArgsMap);
+
+}
+
+void VulkanClass::writeBrickBuffers() {
+
+	// BrickTable in shader.comp and shader.frag: the open and far field brick counts, then one entry per brick.
+	// A dense solve never reads the entries, so it gets a single one.
+	std::vector<uint32_t> table = { occupancy.getOpenBricks(), occupancy.getFarBricks() };
+	std::vector<uint32_t> work = occupancy.getWorkBricks();
+
+	if (sparseVolume) {
+		table.insert(table.end(), occupancy.getEntries().begin(), occupancy.getEntries().end());
+	}
+	else {
+		table.push_back(AMP_BRICK_SOLID);
+	}
+
+	if (work.empty()) {
+		work.push_back(0);
+	}
+
+	void* map;
+	vkMapMemory(logicalDevice, brickTableMemory, 0, sizeof(uint32_t) * table.size(), 0, &map);
+	memcpy(map, table.data(), sizeof(uint32_t) * table.size());
+	vkUnmapMemory(logicalDevice, brickTableMemory);
+
+	vkMapMemory(logicalDevice, workBrickMemory, 0, sizeof(uint32_t) * work.size(), 0, &map);
+	memcpy(map, work.data(), sizeof(uint32_t) * work.size());
+	vkUnmapMemory(logicalDevice, workBrickMemory);
+
+}
+
+void VulkanClass::writeChangedBricks(const std::vector<uint32_t>& bricks) {
+
+	// Only the compute pass reads the work list. A frame in flight may read the table as it changes, but
+	// every entry it can see is a valid pool cell, so it only ever draws a stale value until the solve lands.
+	vkWaitForFences(logicalDevice, 1, &computeInFlightFence, VK_TRUE, UINT64_MAX);
+
+	const std::vector<uint32_t>& entries = occupancy.getEntries();
+	const std::vector<uint32_t>& work = occupancy.getWorkBricks();
+
+	void* map;
+	vkMapMemory(logicalDevice, brickTableMemory, 0, VK_WHOLE_SIZE, 0, &map);
+	uint32_t* table = static_cast<uint32_t*>(map);
+	table[0] = occupancy.getOpenBricks();
+	table[1] = occupancy.getFarBricks();
+	for (uint32_t brick : bricks) {
+		table[2 + brick] = entries[brick];
+	}
+	vkUnmapMemory(logicalDevice, brickTableMemory);
+
+	vkMapMemory(logicalDevice, workBrickMemory, 0, sizeof(uint32_t) * work.size(), 0, &map);
+	memcpy(map, work.data(), sizeof(uint32_t) * work.size());
+	vkUnmapMemory(logicalDevice, workBrickMemory);
+
+	// The pool cells these bricks now use weren't theirs in the last solve, so shader.comp traces them and
+	// their sources again whatever the source did. It clears each bit as it goes.
+	uint32_t* fresh = static_cast<uint32_t*>(visibilityBufferMap) + 1 + (ampGpuCells + 31) / 32;
+
+	for (uint32_t brick : bricks) {
+		uint32_t first = entries[brick] & ~AMP_BRICK_FAR;
+		uint32_t count = (entries[brick] & AMP_BRICK_FAR) != 0u ? 1 : AMP_BRICK_CELLS;
+
+		for (uint32_t cell = first; cell < first + count; cell++) {
+			fresh[cell >> 5] |= 1u << (cell & 31u);
+		}
+	}
+
+	freshBricks = true;
+
+}
+
+bool VulkanClass::gridIntersect(const glm::vec3& start, const glm::vec3& end, float& closestT, bool rescan) {
+
+	// CPU port of the 8x8x8 grid walk in traverseOctree/Collision, using the same segment test as the BVH.
+	// rescan finds each cell's first triangle by summing the sizes before it, as TRAVERSAL_GRID_RESCAN does.
+	glm::vec3 invDir = 1.0f / (end - start);
+	glm::ivec3 startCell = getAmpCellID(start, extents);
+
+	closestT = 1.0f;
+	bool hit = false;
+
+	for (int cell = 0; cell < (8 * 8 * 8); cell++) {
+		unsigned int size = Sizes[cell];
+		unsigned int first = Offsets[cell];
+
+		if (rescan) {
+			first = 0;
+			for (int i = 0; i < cell; i++) {
+				first += Sizes[i];
+			}
+		}
+
+		if (size == 0) {
+			continue;
+		}
+
+		glm::ivec3 id = glm::ivec3(cell % 8, (cell / 8) % 8, cell / 64);
+		glm::vec3 cellMin = glm::vec3(midpoints[0][id.x], midpoints[1][id.y], midpoints[2][id.z]);
+		glm::vec3 cellMax = glm::vec3(midpoints[0][id.x + 1], midpoints[1][id.y + 1], midpoints[2][id.z + 1]);
+
+		if (rayBoxIntersection(cellMin, cellMax, start, invDir) >= closestT) {
+			continue;
+		}
+
+		for (unsigned int i = first; i < first + size; i++) {
+			if (triangleTouchesCell(triangles[Octree[i]], startCell, extents)) {
+				continue;
+			}
+
+			float t = rayTriangleIntersection(start, end, triangles[Octree[i]]);
+			if (t > 0 && t < closestT) {
+				closestT = t;
+				hit = true;
+			}
+		}
+	}
+
+	return hit;
+
+}
+
+void VulkanClass::validateBVH(uint32_t samples) {
+
+	loadCachedTriangles();
+
+	// Cell to source segments through both structures, fixed seed so runs are comparable.
+	srand(2);
+
+	std::vector<glm::vec3> starts(samples);
+	for (auto& start : starts) {
+		glm::ivec3 cell = glm::ivec3(rand() % ampGridSize.x, rand() % ampGridSize.y, rand() % ampGridSize.z);
+		start = glm::vec3(cell) * AMP_CELL_SIZE + glm::vec3(AMP_CELL_SIZE / 2.0f) + glm::vec3(extents.xMin, extents.yMin, extents.zMin);
+	}
+
+	std::vector<float> bvhT(samples, 1.0f);
+	std::vector<float> gridT(samples, 1.0f);
+	std::vector<uint8_t> bvhHit(samples);
+	std::vector<uint8_t> gridHit(samples);
+
+	auto bvhStart = std::chrono::high_resolution_clock::now();
+	for (uint32_t i = 0; i < samples; i++) {
+		bvhHit[i] = bvh.intersect(triangles, starts[i], sourcePos, extents, bvhT[i]) ? 1 : 0;
+	}
+	double bvhTime = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - bvhStart).count();
+
+	auto gridStart = std::chrono::high_resolution_clock::now();
+	for (uint32_t i = 0; i < samples; i++) {
+		gridHit[i] = gridIntersect(starts[i], sourcePos, gridT[i]) ? 1 : 0;
+	}
+	double gridTime = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - gridStart).count();
+
+	// The same walk without the offsets scan; only the time differs.
+	float rescanT;
+	auto rescanStart = std::chrono::high_resolution_clock::now();
+	for (uint32_t i = 0; i < samples; i++) {
+		gridIntersect(starts[i], sourcePos, rescanT, true);
+	}
+	double rescanTime = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - rescanStart).count();
+
+	uint32_t mismatches = 0;
+	uint32_t occluded = 0;
+
+	for (uint32_t i = 0; i < samples; i++) {
+		occluded += bvhHit[i];
+
+		if (bvhHit[i] != gridHit[i] || (bvhHit[i] && std::abs(bvhT[i] - gridT[i]) > 0.0001f)) {
+			mismatches++;
+		}
+	}
+
+	std::cout << "BVH VALIDATION - " << samples << " SAMPLES | " << occluded << " OCCLUDED | " << mismatches << " MISMATCHES\n";
+	std::cout << "AVERAGE QUERY TIME - BVH " << (bvhTime / samples) * 1000000.0 << " us | GRID " << (gridTime / samples) * 1000000.0
+		<< " us | GRID-RESCAN " << (rescanTime / samples) * 1000000.0 << " us\n";
+
+	if (mismatches > 0) {
+		std::cout << "WARNING - BVH AND GRID DISAGREE ON " << mismatches << " SEGMENTS\n";
+	}
+
+}
+
+void VulkanClass::createTriangleBuffer() {
 
 	VkBufferCreateInfo bufferInfo{};
 	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
 	bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
-	bufferInfo.size = sizeof(Triangle) * triangles.size();
+	bufferInfo.size = sizeof(glm::vec4) * positions.size();
 	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
 	if (vkCreateBuffer(logicalDevice, &bufferInfo, nullptr, &posBuffer) != VK_SUCCESS) {
@@ -1750,9 +3332,15 @@ void VulkanClass::createTriangleBuffer() {
 	vkBindBufferMemory(logicalDevice, posBuffer, posBufferMemory, 0);
 
 	vkMapMemory(logicalDevice, posBufferMemory, 0, bufferInfo.size, 0, &posBufferMap);
-	memcpy(posBufferMap, Octree.data(), (size_t)bufferInfo.size);
+	memcpy(posBufferMap, positions.data(), (size_t)bufferInfo.size);
 	vkUnmapMemory(logicalDevice, posBufferMemory);
 
+	createHostBuffer(faces.data(), sizeof(Face) * faces.size(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, faceBuffer, faceBufferMemory);
+	createHostBuffer(Octree.data(), sizeof(uint32_t) * Octree.size(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, octreeBuffer, octreeBufferMemory);
+
+	size_t indexedSize = sizeof(glm::vec4) * positions.size() + sizeof(Face) * faces.size() + sizeof(uint32_t) * Octree.size();
+	std::cout << "TRIANGLE BUFFERS - " << indexedSize / 1024 << " KB (" << sizeof(Triangle) * Octree.size() / 1024 << " KB AS FULL TRIANGLE COPIES)\n";
+
 }
 
 void VulkanClass::createIndexBuffer() {
@@ -1814,7 +3402,9 @@ void VulkanClass::createIndexBuffer() {
 
 void VulkanClass::createAmpBuffer() {
 
-	VkDeviceSize bufferSize = sizeof(AmpVolume) * ampVolumeSize;
+	VkDeviceSize bufferSize = ampBufferBytes;
+	std::vector<float> scales;
+	std::vector<uint32_t> words = encodeAmpVolume(scales);
 
 	VkBuffer stagingBuffer;
 	VkDeviceMemory stagingBufferMemory;
@@ -1841,7 +3431,7 @@ void VulkanClass::createAmpBuffer() {
 
 	void* data;
 	vkMapMemory(logicalDevice, stagingBufferMemory, 0, bufferSize, 0, &data);
-	memcpy(data, ampVolume, bufferSize);
+	memcpy(data, words.data(), bufferSize);
 
 	//for (unsigned int i = 0; i < ampVolumeSize; i++) {
 	//	//std::cout << static_cast<float>(*((float*)data + sizeof(float)*i)) << "\n";
@@ -1871,78 +3461,766 @@ void VulkanClass::createAmpBuffer() {
 	vkDestroyBuffer(logicalDevice, stagingBuffer, nullptr);
 	vkFreeMemory(logicalDevice, stagingBufferMemory, nullptr);
 
-}
-
-void VulkanClass::validateAmpBuffer() {
+	createDeviceBuffer(ampScaleBytes, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, ampScaleBuffer, ampScaleMemory);
+	uploadAmpScales(scales);
 
-	VkDeviceSize bufferSize = sizeof(AmpVolume) * ampVolumeSize;
+}
 
-	VkBuffer stagingBuffer;
-	VkDeviceMemory stagingBufferMemory;
+void VulkanClass::createReadbackBuffer(VkDeviceSize size, VkBuffer& buffer, VkDeviceMemory& memory, void*& map, bool& coherent) {
 
 	VkBufferCreateInfo bufferInfo{};
 	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	bufferInfo.size = size;
 	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-	bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
-	bufferInfo.size = bufferSize;
 
-	vkCreateBuffer(logicalDevice, &bufferInfo, nullptr, &stagingBuffer);
+	if (vkCreateBuffer(logicalDevice, &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to Create Readback Buffer\n");
+	}
 
 	VkMemoryRequirements memReq;
-	vkGetBufferMemoryRequirements(logicalDevice, stagingBuffer, &memReq);
+	vkGetBufferMemoryRequirements(logicalDevice, buffer, &memReq);
 
+	// Reads through uncached write-combined memory are very slow, so prefer host cached memory even if it isn't coherent.
 	VkMemoryAllocateInfo allocInfo{};
 	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
 	allocInfo.allocationSize = memReq.size;
-	allocInfo.memoryTypeIndex = findMemoryType(memReq.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
 
-	vkAllocateMemory(logicalDevice, &allocInfo, nullptr, &stagingBufferMemory);
+	try {
+		allocInfo.memoryTypeIndex = findMemoryType(memReq.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
+	}
+	catch (const std::runtime_error&) {
+		allocInfo.memoryTypeIndex = findMemoryType(memReq.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+	}
 
-	vkBindBufferMemory(logicalDevice, stagingBuffer, stagingBufferMemory, 0);
+	VkPhysicalDeviceMemoryProperties memProperties;
+	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+	coherent = (memProperties.memoryTypes[allocInfo.memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
 
-	copyBuffer(ampBuffer, stagingBuffer, bufferSize);
+	if (vkAllocateMemory(logicalDevice, &allocInfo, nullptr, &memory) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to Allocate Readback Memory\n");
+	}
 
-	void* data;
-	vkMapMemory(logicalDevice, stagingBufferMemory, 0, bufferSize, 0, &data);
-	//memcpy(data, ampVolume, bufferSize);
+	vkBindBufferMemory(logicalDevice, buffer, memory, 0);
+	vkMapMemory(logicalDevice, memory, 0, VK_WHOLE_SIZE, 0, &map);
 
-	AmpVolume* ampBufferValidation = reinterpret_cast<AmpVolume*>(data);
+}
 
-	//std::cout << "FIRST ELEMENT - " << ampBufferValidation[0].amp << "\n";
+void VulkanClass::uploadReadback(VkBuffer readback, VkDeviceMemory memory, bool coherent, VkBuffer buffer, VkDeviceSize size) {
 
-	std::cout << midpointsGPU[0] << "\n";
+	if (!coherent) {
+		VkMappedMemoryRange range{};
+		range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+		range.memory = memory;
+		range.size = VK_WHOLE_SIZE;
+		vkFlushMappedMemoryRanges(logicalDevice, 1, &range);
+	}
 
-	std::vector<AmpVolume> ampBufferVector(ampBufferValidation, ampBufferValidation + ampVolumeSize);
+	copyBuffer(readback, buffer, size);
 
-	float max = 0;
-	float min = 1;
-	std::vector<float> count;
+}
 
-	for (unsigned int i = 0; i < ampVolumeSize; i++) {
-		if (ampBufferVector[i].amp > max) {
-			max = ampBufferVector[i].amp;
-		}
-		if (ampBufferVector[i].amp < min) {
-			min = ampBufferVector[i].amp;
-		}
+void VulkanClass::createAmpReadbackBuffer() {
+
+	VkDeviceSize bufferSize = ampBufferBytes;
+
+	createReadbackBuffer(bufferSize, ampReadbackBuffer, ampReadbackMemory, ampReadbackMap, ampReadbackCoherent);
+
+	createReadbackBuffer(ampScaleBytes, ampScaleReadbackBuffer, ampScaleReadbackMemory, ampScaleReadbackMap, ampScaleReadbackCoherent);
+
+	// Starts out as the initial volume, so queries before the first dispatch see what ampBuffer holds.
+	std::vector<float> scales;
+	memcpy(ampReadbackMap, encodeAmpVolume(scales).data(), bufferSize);
+	memcpy(ampScaleReadbackMap, scales.data(), ampScaleBytes);
+
+	// A float volume is read in place; packed ones go through ampDecoded. A sparse pool is read through its brick table.
+	const float* fieldData = static_cast<const float*>(ampReadbackMap);
+	if (ampFormat != AMP_FORMAT_FLOAT) {
+		ampDecoded.resize(ampGpuCells);
+		ampDecodedStale = true;
+		fieldData = ampDecoded.data();
 	}
 
-	std::cout << triangles[0].vertices[2].pos.z;
-	std::cout << triangles[2].vertices[0].pos.z;
+	ampField = AmplitudeField(fieldData, ampGridSize, glm::vec3(extents.xMin, extents.yMin, extents.zMin), AMP_CELL_SIZE, 1, ampLayout, sparseVolume ? &occupancy : nullptr);
 
-	std::cout << max << "\n";
-	std::cout << min << "\n";
+}
 
-	for (unsigned int i = 0; i < ampVolumeSize; i++) {
-		if (ampBufferVector[i].amp < 0 || ampBufferVector[i].amp > 1) {
-			count.push_back(ampBufferVector[i].amp);
-		}
+void VulkanClass::createAmpImage() {
+
+	// A single texel keeps the descriptors valid when the renderer reads ampBuffer instead.
+	glm::uvec3 imageSize = useAmpImage ? ampGridSize : glm::uvec3(1);
+
+	if (useAmpImage) {
+		findSupportedFormat({ AMP_IMAGE_FORMAT }, VK_IMAGE_TILING_OPTIMAL,
+			VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT);
+	}
+
+	VkImageCreateInfo imageInfo{};
+	imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	imageInfo.imageType = VK_IMAGE_TYPE_3D;
+	imageInfo.extent = { imageSize.x, imageSize.y, imageSize.z };
+	imageInfo.mipLevels = 1;
+	imageInfo.arrayLayers = 1;
+	imageInfo.format = AMP_IMAGE_FORMAT;
+	imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	imageInfo.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+	imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	if (vkCreateImage(logicalDevice, &imageInfo, nullptr, &ampImage) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to Create Amplitude Image\n");
 	}
 
-	std::cout << "count of irregular values - " << count.size() << "\n";
+	VkMemoryRequirements memReq;
+	vkGetImageMemoryRequirements(logicalDevice, ampImage, &memReq);
+
+	VkMemoryAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = memReq.size;
+	allocInfo.memoryTypeIndex = findMemoryType(memReq.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+	if (vkAllocateMemory(logicalDevice, &allocInfo, nullptr, &ampImageMemory) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to Allocate Amplitude Image Memory\n");
+	}
+
+	vkBindImageMemory(logicalDevice, ampImage, ampImageMemory, 0);
+
+	VkImageViewCreateInfo viewInfo{};
+	viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	viewInfo.image = ampImage;
+	viewInfo.viewType = VK_IMAGE_VIEW_TYPE_3D;
+	viewInfo.format = AMP_IMAGE_FORMAT;
+	viewInfo.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+
+	if (vkCreateImageView(logicalDevice, &viewInfo, nullptr, &ampImageView) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to Create Amplitude Image View\n");
+	}
+
+	// Trilinear between cell centres, clamped at the grid faces like AmplitudeField::sample.
+	VkSamplerCreateInfo samplerInfo{};
+	samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	samplerInfo.magFilter = VK_FILTER_LINEAR;
+	samplerInfo.minFilter = VK_FILTER_LINEAR;
+	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.maxLod = 0.0f;
+
+	if (vkCreateSampler(logicalDevice, &samplerInfo, nullptr, &ampSampler) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to Create Amplitude Sampler\n");
+	}
+
+	// Move to GENERAL once and clear, so cells the first solve skips read as silent rather than garbage.
+	VkCommandBufferAllocateInfo commandInfo{};
+	commandInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	commandInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	commandInfo.commandPool = commandPool;
+	commandInfo.commandBufferCount = 1;
+
+	VkCommandBuffer commandBuffer;
+	vkAllocateCommandBuffers(logicalDevice, &commandInfo, &commandBuffer);
+
+	VkCommandBufferBeginInfo beginInfo{};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+	vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+	VkImageMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.srcAccessMask = 0;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = ampImage;
+	barrier.subresourceRange = viewInfo.subresourceRange;
+
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+	VkClearColorValue clear{};
+	vkCmdClearColorImage(commandBuffer, ampImage, VK_IMAGE_LAYOUT_GENERAL, &clear, 1, &viewInfo.subresourceRange);
+
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+	vkEndCommandBuffer(commandBuffer);
+
+	VkSubmitInfo submitInfo{};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &commandBuffer;
+
+	vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
+	vkQueueWaitIdle(graphicsQueue);
+
+	vkFreeCommandBuffers(logicalDevice, commandPool, 1, &commandBuffer);
+
+	if (useAmpImage) {
+		std::cout << "AMPLITUDE IMAGE - " << imageSize.x << " X " << imageSize.y << " X " << imageSize.z << " | " << (memReq.size >> 20) << " MB\n";
+	}
+
+}
+
+void VulkanClass::waitForReadback() {
+
+	vkWaitForFences(logicalDevice, 1, &computeInFlightFence, VK_TRUE, UINT64_MAX);
+
+	std::vector<VkMappedMemoryRange> ranges;
+	for (auto readback : { std::make_pair(ampReadbackMemory, ampReadbackCoherent), std::make_pair(ampScaleReadbackMemory, ampScaleReadbackCoherent),
+		std::make_pair(bandReadbackMemory, bandReadbackCoherent), std::make_pair(channelReadbackMemory, channelReadbackCoherent) }) {
+		if (!readback.second) {
+			VkMappedMemoryRange range{};
+			range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+			range.memory = readback.first;
+			range.size = VK_WHOLE_SIZE;
+			ranges.push_back(range);
+		}
+	}
+
+	if (!ranges.empty()) {
+		vkInvalidateMappedMemoryRanges(logicalDevice, static_cast<uint32_t>(ranges.size()), ranges.data());
+	}
+
+}
+
+const AmplitudeField& VulkanClass::getAmplitudeField() {
+
+	if (cpuOnly) {
+		ampField = AmplitudeField(reinterpret_cast<const float*>(ampVolume), ampGridSize, glm::vec3(extents.xMin, extents.yMin, extents.zMin), AMP_CELL_SIZE, 1, ampLayout);
+		return ampField;
+	}
+
+	waitForReadback();
+
+	if (ampDecodedStale && ampFormat != AMP_FORMAT_FLOAT) {
+		const uint32_t* words = static_cast<const uint32_t*>(ampReadbackMap);
+		const float* scales = static_cast<const float*>(ampScaleReadbackMap);
+
+		for (size_t i = 0; i < ampGpuCells; i++) {
+			int cell = static_cast<int>(i);
+			float scale = ampFormat == AMP_FORMAT_LOG8 ? scales[ampScaleIndex(cell)] : 1.0f;
+			ampDecoded[i] = ampDecodeCell(words[ampWordIndex(cell, ampFormat)], cell, ampFormat, scale);
+		}
+	}
+
+	ampDecodedStale = false;
+
+	return ampField;
+
+}
+
+void VulkanClass::solveOnCPU() {
+
+	refineForSource();
+
+	CPUSolver solver(positions, faces, bvh, bvhTriangles, diffractionEdges, extents, ampGridSize, ampLayout);
+	solver.setOccupancy(sparseVolume ? &occupancy : nullptr);
+
+	auto solveStart = std::chrono::high_resolution_clock::now();
+
+	bandVolume.resize(ampVolumeSize);
+
+	solver.solve(sourcePos, ampVolume, bandVolume.data());
+
+	// Keep only what the chosen format can hold, so CPU and GPU solves read back alike. LOG8 runs are taken
+	// over the dense volume, which matches the GPU's for every cell but a sparse pool's far field ones.
+	if (ampFormat != AMP_FORMAT_FLOAT) {
+		std::vector<float> scales = findAmpScales(ampVolume, ampVolumeSize);
+
+		for (size_t i = 0; i < ampVolumeSize; i++) {
+			float scale = scales[ampScaleIndex(static_cast<int>(i))];
+			ampVolume[i].amp = ampDecode(ampEncode(ampVolume[i].amp, ampFormat, scale), ampFormat, scale);
+		}
+	}
+
+	double solveTime = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - solveStart).count();
+
+	if (!sources.empty()) {
+		sourceChannels.resize(ampVolumeSize);
+
+		auto sourcesStart = std::chrono::high_resolution_clock::now();
+
+		solver.solveSources(sources, sourceChannels.data());
+
+		double sourcesTime = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - sourcesStart).count();
+
+		std::cout << "CPU SOURCES TIME - " << sourcesTime * 1000.0 << " ms | " << sources.size() << " SOURCES\n";
+	}
+
+	std::cout << "CPU SOLVE TIME - " << solveTime * 1000.0 << " ms | " << (ampCellCount / solveTime) / 1000000.0 << " MRAYS/S\n";
+
+	if (!cpuOnly) {
+		uploadAmpVolume();
+		std::vector<float> scales;
+		memcpy(ampReadbackMap, encodeAmpVolume(scales).data(), ampBufferBytes);
+		memcpy(ampScaleReadbackMap, scales.data(), ampScaleBytes);
+		ampDecodedStale = true;
+		if (sparseVolume) {
+			occupancy.gather(bandVolume.data(), static_cast<BandAmplitude*>(bandReadbackMap), ampLayout);
+			if (!sources.empty()) {
+				occupancy.gather(sourceChannels.data(), static_cast<SourceChannels*>(channelReadbackMap), ampLayout);
+			}
+		}
+		else {
+			memcpy(bandReadbackMap, bandVolume.data(), sizeof(BandAmplitude) * ampVolumeSize);
+			if (!sources.empty()) {
+				memcpy(channelReadbackMap, sourceChannels.data(), sizeof(SourceChannels) * ampVolumeSize);
+			}
+		}
+
+		// The host copies are what gets read; the device ones are kept in step for later incremental solves.
+		uploadReadback(bandReadbackBuffer, bandReadbackMemory, bandReadbackCoherent, bandBuffer, sizeof(BandAmplitude) * ampGpuCells);
+		if (!sources.empty()) {
+			uploadReadback(channelReadbackBuffer, channelReadbackMemory, channelReadbackCoherent, channelBuffer, sizeof(SourceChannels) * channelCells);
+		}
+	}
+
+}
+
+void VulkanClass::benchmarkTraversal(uint32_t rays) {
+
+	loadCachedTriangles();
+
+	CPUSolver solver(positions, faces, bvh, bvhTriangles, diffractionEdges, extents, ampGridSize, ampLayout);
+
+	// Same cell to source segments the solver traces, fixed seed so runs are comparable.
+	srand(1);
+
+	std::vector<glm::ivec3> cells(rays);
+	for (auto& cell : cells) {
+		cell = glm::ivec3(rand() % ampGridSize.x, rand() % ampGridSize.y, rand() % ampGridSize.z);
+	}
+
+	auto cellPos = [&](const glm::ivec3& cell) {
+		return glm::vec3(cell) * AMP_CELL_SIZE + glm::vec3(AMP_CELL_SIZE / 2.0f) + glm::vec3(extents.xMin, extents.yMin, extents.zMin);
+	};
+
+	uint32_t scalarHits = 0;
+	uint32_t packetHits = 0;
+	float t;
+
+	auto scalarStart = std::chrono::high_resolution_clock::now();
+	for (const auto& cell : cells) {
+		scalarHits += bvh.intersect(triangles, cellPos(cell), sourcePos, extents, t) ? 1 : 0;
+	}
+	double scalarTime = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - scalarStart).count();
+
+	auto packetStart = std::chrono::high_resolution_clock::now();
+	for (const auto& cell : cells) {
+		packetHits += solver.traverse(cellPos(cell), sourcePos, cell, t) ? 1 : 0;
+	}
+	double packetTime = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - packetStart).count();
+
+	std::cout << "TRAVERSAL BENCHMARK - " << rays << " RAYS | " << triangles.size() << " TRIANGLES | " << packetHits << " OCCLUDED\n";
+	std::cout << "SINGLE THREAD - SCALAR " << (rays / scalarTime) / 1000000.0 << " MRAYS/S | " << PACKET_WIDTH << " WIDE PACKETS " << (rays / packetTime) / 1000000.0 << " MRAYS/S\n";
+
+	if (scalarHits != packetHits) {
+		std::cout << "WARNING - SCALAR AND PACKET TRAVERSAL DISAGREE ON " << (scalarHits > packetHits ? scalarHits - packetHits : packetHits - scalarHits) << " RAYS\n";
+	}
+
+}
+
+void VulkanClass::benchmarkRaymarch(uint32_t rays) {
+
+	std::vector<float> expanded;
+	const float* amps = denseAmplitudes(expanded);
+	glm::ivec3 extent = glm::ivec3(ampGridSize);
+
+	// Random rays stepped one cell at a time through the solved volume, reading the nearest cell, which is
+	// the access pattern the fragment shader's ray march puts on the volume. Fixed seed so layouts compare.
+	srand(1);
+
+	std::vector<glm::vec3> starts(rays);
+	std::vector<glm::vec3> directions(rays);
+	for (uint32_t i = 0; i < rays; i++) {
+		starts[i] = glm::vec3(rand() % extent.x, rand() % extent.y, rand() % extent.z) + glm::vec3(0.5f);
+
+		glm::vec3 direction = glm::vec3(rand(), rand(), rand()) / float(RAND_MAX) * 2.0f - 1.0f;
+		directions[i] = glm::length(direction) > 0.001f ? glm::normalize(direction) : glm::vec3(1.0f, 0.0f, 0.0f);
+	}
+
+	size_t samples = 0;
+	float sum = 0.0f;
+
+	auto marchStart = std::chrono::high_resolution_clock::now();
+	for (uint32_t i = 0; i < rays; i++) {
+		glm::vec3 pos = starts[i];
+		glm::ivec3 cell = glm::ivec3(pos);
+
+		while (glm::all(glm::greaterThanEqual(cell, glm::ivec3(0))) && glm::all(glm::lessThan(cell, extent))) {
+			sum += amps[ampCellIndex(cell, extent, ampLayout)];
+			samples++;
+
+			pos += directions[i];
+			cell = glm::ivec3(glm::floor(pos));
+		}
+	}
+	double marchTime = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - marchStart).count();
+
+	std::cout << "RAYMARCH BENCHMARK - " << AMP_LAYOUT_NAMES[ampLayout] << " LAYOUT | " << rays << " RAYS | " << samples << " SAMPLES | " << (samples / marchTime) / 1000000.0 << " MSAMPLES/S (" << sum / std::max<size_t>(samples, 1) << " MEAN)\n";
+
+}
+
+// Output files are always in linear order, so a bricked volume is gathered back a row at a time.
+template <typename T>
+static void writeCells(std::ofstream& file, const T* cells, const glm::uvec3& gridSize, int layout) {
+
+	if (layout == AMP_LAYOUT_LINEAR) {
+		file.write(reinterpret_cast<const char*>(cells), sizeof(T) * gridSize.x * gridSize.y * gridSize.z);
+		return;
+	}
+
+	std::vector<T> row(gridSize.x);
+
+	for (uint32_t z = 0; z < gridSize.z; z++) {
+		for (uint32_t y = 0; y < gridSize.y; y++) {
+			for (uint32_t x = 0; x < gridSize.x; x++) {
+				row[x] = cells[ampCellIndex(glm::ivec3(x, y, z), glm::ivec3(gridSize), layout)];
+			}
+
+			file.write(reinterpret_cast<const char*>(row.data()), sizeof(T) * row.size());
+		}
+	}
+
+}
+
+void VulkanClass::writeSourceChannels(const std::string& path) {
+
+	std::ofstream file(path, std::ios::binary);
+
+	if (!file.is_open()) {
+		throw std::runtime_error("Failed to Open Source Channel Output File\n");
+	}
+
+	// Same header as writeAmpBuffer, followed by one SourceChannels per cell in the same order.
+	AmpFileHeader header{};
+	memcpy(header.magic, "AMPC", 4);
+	header.gridExtent[0] = ampGridSize.x;
+	header.gridExtent[1] = ampGridSize.y;
+	header.gridExtent[2] = ampGridSize.z;
+	header.cellSize = AMP_CELL_SIZE;
+	header.gridMin[0] = extents.xMin;
+	header.gridMin[1] = extents.yMin;
+	header.gridMin[2] = extents.zMin;
+
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+	std::vector<SourceChannels> expanded;
+	writeCells(file, denseChannels(expanded), ampGridSize, ampLayout);
+
+	if (!file.good()) {
+		throw std::runtime_error("Failed to Write Source Channel Output File\n");
+	}
+
+	std::cout << "SOURCE CHANNELS WRITTEN - " << path << " (" << sources.size() << " SOURCES)\n";
+
+}
+
+void VulkanClass::writeBandVolume(const std::string& path) {
+
+	std::ofstream file(path, std::ios::binary);
+
+	if (!file.is_open()) {
+		throw std::runtime_error("Failed to Open Band Output File\n");
+	}
+
+	// Same header as writeAmpBuffer, followed by BAND_COUNT floats per cell, 63 Hz band first.
+	AmpFileHeader header{};
+	memcpy(header.magic, "AMPB", 4);
+	header.gridExtent[0] = ampGridSize.x;
+	header.gridExtent[1] = ampGridSize.y;
+	header.gridExtent[2] = ampGridSize.z;
+	header.cellSize = AMP_CELL_SIZE;
+	header.gridMin[0] = extents.xMin;
+	header.gridMin[1] = extents.yMin;
+	header.gridMin[2] = extents.zMin;
+
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+	std::vector<BandAmplitude> expanded;
+	writeCells(file, denseBands(expanded), ampGridSize, ampLayout);
+
+	if (!file.good()) {
+		throw std::runtime_error("Failed to Write Band Output File\n");
+	}
+
+	std::cout << "BAND VOLUME WRITTEN - " << path << " (" << BAND_COUNT << " BANDS)\n";
+
+}
+
+BandAmplitude VulkanClass::sampleBands(const glm::vec3& pos) {
+
+	if (!cpuOnly) {
+		waitForReadback();
+	}
+
+	const void* volume = cpuOnly ? static_cast<const void*>(bandVolume.data()) : bandReadbackMap;
+	const SparseVolume* sparse = sparseVolume && !cpuOnly ? &occupancy : nullptr;
+	AmplitudeField bandField(static_cast<const float*>(volume), ampGridSize, glm::vec3(extents.xMin, extents.yMin, extents.zMin), AMP_CELL_SIZE, BAND_COUNT, ampLayout, sparse);
+
+	BandAmplitude result{};
+
+	for (int band = 0; band < BAND_COUNT; band++) {
+		result.amp[band] = bandField.sample(pos, band);
+	}
+
+	return result;
+
+}
+
+SourceChannels VulkanClass::sampleChannels(const glm::vec3& pos) {
+
+	if (!cpuOnly) {
+		waitForReadback();
+	}
+
+	const SourceChannels* volume = cpuOnly ? sourceChannels.data() : static_cast<const SourceChannels*>(channelReadbackMap);
+
+	glm::uvec3 cell = glm::uvec3(glm::clamp(getAmpCellID(pos, extents), glm::ivec3(0), glm::ivec3(ampGridSize) - glm::ivec3(1)));
+
+	if (sparseVolume && !cpuOnly) {
+		int poolCell = occupancy.poolCell(glm::ivec3(cell));
+
+		if (poolCell < 0) {
+			SourceChannels silent{};
+			std::fill(silent.source, silent.source + TOP_SOURCES, 0xFFFFFFFFu);
+			return silent;
+		}
+
+		return volume[poolCell];
+	}
+
+	return volume[ampCellIndex(glm::ivec3(cell), glm::ivec3(ampGridSize), ampLayout)];
+
+}
+
+std::vector<uint32_t> VulkanClass::encodeAmpVolume(std::vector<float>& scales) {
+
+	std::vector<uint32_t> words(ampBufferBytes / sizeof(uint32_t), 0u);
+
+	// ampBuffer holds the pool of a sparse volume.
+	const AmpVolume* cells = ampVolume;
+	std::vector<AmpVolume> pool;
+	if (sparseVolume) {
+		pool.resize(ampGpuCells);
+		occupancy.gather(ampVolume, pool.data(), ampLayout);
+		cells = pool.data();
+	}
+
+	scales = findAmpScales(cells, ampGpuCells);
+
+	for (size_t i = 0; i < ampGpuCells; i++) {
+		int cell = static_cast<int>(i);
+		words[ampWordIndex(cell, ampFormat)] |= ampEncode(cells[i].amp, ampFormat, scales[ampScaleIndex(cell)]) << ampElementShift(cell, ampFormat);
+	}
+
+	return words;
+
+}
+
+// The loudest amplitude of every AMP_SCALE_CELLS run under LOG8, as the direct and diffraction passes find it; 1 otherwise.
+std::vector<float> VulkanClass::findAmpScales(const AmpVolume* cells, size_t count) {
+
+	std::vector<float> scales(ampScaleCount(static_cast<int>(count)), ampFormat == AMP_FORMAT_LOG8 ? 0.0f : 1.0f);
+
+	if (ampFormat == AMP_FORMAT_LOG8) {
+		for (size_t i = 0; i < count; i++) {
+			float& scale = scales[ampScaleIndex(static_cast<int>(i))];
+			scale = std::max(scale, cells[i].amp);
+		}
+	}
+
+	return scales;
+
+}
+
+void VulkanClass::uploadAmpScales(const std::vector<float>& scales) {
+
+	VkBuffer stagingBuffer;
+	VkDeviceMemory stagingBufferMemory;
+
+	createHostBuffer(scales.data(), ampScaleBytes, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, stagingBuffer, stagingBufferMemory);
+
+	copyBuffer(stagingBuffer, ampScaleBuffer, ampScaleBytes);
+
+	vkDestroyBuffer(logicalDevice, stagingBuffer, nullptr);
+	vkFreeMemory(logicalDevice, stagingBufferMemory, nullptr);
+
+}
+
+const float* VulkanClass::denseAmplitudes(std::vector<float>& expanded) {
+
+	const float* amps = getAmplitudeField().getData();
+
+	if (cpuOnly || !sparseVolume) {
+		return amps;
+	}
+
+	expanded.assign(ampVolumeSize, 0.0f);
+	occupancy.expand(amps, expanded.data(), ampLayout, 0.0f);
+	return expanded.data();
+
+}
+
+const BandAmplitude* VulkanClass::denseBands(std::vector<BandAmplitude>& expanded) {
+
+	if (cpuOnly) {
+		return bandVolume.data();
+	}
+
+	waitForReadback();
+
+	const BandAmplitude* bands = static_cast<const BandAmplitude*>(bandReadbackMap);
+
+	if (!sparseVolume) {
+		return bands;
+	}
+
+	expanded.assign(ampVolumeSize, BandAmplitude{});
+	occupancy.expand(bands, expanded.data(), ampLayout, BandAmplitude{});
+	return expanded.data();
+
+}
+
+const SourceChannels* VulkanClass::denseChannels(std::vector<SourceChannels>& expanded) {
+
+	if (cpuOnly) {
+		return sourceChannels.data();
+	}
+
+	waitForReadback();
+
+	const SourceChannels* channels = static_cast<const SourceChannels*>(channelReadbackMap);
+
+	if (!sparseVolume) {
+		return channels;
+	}
+
+	SourceChannels silent{};
+	std::fill(silent.source, silent.source + TOP_SOURCES, 0xFFFFFFFFu);
+
+	expanded.assign(ampVolumeSize, silent);
+	occupancy.expand(channels, expanded.data(), ampLayout, silent);
+	return expanded.data();
+
+}
+
+void VulkanClass::uploadAmpVolume() {
+
+	VkDeviceSize bufferSize = ampBufferBytes;
+	std::vector<float> scales;
+	std::vector<uint32_t> words = encodeAmpVolume(scales);
+
+	VkBuffer stagingBuffer;
+	VkDeviceMemory stagingBufferMemory;
+
+	createHostBuffer(words.data(), bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, stagingBuffer, stagingBufferMemory);
+
+	copyBuffer(stagingBuffer, ampBuffer, bufferSize);
+
+	vkDestroyBuffer(logicalDevice, stagingBuffer, nullptr);
+	vkFreeMemory(logicalDevice, stagingBufferMemory, nullptr);
+
+	uploadAmpScales(scales);
+
+}
+
+void VulkanClass::writeAmpBuffer(const std::string& path) {
+
+	std::ofstream file(path, std::ios::binary);
+
+	if (!file.is_open()) {
+		throw std::runtime_error("Failed to Open Amplitude Output File\n");
+	}
+
+	const char* magic[] = { "AMPV", "AMPH", "AMP8" };
+
+	AmpFileHeader header{};
+	memcpy(header.magic, magic[ampFormat], 4);
+	header.gridExtent[0] = ampGridSize.x;
+	header.gridExtent[1] = ampGridSize.y;
+	header.gridExtent[2] = ampGridSize.z;
+	header.cellSize = AMP_CELL_SIZE;
+	header.gridMin[0] = extents.xMin;
+	header.gridMin[1] = extents.yMin;
+	header.gridMin[2] = extents.zMin;
+
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+	// A CPU solve already has the volume in host memory, a dense GPU solve is already in the mapped readback.
+	std::vector<float> expanded;
+	const float* amps = denseAmplitudes(expanded);
+
+	if (ampFormat == AMP_FORMAT_FLOAT) {
+		writeCells(file, amps, ampGridSize, ampLayout);
+	}
+	else {
+		// HALF values re-encode to the codes the solve stored. LOG8 files carry no scales, so codes are written at a scale of 1.
+		std::vector<float> linear(ampCellCount);
+		for (uint32_t z = 0; z < ampGridSize.z; z++) {
+			for (uint32_t y = 0; y < ampGridSize.y; y++) {
+				for (uint32_t x = 0; x < ampGridSize.x; x++) {
+					linear[x + size_t(y) * ampGridSize.x + size_t(z) * ampGridSize.x * ampGridSize.y] = amps[ampCellIndex(glm::ivec3(x, y, z), glm::ivec3(ampGridSize), ampLayout)];
+				}
+			}
+		}
+
+		if (ampFormat == AMP_FORMAT_HALF) {
+			std::vector<uint16_t> elements(ampCellCount);
+			std::transform(linear.begin(), linear.end(), elements.begin(), [](float amp) { return static_cast<uint16_t>(ampEncode(amp, AMP_FORMAT_HALF, 1.0f)); });
+			file.write(reinterpret_cast<const char*>(elements.data()), sizeof(uint16_t) * elements.size());
+		}
+		else {
+			std::vector<uint8_t> elements(ampCellCount);
+			std::transform(linear.begin(), linear.end(), elements.begin(), [](float amp) { return static_cast<uint8_t>(ampEncode(amp, AMP_FORMAT_LOG8, 1.0f)); });
+			file.write(reinterpret_cast<const char*>(elements.data()), elements.size());
+		}
+	}
+
+	if (!file.good()) {
+		throw std::runtime_error("Failed to Write Amplitude Output File\n");
+	}
+
+	std::cout << "AMPLITUDE VOLUME WRITTEN - " << path << " (" << ampGridSize.x << " X " << ampGridSize.y << " X " << ampGridSize.z << ", " << AMP_FORMAT_NAMES[ampFormat] << ")\n";
+
+}
+
+void VulkanClass::validateAmpBuffer() {
+
+	std::vector<float> expanded;
+	const float* amps = denseAmplitudes(expanded);
+
+	float max = 0;
+	float min = 1;
+	size_t irregular = 0;
+
+	// Only real cells; the bricked layout's padding is never solved.
+	for (uint32_t z = 0; z < ampGridSize.z; z++) {
+		for (uint32_t y = 0; y < ampGridSize.y; y++) {
+			for (uint32_t x = 0; x < ampGridSize.x; x++) {
+				float amp = amps[ampCellIndex(glm::ivec3(x, y, z), glm::ivec3(ampGridSize), ampLayout)];
+				max = std::max(max, amp);
+				min = std::min(min, amp);
+
+				if (amp < 0 || amp > 1) {
+					irregular++;
+				}
+			}
+		}
+	}
+
+	std::cout << max << "\n";
+	std::cout << min << "\n";
+
+	std::cout << "count of irregular values - " << irregular << "\n";
 
-	vkDestroyBuffer(logicalDevice, stagingBuffer, nullptr);
-	vkFreeMemory(logicalDevice, stagingBufferMemory, nullptr);
 }
 
 void VulkanClass::createImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory) {
@@ -17,6 +17,31 @@
 #include <vector>
 
 #include "Shaders.h"
+#include "Geometry.h"
+#include "BVH.h"
+#include "CPUSolver.h"
+#include "AmplitudeField.h"
+#include "SparseVolume.h"
+#include "DiffractionEdges.h"
+#include "GpuProfiler.h"
+#include "SceneCache.h"
+
+// Format of the 3D amplitude image. Must match AMP_IMAGE_FORMAT in shader.comp (r16f here, r32f for VK_FORMAT_R32_SFLOAT).
+const VkFormat AMP_IMAGE_FORMAT = VK_FORMAT_R16_SFLOAT;
+
+// Far field bricks the pool keeps room to refine past what the starting source needed: twice as many, and
+// at least this many, so a moved source can refine without reallocating the per cell buffers.
+const uint32_t REFINE_CAPACITY_MIN = 64;
+
+// The dispatches of one solve in the order they run, matching SOLVE_PASS_* in shader.comp. Each only reads
+// what the ones before it finished: visibility bits and hit distances, then the direct sound, then diffraction.
+// The pack pass only runs for LOG8, whose codes wait on the per run scale the two before it find.
+enum SolvePass { SOLVE_PASS_VISIBILITY, SOLVE_PASS_DIRECT, SOLVE_PASS_DIFFRACTION, SOLVE_PASS_PACK, SOLVE_PASS_COUNT };
+
+// How the visibility pass traces (--traversal), matching TRAVERSAL_* in shader.comp: the BVH, or the 8x8x8
+// grid walk it replaced, finding each cell's triangles through the offsets scan or by re-summing the sizes before it.
+enum Traversal { TRAVERSAL_BVH, TRAVERSAL_GRID, TRAVERSAL_GRID_RESCAN };
+const char* const TRAVERSAL_NAMES[] = { "BVH", "GRID", "GRID-RESCAN" };
 
 struct Transform {
 	glm::mat4 M;
@@ -27,46 +52,26 @@ struct Transform {
 	glm::vec3 cameraFront;
 };
 
-struct Vertex {
-	glm::vec4 pos;
-	glm::vec4 normal;
-
-	bool operator == (Vertex v) {
-		if (v.pos == pos && v.normal == normal) {
-			return true;
-		}
-
-		return false;
-	}
+// std140 Scene block shared by shader.comp and shader.frag (binding 1 of the transform set).
+struct SceneUniform {
+	// xyz = amplitude grid size, w = number of entries in the source buffer.
+	glm::ivec4 gridExtent;
+	glm::vec4 gridOffset;
+	glm::vec4 sourcePos;
+	// Source of the last finished solve. w is 1 when shader.comp may keep cells that saw it, 0 for a full solve.
+	glm::vec4 previousSourcePos;
 };
 
-struct ModelExtent {
-
-	float xMin;
-	float xMax;
-	float yMin;
-	float yMax;
-	float zMin;
-	float zMax;
-
+// Written in front of the raw amplitudes by writeAmpBuffer. Amplitudes follow in x, then y, then z order
+// whatever layout the volume was solved in, one element per cell in the volume's format: 32 bit floats
+// after "AMPV", fp16 after "AMPH", 8 bit log codes (ampDecode in AmpLayout.h) at a scale of 1 after "AMP8".
+struct AmpFileHeader {
+	char magic[4];
+	uint32_t gridExtent[3];
+	float cellSize;
+	float gridMin[3];
 };
 
-struct Triangle {
-	Vertex vertices[3];
-
-	bool operator == (Triangle t) {
-		
-		for (int i = 0; i < 3; i++) {
-			if (t.vertices[i] != vertices[i]) {
-				return false;
-			}
-		}
-
-		return true;
-	}
-};
-
-
 struct QueueFamily {
 
 	uint32_t graphicsFamily;
@@ -83,12 +88,6 @@ struct SwapChainSupport {
 
 };
 
-struct AmpVolume {
-
-	float amp;
-
-};
-
 struct SwapChain {
 
 	VkSwapchainKHR __swapChain;
@@ -114,6 +113,8 @@ class VulkanClass {
 private:
 
 	bool enableValidationLayers = true;
+	bool headless = false;
+	bool cpuOnly = false;
 	std::vector<const char*> validationLayers = { "VK_LAYER_KHRONOS_validation" };
 	std::vector<const char*> deviceExtensions = { VK_KHR_SWAPCHAIN_EXTENSION_NAME };
 	QueueFamily QueueFamilyIndex;
@@ -137,14 +138,16 @@ private:
 	VkDescriptorSetLayout posDescriptorSetLayout;
 	VkDescriptorSetLayout midpointsDescriptorSetLayout;
 	VkDescriptorSetLayout sizesDescriptorSetLayout;
+	VkDescriptorSetLayout bvhDescriptorSetLayout;
 	VkDescriptorPool uniformDescriptorPool;
 	VkDescriptorPool ampDescriptorPool;
 	std::vector<VkDescriptorSet> transformDescriptorSet;
 	VkDescriptorPool imguiDescriptorPool;
-	VkDescriptorSet ampDescriptorSet;
+	VkDescriptorSet ampDescriptorSet = VK_NULL_HANDLE;
 	VkDescriptorSet posDescriptorSet;
 	VkDescriptorSet midpointsDescriptorSet;
 	VkDescriptorSet sizesDescriptorSet;
+	VkDescriptorSet bvhDescriptorSet;
 
 	std::vector<VkBuffer> transformBuffer;
 	std::vector<VkDeviceMemory> transformBufferMemory;
@@ -153,10 +156,16 @@ private:
 	std::vector<Vertex> vertices;
 	std::vector<uint32_t> indices;
 	std::vector<Triangle> triangles;
-	std::vector<Triangle> Octree;
+	std::vector<glm::vec4> positions;
+	std::vector<Face> faces;
+	std::vector<uint32_t> Octree;
 	std::vector<std::vector<float>> midpoints;
 	std::vector<float> midpointsGPU;
 	std::vector<unsigned int> Sizes;
+	std::vector<unsigned int> Offsets;
+	BVH bvh;
+	std::vector<PrecomputedTriangle> bvhTriangles;
+	DiffractionEdges diffractionEdges;
 	
 	VkBuffer vertexBuffer;
 	VkDeviceMemory vertexBufferMemory;
@@ -170,11 +179,116 @@ private:
 	VkDeviceMemory ampBufferMemory;
 	void* ampBufferMap;
 
+	// Every compute dispatch ends by copying ampBuffer here. Persistently mapped, host cached when the
+	// device offers it, and wrapped by ampField for listener queries.
+	VkBuffer ampReadbackBuffer;
+	VkDeviceMemory ampReadbackMemory;
+	void* ampReadbackMap;
+	bool ampReadbackCoherent = true;
+	AmplitudeField ampField;
+	// Packed formats are decoded here for ampField after each solve lands in the readback.
+	std::vector<float> ampDecoded;
+	bool ampDecodedStale = false;
+
+	// LOG8 scale per AMP_SCALE_CELLS run of ampBuffer, found by every solve and copied to its readback with
+	// the amplitudes. Always bound; all 1 and never touched by the GPU for the other formats.
+	VkBuffer ampScaleBuffer;
+	VkDeviceMemory ampScaleMemory;
+	VkBuffer ampScaleReadbackBuffer;
+	VkDeviceMemory ampScaleReadbackMemory;
+	void* ampScaleReadbackMap;
+	bool ampScaleReadbackCoherent = true;
+	VkDeviceSize ampScaleBytes;
+
+	// 3D copy of the amplitudes that shader.comp stores alongside ampBuffer and shader.frag samples with
+	// trilinear filtering. Always bound, but only a single texel unless useAmpImage is set. Kept in
+	// VK_IMAGE_LAYOUT_GENERAL for both uses.
+	bool useAmpImage = false;
+	VkImage ampImage;
+	VkDeviceMemory ampImageMemory;
+	VkImageView ampImageView;
+	VkSampler ampSampler;
+
+	// Sparse solve (--sparse): the GPU per cell buffers hold occupancy's brick pool, ampGpuCells cells, and
+	// shader.comp is dispatched indirectly over its open and far field bricks. Host copies stay dense.
+	// The brick table and work list are always bound, as a single solid brick when the solve is dense.
+	bool sparseVolume = false;
+	// Adaptive solve (--refine): above 0, far field bricks the coarse level of the source shows an occlusion
+	// boundary or an amplitude step larger than this across are solved at full resolution. Redone each time
+	// the source moves, up to refineCapacity bricks, the ones nearest the source first; only the bricks that
+	// change class are rewritten and traced again.
+	float refineThreshold = 0.0f;
+	uint32_t refineCapacity = 0;
+	int traversal = TRAVERSAL_BVH;
+	glm::vec3 refinedSourcePos;
+	SparseVolume occupancy;
+	size_t ampGpuCells;
+	VkBuffer brickTableBuffer;
+	VkDeviceMemory brickTableMemory;
+	VkBuffer workBrickBuffer;
+	VkDeviceMemory workBrickMemory;
+	VkBuffer dispatchArgsBuffer;
+	VkDeviceMemory dispatchArgsMemory;
+	void* dispatchArgsMap;
+
+	// Solve timed in slot 0, each frame in flight's draw in its own slot.
+	GpuProfiler gpuProfiler;
+	// Set by initImGui; drawGui and the render pass then draw the profiling panel.
+	bool guiEnabled = false;
+
+	SceneUniform scene;
+	VkBuffer sceneBuffer;
+	VkDeviceMemory sceneBufferMemory;
+	void* sceneBufferMap;
+
+	// Per cell visibility bits plus the traced cell counter, read by shader.comp for incremental re-solves.
+	VkBuffer visibilityBuffer;
+	VkDeviceMemory visibilityBufferMemory;
+	void* visibilityBufferMap;
+	// Distance to the occluder per cell, only ever touched by the GPU between the visibility and diffraction passes,
+	// and under LOG8 the float amplitudes between those and the pack pass.
+	VkBuffer hitBuffer;
+	VkDeviceMemory hitBufferMemory;
+	bool ampSolved = false;
+	glm::vec3 solvedSourcePos;
+	// Set by writeChangedBricks until the next dispatch, whose fresh cells also rewrite their channels.
+	bool freshBricks = false;
+
+	// Multi-source pass: positions and gains in, one SourceChannels per cell out. Sources are host visible
+	// so they can be rewritten in place. Channels are device local, a single cell until loadSources lists
+	// any, and copied to their readback by every full solve that writes them.
+	VkBuffer sourceBuffer;
+	VkDeviceMemory sourceBufferMemory;
+	void* sourceBufferMap;
+	VkBuffer channelBuffer;
+	VkDeviceMemory channelBufferMemory;
+	size_t channelCells = 0;
+	VkBuffer channelReadbackBuffer;
+	VkDeviceMemory channelReadbackMemory;
+	void* channelReadbackMap;
+	bool channelReadbackCoherent = true;
+	std::vector<SourceChannels> sourceChannels;
+
+	// Octave band amplitudes of the primary source, device local and copied to their readback by every full dispatch.
+	VkBuffer bandBuffer;
+	VkDeviceMemory bandBufferMemory;
+	VkBuffer bandReadbackBuffer;
+	VkDeviceMemory bandReadbackMemory;
+	void* bandReadbackMap;
+	bool bandReadbackCoherent = true;
+	std::vector<BandAmplitude> bandVolume;
+
 	unsigned int posBufferSize;
 	VkBuffer posBuffer;
 	VkDeviceMemory posBufferMemory;
 	void* posBufferMap;
 
+	VkBuffer faceBuffer;
+	VkDeviceMemory faceBufferMemory;
+
+	VkBuffer octreeBuffer;
+	VkDeviceMemory octreeBufferMemory;
+
 	VkBuffer midpointsBuffer;
 	VkDeviceMemory midpointsBufferMemory;
 	void* midpointsBufferMap;
@@ -183,12 +297,39 @@ private:
 	VkDeviceMemory sizesBufferMemory;
 	void* sizesBufferMap;
 
+	VkBuffer offsetsBuffer;
+	VkDeviceMemory offsetsBufferMemory;
+
+	VkBuffer bvhNodeBuffer;
+	VkDeviceMemory bvhNodeBufferMemory;
+
+	VkBuffer bvhTriangleBuffer;
+	VkDeviceMemory bvhTriangleBufferMemory;
+
+	VkBuffer bvhFaceIdBuffer;
+	VkDeviceMemory bvhFaceIdBufferMemory;
+
+	// Diffraction edges and their spatial hash, bound after the BVH in the same set.
+	VkBuffer edgeBuffer;
+	VkDeviceMemory edgeBufferMemory;
+
+	VkBuffer edgeBucketStartBuffer;
+	VkDeviceMemory edgeBucketStartBufferMemory;
+
+	VkBuffer edgeBucketBuffer;
+	VkDeviceMemory edgeBucketBufferMemory;
+
 	VkRenderPass renderPass;
 	VkPipelineLayout pipelineLayout;
 	VkPipeline graphicsPipeline;
 
-	VkPipelineLayout computePipelineLayout;
-	VkPipeline computePipeline;
+	VkPipelineLayout computePipelineLayout = VK_NULL_HANDLE;
+	// One per SolvePass, differing only in specialization constant 7.
+	VkPipeline computePipelines[SOLVE_PASS_COUNT] = {};
+
+	// Workgroup size fed to shader.comp through specialization constants 0, 1 and 2.
+	glm::uvec3 computeLocalSize = glm::uvec3(8, 4, 8);
+	glm::uvec3 ampGridSize;
 
 	VkCommandPool commandPool;
 	std::vector<VkCommandBuffer> commandBuffer;
@@ -216,13 +357,33 @@ public:
 	VkFence imGuiFence;
 
 	Transform transform;
-
-	const std::string MODEL_PATH = "models/City.obj";
+	glm::vec3 sourcePos;
+	std::vector<glm::vec4> sources;
+	// Optional audio clip per listed source, empty when the source list gave none.
+	std::vector<std::string> sourceClips;
+
+	std::string MODEL_PATH = "models/City.obj";
+	const std::string WORKGROUP_CACHE_PATH = "workgroup_cache.txt";
+	// Geometry and acceleration structures of MODEL_PATH, kept in MODEL_PATH + ".scene" unless --no-scene-cache.
+	// On a hit the file stays mapped: the vertex buffer is filled straight from it and the debug traversals
+	// read their triangles back from it, so vertices and triangles stay empty.
+	bool useSceneCache = true;
+	bool sceneCached = false;
+	uint64_t sceneCacheKey = 0;
+	SceneCache sceneCache;
 	AmpVolume* ampVolume = nullptr;
+	// Elements in every host per cell array, which the bricked layout pads past ampCellCount.
 	size_t ampVolumeSize;
+	size_t ampCellCount;
+	int ampLayout = AMP_LAYOUT_LINEAR;
+	// Element format of ampBuffer and its readback (AMP_FORMAT_*); ampVolume on the host is always float,
+	// and bandBuffer and channelBuffer are float whatever the format.
+	int ampFormat = AMP_FORMAT_FLOAT;
+	VkDeviceSize ampBufferBytes;
 
 	VulkanClass();
-	VulkanClass(GLFWwindow* win);
+	VulkanClass(GLFWwindow* win, const std::string& modelPath = "models/City.obj", int layout = AMP_LAYOUT_LINEAR, bool volumeImage = false, int format = AMP_FORMAT_FLOAT, bool sparse = false, float refine = 0.0f, bool cache = true, int trace = TRAVERSAL_BVH);
+	VulkanClass(const std::string& modelPath, bool cpuOnly = false, int layout = AMP_LAYOUT_LINEAR, int format = AMP_FORMAT_FLOAT, bool sparse = false, float refine = 0.0f, bool cache = true, int trace = TRAVERSAL_BVH);
 	~VulkanClass();
 
 	std::vector<const char*> getRequiredExtensions();
@@ -230,7 +391,9 @@ public:
 	bool findQueueFamilies(VkPhysicalDevice device);
 	bool checkSwapChainSupport(VkPhysicalDevice device);
 	VkDevice getLogicalDevice() { return logicalDevice; }
+	const ModelExtent& getExtents() { return extents; }
 	uint32_t getMaxFramesInFlight() { return swapChain.MAX_FRAMES_IN_FLIGHT; }
+	GpuProfiler& getGpuProfiler() { return gpuProfiler; }
 	uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties);
 	VkFormat findSupportedFormat(const std::vector<VkFormat>& candidates, VkImageTiling tiling, VkFormatFeatureFlags features);
 	VkFormat findDepthFormat();
@@ -239,6 +402,8 @@ public:
 
 	void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size);
 	void dispatch();
+	uint32_t getTracedCellCount();
+	void tuneComputeWorkgroupSize();
 	void draw(uint32_t& imageIndex);
 
 	//void initVulkan();
@@ -256,12 +421,14 @@ public:
 	void createDescriptorPools();
 	void createAmpDescriptorSetLayout();
 	void createPosDescriptorSetLayout();
+	void createBVHDescriptorSetLayout();
 
 	void createTransformBuffer(VkDeviceSize bufferSize);
 	void createTransformDescriptorSet();
 
 	void createAmpDescriptorSet();
 	void createPosDescriptorSet();
+	void createBVHDescriptorSet();
 
 	void updateTransform();
 
@@ -272,7 +439,7 @@ public:
 	void createCommandPool();
 	void createCommandBuffer();
 
-	void recordComputeCommandBuffer(VkCommandBuffer commandBuffer);
+	void recordComputeCommandBuffer(VkCommandBuffer commandBuffer, uint32_t zLayers);
 	void recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t index, uint32_t currentFrame);
 
 	void createDepthResources();
@@ -280,14 +447,64 @@ public:
 	void createSyncObjects();
 
 	void loadModel();
+	void parseModel();
 	void createVertexBuffer();
 	void createIndexBuffer();
 	void createAmpBuffer();
+	void createAmpReadbackBuffer();
+	void createAmpImage();
+	void createSceneGeometry();
+	void loadSceneCache();
+	void writeSceneCache();
+	void loadCachedTriangles();
+	void createIndexedGeometry();
 	void createOctree();
 	void createTriangleBuffer();
 	void createAuxilaryOctreeBuffers();
+	void createBVH();
+	void createBVHBuffers();
+	void createDiffractionEdges();
+	void createSparseVolume();
+	void refineForSource();
+	void createBrickBuffers();
+	void writeBrickBuffers();
+	void writeChangedBricks(const std::vector<uint32_t>& bricks);
+	void createHostBuffer(const void* data, VkDeviceSize size, VkBufferUsageFlags usage, VkBuffer& buffer, VkDeviceMemory& memory);
+	void createDeviceBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkBuffer& buffer, VkDeviceMemory& memory);
+	// Persistently mapped copy target for a device local buffer; coherent reports whether it needs flushes and invalidates.
+	void createReadbackBuffer(VkDeviceSize size, VkBuffer& buffer, VkDeviceMemory& memory, void*& map, bool& coherent);
+	// Copies what the host wrote into a readback up to its device buffer, as a CPU solve does.
+	void uploadReadback(VkBuffer readback, VkDeviceMemory memory, bool coherent, VkBuffer buffer, VkDeviceSize size);
+	void createSceneBuffer();
+	void createVisibilityBuffer();
+	void createSourceBuffers();
+	void createChannelBuffers(size_t cells);
+	void destroyChannelBuffers();
+	void loadSources(const std::string& path);
+	void setupScene();
 
 	void validateAmpBuffer();
+	void writeAmpBuffer(const std::string& path);
+	void writeSourceChannels(const std::string& path);
+	void writeBandVolume(const std::string& path);
+	// Waits for the last dispatch to land in the readbacks, so call it after dispatch() rather than before.
+	void waitForReadback();
+	const AmplitudeField& getAmplitudeField();
+	BandAmplitude sampleBands(const glm::vec3& pos);
+	SourceChannels sampleChannels(const glm::vec3& pos);
+	void solveOnCPU();
+	void benchmarkTraversal(uint32_t rays);
+	void benchmarkRaymarch(uint32_t rays);
+	void uploadAmpVolume();
+	std::vector<uint32_t> encodeAmpVolume(std::vector<float>& scales);
+	std::vector<float> findAmpScales(const AmpVolume* cells, size_t count);
+	void uploadAmpScales(const std::vector<float>& scales);
+	// Dense copies of the GPU side volumes, expanded from the pool when the solve is sparse; expanded is scratch for that.
+	const float* denseAmplitudes(std::vector<float>& expanded);
+	const BandAmplitude* denseBands(std::vector<BandAmplitude>& expanded);
+	const SourceChannels* denseChannels(std::vector<SourceChannels>& expanded);
+	bool gridIntersect(const glm::vec3& start, const glm::vec3& end, float& closestT, bool rescan = false);
+	void validateBVH(uint32_t samples);
 
 	void initImGui();
 	void drawGui();